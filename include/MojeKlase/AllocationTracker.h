@@ -0,0 +1,209 @@
+#ifndef PROJECT_BASE_ALLOCATIONTRACKER_H
+#define PROJECT_BASE_ALLOCATIONTRACKER_H
+
+#include <iostream>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <execinfo.h>
+#include <unistd.h>
+
+// frames before strict mode starts failing, long enough for lazy textures and shaders to have come in
+const unsigned int ALLOCATION_WARMUP_FRAMES = 600;
+const unsigned int ALLOCATION_REPORT_FRAMES = 600;
+// frames after the warm-up that allocated outside streaming get a line each, up to this many
+const unsigned int ALLOCATION_SPIKE_LINES = 20;
+
+// the part of the frame loop the main thread is in
+enum AllocationScopeId
+{
+    SCOPE_OTHER = 0,        // main thread outside the scopes below
+    SCOPE_INPUT,
+    SCOPE_UPDATE,
+    SCOPE_DRAW_SKYBOX,
+    SCOPE_DRAW,
+    SCOPE_STREAMING,        // textures, rooms, shader variants and impostor bakes coming in as the view moves
+    SCOPE_WORKERS,          // every other thread: jobs, decodes, the shader compiler
+    SCOPE_COUNT
+};
+
+// Counts operator new per scope and frame. The counting itself is in the replacement operator new that
+// main.cpp defines when built with TRACK_ALLOCATIONS (cmake -DTRACK_ALLOCATIONS=ON); without it everything
+// here stays at zero and prints nothing. malloc from C libraries and the GL driver is not seen.
+// Strict mode aborts with a stack trace on the first main thread allocation after the warm-up. Streaming
+// is exempt: it is counted and reported, but new textures and rooms coming into view are expected to
+// allocate. The F keys start model loads and print reports, so strict runs should leave them alone.
+class AllocationTracker
+{
+public:
+    static AllocationTracker& instance()
+    {
+        // constant initialized, usable from operator new before main
+        static AllocationTracker tracker;
+        return tracker;
+    }
+
+    static int& currentScope()
+    {
+        static thread_local int scope = SCOPE_WORKERS;
+        return scope;
+    }
+
+    static bool& paused()
+    {
+        static thread_local bool value = false;
+        return value;
+    }
+
+    // main thread, right before the frame loop
+    void start(bool strictMode)
+    {
+        currentScope() = SCOPE_OTHER;
+#ifdef TRACK_ALLOCATIONS
+        strict = strictMode;
+        // the first backtrace() loads libgcc, which must not happen inside operator new
+        void* frames[1];
+        backtrace(frames, 1);
+        std::cout << "allocation tracking on" << (strictMode ? ", strict" : "") << ", warm-up " << ALLOCATION_WARMUP_FRAMES
+                  << " frames" << std::endl;
+#else
+        if(strictMode)
+            std::cout << "strict allocation checks need a build with TRACK_ALLOCATIONS" << std::endl;
+#endif
+    }
+
+    // from operator new
+    void record(size_t bytes)
+    {
+        if(paused())
+            return;
+        int scope = currentScope();
+        frameCounts[scope].fetch_add(1, std::memory_order_relaxed);
+        frameBytes[scope].fetch_add(bytes, std::memory_order_relaxed);
+        if(strict.load(std::memory_order_relaxed) && warm.load(std::memory_order_relaxed) && !exempt(scope))
+            fail(scope, bytes);
+    }
+
+    // main thread, at the end of every frame
+    void endFrame()
+    {
+#ifdef TRACK_ALLOCATIONS
+        paused() = true;
+        size_t mainCount = 0, mainBytes = 0, strictCount = 0;
+        size_t counts[SCOPE_COUNT], bytes[SCOPE_COUNT];
+        for(unsigned int s = 0; s < SCOPE_COUNT; s++)
+        {
+            counts[s] = frameCounts[s].exchange(0, std::memory_order_relaxed);
+            bytes[s] = frameBytes[s].exchange(0, std::memory_order_relaxed);
+            totalCounts[s] += counts[s];
+            totalBytes[s] += bytes[s];
+            if(s != SCOPE_WORKERS)
+            {
+                mainCount += counts[s];
+                mainBytes += bytes[s];
+            }
+            if(!exempt(s))
+                strictCount += counts[s];
+        }
+        worstCount = std::max(worstCount, mainCount);
+        worstBytes = std::max(worstBytes, mainBytes);
+        frame++;
+        if(frame > ALLOCATION_WARMUP_FRAMES && strictCount > 0 && spikeLines < ALLOCATION_SPIKE_LINES)
+        {
+            std::cout << "frame " << frame << " allocated";
+            for(unsigned int s = 0; s < SCOPE_WORKERS; s++)
+                if(counts[s] > 0)
+                    std::cout << ", " << scopeName(s) << " " << counts[s] << " (" << bytes[s] << " B)";
+            std::cout << std::endl;
+            if(++spikeLines == ALLOCATION_SPIKE_LINES)
+                std::cout << "no more lines for single frames, the reports go on" << std::endl;
+        }
+        if(frame % ALLOCATION_REPORT_FRAMES == 0)
+            report();
+        warm.store(frame >= ALLOCATION_WARMUP_FRAMES, std::memory_order_relaxed);
+        paused() = false;
+#endif
+    }
+private:
+    std::atomic<size_t> frameCounts[SCOPE_COUNT];
+    std::atomic<size_t> frameBytes[SCOPE_COUNT];
+    std::atomic<bool> warm;
+    std::atomic<bool> strict;
+    // main thread only
+    size_t totalCounts[SCOPE_COUNT];
+    size_t totalBytes[SCOPE_COUNT];
+    size_t worstCount = 0;
+    size_t worstBytes = 0;
+    unsigned int frame = 0;
+    unsigned int spikeLines = 0;
+
+    constexpr AllocationTracker() : frameCounts(), frameBytes(), warm(false), strict(false), totalCounts(), totalBytes() {}
+
+    static const char* scopeName(int scope)
+    {
+        static const char* const names[SCOPE_COUNT] = {
+                "other", "Input", "Update", "DrawSkybox", "Draw", "streaming", "worker threads"
+        };
+        return names[scope];
+    }
+
+    // allowed to allocate in strict mode
+    static bool exempt(int scope)
+    {
+        return scope == SCOPE_STREAMING || scope == SCOPE_WORKERS;
+    }
+
+    // allocations and bytes per frame averaged over the frames since the last report, and the worst frame
+    void report()
+    {
+        std::cout << "allocations per frame, frames " << frame - ALLOCATION_REPORT_FRAMES + 1 << "-" << frame << ":";
+        for(unsigned int s = 0; s < SCOPE_COUNT; s++)
+        {
+            std::cout << " " << scopeName(s) << " " << (double)totalCounts[s] / ALLOCATION_REPORT_FRAMES
+                      << " (" << (double)totalBytes[s] / ALLOCATION_REPORT_FRAMES << " B)" << (s + 1 < SCOPE_COUNT ? "," : "");
+            totalCounts[s] = 0;
+            totalBytes[s] = 0;
+        }
+        std::cout << "; worst frame on the main thread " << worstCount << " (" << worstBytes << " B)" << std::endl;
+        worstCount = 0;
+        worstBytes = 0;
+    }
+
+    // write() and backtrace_symbols_fd() do not allocate, unlike iostreams
+    void fail(int scope, size_t bytes)
+    {
+        paused() = true;
+        char line[160];
+        int length = std::snprintf(line, sizeof(line), "allocation of %zu bytes in %s after the warm-up, frame %u\n",
+                                   bytes, scopeName(scope), frame + 1);
+        if(length > 0)
+        {
+            ssize_t written = write(STDERR_FILENO, line, std::min<size_t>(length, sizeof(line) - 1));
+            (void)written;
+        }
+        void* frames[64];
+        int depth = backtrace(frames, 64);
+        backtrace_symbols_fd(frames, depth, STDERR_FILENO);
+        std::abort();
+    }
+};
+
+// tags the main thread's allocations with a scope until it goes out of scope itself
+class AllocationScope
+{
+public:
+    explicit AllocationScope(AllocationScopeId scope) : previous(AllocationTracker::currentScope())
+    {
+        AllocationTracker::currentScope() = scope;
+    }
+    ~AllocationScope()
+    {
+        AllocationTracker::currentScope() = previous;
+    }
+private:
+    int previous;
+};
+
+#endif //PROJECT_BASE_ALLOCATIONTRACKER_H
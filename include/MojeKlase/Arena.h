@@ -0,0 +1,211 @@
+#ifndef PROJECT_BASE_ARENA_H
+#define PROJECT_BASE_ARENA_H
+
+#include <vector>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdarg>
+#include <algorithm>
+
+const size_t ARENA_BLOCK_BYTES = 64 * 1024;
+// enough for a frame's uniform names and sort lists, grows on the first frame that needs more
+const size_t FRAME_ARENA_BYTES = 256 * 1024;
+
+// Linear allocator: allocations bump a pointer through a list of blocks and are never freed one by one.
+// reset() rewinds to the first block and keeps them all for reuse, release() frees them; both invalidate
+// everything handed out so far. Not thread safe, every thread needs its own.
+class Arena
+{
+public:
+    explicit Arena(size_t blockSize = ARENA_BLOCK_BYTES) : blockSize(blockSize) {}
+    ~Arena()
+    {
+        release();
+    }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+    {
+        char* start = align(cursor, alignment);
+        if(!cursor || start > limit || bytes > (size_t)(limit - start))
+        {
+            nextBlock(bytes + alignment);
+            start = align(cursor, alignment);
+        }
+        cursor = start + bytes;
+        used += bytes;
+        return start;
+    }
+
+    template<class T>
+    T* allocateArray(size_t count)
+    {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void reset()
+    {
+        current = 0;
+        cursor = blocks.empty() ? nullptr : blocks[0].data;
+        limit = blocks.empty() ? nullptr : blocks[0].data + blocks[0].size;
+        used = 0;
+    }
+
+    void release()
+    {
+        for(unsigned int i = 0; i < blocks.size(); i++)
+            ::operator delete(blocks[i].data);
+        blocks.clear();
+        reserved = 0;
+        reset();
+    }
+
+    // bytes asked for since the last reset, without alignment padding and block tails
+    size_t getUsed() const
+    {
+        return used;
+    }
+
+    size_t getReserved() const
+    {
+        return reserved;
+    }
+private:
+    struct Block
+    {
+        char* data;
+        size_t size;
+    };
+
+    size_t blockSize;
+    std::vector<Block> blocks;
+    unsigned int current = 0;
+    char* cursor = nullptr;
+    char* limit = nullptr;
+    size_t used = 0;
+    size_t reserved = 0;
+
+    static char* align(char* p, size_t alignment)
+    {
+        return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    }
+
+    // the rest of the current block is given up; blocks kept by reset() are reused while the allocation fits
+    // them, a bigger one is put in front of them
+    void nextBlock(size_t bytes)
+    {
+        unsigned int next = cursor ? current + 1 : current;
+        if(next == blocks.size() || blocks[next].size < bytes)
+        {
+            Block block;
+            block.size = std::max(blockSize, bytes);
+            block.data = static_cast<char*>(::operator new(block.size));
+            blocks.insert(blocks.begin() + next, block);
+            reserved += block.size;
+        }
+        current = next;
+        cursor = blocks[next].data;
+        limit = blocks[next].data + blocks[next].size;
+    }
+};
+
+// lets standard containers live in an arena; deallocate does nothing, the memory goes when the arena does
+template<class T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+    Arena* arena;
+
+    explicit ArenaAllocator(Arena* arena) : arena(arena) {}
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count)
+    {
+        return arena->allocateArray<T>(count);
+    }
+    void deallocate(T*, size_t) {}
+};
+
+template<class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena == b.arena;
+}
+
+template<class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena != b.arena;
+}
+
+// a vector grown in an arena leaves its old buffers behind, reserve() up front where the size is known
+template<class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+// Scratch memory for the frame being rendered, rewound by beginFrame() at the start of the next one:
+// nothing allocated from it may be kept across frames. After the first frames have grown it to its
+// peak, frames take no memory from the heap for their temporaries. Main thread only.
+class FrameAllocator
+{
+public:
+    static FrameAllocator& instance()
+    {
+        static FrameAllocator frame;
+        return frame;
+    }
+
+    void beginFrame()
+    {
+        lastUsed = arena.getUsed();
+        arena.reset();
+    }
+
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+    {
+        return arena.allocate(bytes, alignment);
+    }
+
+    // an empty vector whose buffer is frame memory
+    template<class T>
+    ArenaVector<T> vector()
+    {
+        return ArenaVector<T>(ArenaAllocator<T>(&arena));
+    }
+
+    // printf into frame memory, for names built in a loop like "pointLights[1].position"
+    const char* format(const char* pattern, ...)
+    {
+        va_list args;
+        va_start(args, pattern);
+        va_list copy;
+        va_copy(copy, args);
+        int length = std::vsnprintf(nullptr, 0, pattern, args);
+        va_end(args);
+        char* text = static_cast<char*>(arena.allocate(std::max(length, 0) + 1, 1));
+        std::vsnprintf(text, std::max(length, 0) + 1, pattern, copy);
+        va_end(copy);
+        return text;
+    }
+
+    // what the previous frame used, and what the arena holds on to
+    size_t getLastUsed() const
+    {
+        return lastUsed;
+    }
+
+    size_t getReserved() const
+    {
+        return arena.getReserved();
+    }
+private:
+    Arena arena;
+    size_t lastUsed = 0;
+
+    FrameAllocator() : arena(FRAME_ARENA_BYTES) {}
+};
+
+#endif //PROJECT_BASE_ARENA_H
@@ -0,0 +1,39 @@
+#ifndef PROJECT_BASE_ASSETPACK_H
+#define PROJECT_BASE_ASSETPACK_H
+
+#include <cstdint>
+
+// Layout of the archive tools/asset_packer.cpp writes and VirtualFileSystem mounts, little endian:
+//   AssetPackHeader
+//   AssetPackEntry[entryCount], sorted by name so lookups can bisect
+//   names, entryCount strings without terminators
+//   the entries' data, each blob starting on ASSET_PACK_ALIGNMENT, in the order the packer was given them
+const char ASSET_PACK_MAGIC[4] = { 'M', 'K', 'P', 'K' };
+const uint32_t ASSET_PACK_VERSION = 1;
+const uint64_t ASSET_PACK_ALIGNMENT = 16;
+
+enum AssetPackFlag
+{
+    ASSET_LZ4 = 1 << 0      // data is one LZ4 block of storedSize bytes that expands to size bytes
+};
+
+struct AssetPackHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t namesSize;
+};
+
+struct AssetPackEntry
+{
+    uint64_t offset;        // from the start of the file
+    uint64_t storedSize;
+    uint64_t size;
+    uint32_t nameOffset;    // into the names block
+    uint32_t nameLength;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+#endif //PROJECT_BASE_ASSETPACK_H
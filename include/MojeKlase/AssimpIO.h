@@ -0,0 +1,91 @@
+#ifndef PROJECT_BASE_ASSIMPIO_H
+#define PROJECT_BASE_ASSIMPIO_H
+
+#include <MojeKlase/VirtualFileSystem.h>
+
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+#include <cstring>
+#include <algorithm>
+
+// one file read through VirtualFileSystem, the whole of it is in memory (or the pack) from the start
+class VfsIOStream : public Assimp::IOStream
+{
+public:
+    explicit VfsIOStream(FileData&& file) : file(std::move(file)) {}
+
+    size_t Read(void* buffer, size_t size, size_t count) override
+    {
+        if(size == 0)
+            return 0;
+        size_t items = std::min(count, (file.size() - position) / size);
+        std::memcpy(buffer, file.data() + position, items * size);
+        position += items * size;
+        return items;
+    }
+
+    size_t Write(const void* buffer, size_t size, size_t count) override
+    {
+        return 0;
+    }
+
+    aiReturn Seek(size_t offset, aiOrigin origin) override
+    {
+        size_t target = origin == aiOrigin_SET ? offset
+                      : origin == aiOrigin_CUR ? position + offset
+                      : file.size() + offset;
+        if(target > file.size())
+            return aiReturn_FAILURE;
+        position = target;
+        return aiReturn_SUCCESS;
+    }
+
+    size_t Tell() const override
+    {
+        return position;
+    }
+
+    size_t FileSize() const override
+    {
+        return file.size();
+    }
+
+    void Flush() override {}
+private:
+    FileData file;
+    size_t position = 0;
+};
+
+// lets assimp, and the files it pulls in like .mtl, read from the mounted pack; read only.
+// Importer::SetIOHandler takes it over and deletes it with the importer
+class VfsIOSystem : public Assimp::IOSystem
+{
+public:
+    bool Exists(const char* path) const override
+    {
+        return VirtualFileSystem::instance().exists(path);
+    }
+
+    char getOsSeparator() const override
+    {
+        return '/';
+    }
+
+    Assimp::IOStream* Open(const char* path, const char* mode = "rb") override
+    {
+        if(std::strchr(mode, 'w') || std::strchr(mode, 'a') || !Exists(path))
+            return nullptr;
+        FileData file = VirtualFileSystem::instance().read(path);
+        if(!file.isValid())
+            return nullptr;
+        return new VfsIOStream(std::move(file));
+    }
+
+    void Close(Assimp::IOStream* stream) override
+    {
+        delete stream;
+    }
+};
+
+#endif //PROJECT_BASE_ASSIMPIO_H
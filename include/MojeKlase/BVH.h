@@ -0,0 +1,299 @@
+#ifndef PROJECT_BASE_BVH_H
+#define PROJECT_BASE_BVH_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+
+struct RayHit
+{
+    float t;
+    unsigned int triangle;
+    float u, v;
+};
+
+// Bounding volume hierarchy over a static triangle soup (three positions per triangle).
+// Built once with binned SAH and traversed iteratively, so it is safe to query from many threads at once.
+class BVH
+{
+public:
+    void build(const std::vector<glm::vec3>& trianglePositions)
+    {
+        positions = trianglePositions;
+        unsigned int triangleCount = positions.size() / 3;
+        triangles.resize(triangleCount);
+        centroids.resize(triangleCount);
+        for(unsigned int i = 0; i < triangleCount; i++)
+        {
+            triangles[i] = i;
+            centroids[i] = (positions[i*3] + positions[i*3+1] + positions[i*3+2]) / 3.0f;
+        }
+
+        nodes.clear();
+        nodes.reserve(triangleCount * 2);
+        nodes.push_back(Node());
+        nodes[0].first = 0;
+        nodes[0].count = triangleCount;
+        updateBounds(0);
+        maxDepth = 0;
+        subdivide(0, 0);
+        centroids.clear();
+    }
+
+    // closest hit along the ray, used for bounce rays
+    bool intersect(const glm::vec3& origin, const glm::vec3& direction, float tMax, RayHit& hit) const
+    {
+        return traverse(origin, direction, tMax, false, hit);
+    }
+
+    // any hit along the ray, used for shadow rays
+    bool occluded(const glm::vec3& origin, const glm::vec3& direction, float tMax) const
+    {
+        RayHit hit;
+        return traverse(origin, direction, tMax, true, hit);
+    }
+
+    glm::vec3 triangleNormal(unsigned int triangle) const
+    {
+        const glm::vec3* p = &positions[triangle*3];
+        return glm::normalize(glm::cross(p[1] - p[0], p[2] - p[0]));
+    }
+
+    unsigned int triangleCount() const
+    {
+        return positions.size() / 3;
+    }
+private:
+    struct Node
+    {
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        unsigned int first;   // first triangle for leaves, left child for interior nodes
+        unsigned int count;   // 0 for interior nodes
+    };
+
+    static const unsigned int BIN_COUNT = 12;
+    static const unsigned int MAX_LEAF_SIZE = 4;
+    // traversal stack on the stack, deeper trees get a heap one
+    static const unsigned int STACK_SIZE = 64;
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> centroids;
+    std::vector<unsigned int> triangles;
+    std::vector<Node> nodes;
+    unsigned int maxDepth = 0;          // of the deepest leaf, the root being 0
+
+    void updateBounds(unsigned int nodeIndex)
+    {
+        Node& node = nodes[nodeIndex];
+        node.boundsMin = glm::vec3(FLT_MAX);
+        node.boundsMax = glm::vec3(-FLT_MAX);
+        for(unsigned int i = 0; i < node.count; i++)
+        {
+            unsigned int tri = triangles[node.first + i];
+            for(unsigned int j = 0; j < 3; j++)
+            {
+                node.boundsMin = glm::min(node.boundsMin, positions[tri*3+j]);
+                node.boundsMax = glm::max(node.boundsMax, positions[tri*3+j]);
+            }
+        }
+    }
+
+    static float surfaceArea(const glm::vec3& bmin, const glm::vec3& bmax)
+    {
+        glm::vec3 e = bmax - bmin;
+        return e.x*e.y + e.y*e.z + e.z*e.x;
+    }
+
+    void subdivide(unsigned int nodeIndex, unsigned int depth)
+    {
+        maxDepth = std::max(maxDepth, depth);
+        if(nodes[nodeIndex].count <= MAX_LEAF_SIZE)
+            return;
+
+        unsigned int first = nodes[nodeIndex].first;
+        unsigned int count = nodes[nodeIndex].count;
+
+        glm::vec3 cmin(FLT_MAX), cmax(-FLT_MAX);
+        for(unsigned int i = 0; i < count; i++)
+        {
+            cmin = glm::min(cmin, centroids[triangles[first + i]]);
+            cmax = glm::max(cmax, centroids[triangles[first + i]]);
+        }
+
+        // binned SAH over all three axes
+        int bestAxis = -1;
+        float bestSplit = 0.0f;
+        float bestCost = surfaceArea(nodes[nodeIndex].boundsMin, nodes[nodeIndex].boundsMax) * count;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            float extent = cmax[axis] - cmin[axis];
+            if(extent <= 0.0f)
+                continue;
+
+            glm::vec3 binMin[BIN_COUNT], binMax[BIN_COUNT];
+            unsigned int binCount[BIN_COUNT] = {0};
+            for(unsigned int b = 0; b < BIN_COUNT; b++)
+            {
+                binMin[b] = glm::vec3(FLT_MAX);
+                binMax[b] = glm::vec3(-FLT_MAX);
+            }
+            float scale = BIN_COUNT / extent;
+            for(unsigned int i = 0; i < count; i++)
+            {
+                unsigned int tri = triangles[first + i];
+                unsigned int b = std::min(BIN_COUNT - 1, (unsigned int)((centroids[tri][axis] - cmin[axis]) * scale));
+                binCount[b]++;
+                for(unsigned int j = 0; j < 3; j++)
+                {
+                    binMin[b] = glm::min(binMin[b], positions[tri*3+j]);
+                    binMax[b] = glm::max(binMax[b], positions[tri*3+j]);
+                }
+            }
+
+            float leftArea[BIN_COUNT - 1], rightArea[BIN_COUNT - 1];
+            unsigned int leftCount[BIN_COUNT - 1], rightCount[BIN_COUNT - 1];
+            glm::vec3 lmin(FLT_MAX), lmax(-FLT_MAX), rmin(FLT_MAX), rmax(-FLT_MAX);
+            unsigned int lsum = 0, rsum = 0;
+            for(unsigned int b = 0; b < BIN_COUNT - 1; b++)
+            {
+                lsum += binCount[b];
+                lmin = glm::min(lmin, binMin[b]);
+                lmax = glm::max(lmax, binMax[b]);
+                leftCount[b] = lsum;
+                leftArea[b] = lsum ? surfaceArea(lmin, lmax) : 0.0f;
+
+                unsigned int r = BIN_COUNT - 1 - b;
+                rsum += binCount[r];
+                rmin = glm::min(rmin, binMin[r]);
+                rmax = glm::max(rmax, binMax[r]);
+                rightCount[r - 1] = rsum;
+                rightArea[r - 1] = rsum ? surfaceArea(rmin, rmax) : 0.0f;
+            }
+            for(unsigned int b = 0; b < BIN_COUNT - 1; b++)
+            {
+                float cost = leftCount[b]*leftArea[b] + rightCount[b]*rightArea[b];
+                if(leftCount[b] && rightCount[b] && cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = cmin[axis] + (b + 1) / scale;
+                }
+            }
+        }
+        if(bestAxis < 0)
+            return;
+
+        unsigned int* begin = &triangles[first];
+        unsigned int* middle = std::partition(begin, begin + count, [&](unsigned int tri) {
+            return centroids[tri][bestAxis] < bestSplit;
+        });
+        unsigned int leftCount = middle - begin;
+        if(leftCount == 0 || leftCount == count)
+            return;
+
+        unsigned int left = nodes.size();
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        nodes[left].first = first;
+        nodes[left].count = leftCount;
+        nodes[left + 1].first = first + leftCount;
+        nodes[left + 1].count = count - leftCount;
+        nodes[nodeIndex].first = left;
+        nodes[nodeIndex].count = 0;
+        updateBounds(left);
+        updateBounds(left + 1);
+        subdivide(left, depth + 1);
+        subdivide(left + 1, depth + 1);
+    }
+
+    static bool intersectBounds(const Node& node, const glm::vec3& origin, const glm::vec3& invDir, float tMax)
+    {
+        float tmin = 0.0f;
+        for(int a = 0; a < 3; a++)
+        {
+            float t1 = (node.boundsMin[a] - origin[a]) * invDir[a];
+            float t2 = (node.boundsMax[a] - origin[a]) * invDir[a];
+            tmin = std::max(tmin, std::min(t1, t2));
+            tMax = std::min(tMax, std::max(t1, t2));
+        }
+        return tmin <= tMax;
+    }
+
+    // Moller-Trumbore
+    bool intersectTriangle(unsigned int tri, const glm::vec3& origin, const glm::vec3& direction, float tMax, RayHit& hit) const
+    {
+        const glm::vec3* p = &positions[tri*3];
+        glm::vec3 e1 = p[1] - p[0];
+        glm::vec3 e2 = p[2] - p[0];
+        glm::vec3 h = glm::cross(direction, e2);
+        float a = glm::dot(e1, h);
+        if(a > -1e-8f && a < 1e-8f)
+            return false;
+        float f = 1.0f / a;
+        glm::vec3 s = origin - p[0];
+        float u = f * glm::dot(s, h);
+        if(u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, e1);
+        float v = f * glm::dot(direction, q);
+        if(v < 0.0f || u + v > 1.0f)
+            return false;
+        float t = f * glm::dot(e2, q);
+        if(t <= 1e-5f || t >= tMax)
+            return false;
+        hit.t = t;
+        hit.triangle = tri;
+        hit.u = u;
+        hit.v = v;
+        return true;
+    }
+
+    bool traverse(const glm::vec3& origin, const glm::vec3& direction, float tMax, bool anyHit, RayHit& hit) const
+    {
+        if(nodes.empty())
+            return false;
+        glm::vec3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        // depth first, at most one pending sibling per level plus the two children just pushed
+        unsigned int localStack[STACK_SIZE];
+        std::vector<unsigned int> deepStack;
+        unsigned int* stack = localStack;
+        if(maxDepth + 2 > STACK_SIZE)
+        {
+            deepStack.resize(maxDepth + 2);
+            stack = &deepStack[0];
+        }
+        unsigned int stackSize = 0;
+        stack[stackSize++] = 0;
+        bool found = false;
+        while(stackSize > 0)
+        {
+            const Node& node = nodes[stack[--stackSize]];
+            if(!intersectBounds(node, origin, invDir, tMax))
+                continue;
+            if(node.count > 0)
+            {
+                for(unsigned int i = 0; i < node.count; i++)
+                {
+                    if(intersectTriangle(triangles[node.first + i], origin, direction, tMax, hit))
+                    {
+                        if(anyHit)
+                            return true;
+                        found = true;
+                        tMax = hit.t;
+                    }
+                }
+            }
+            else
+            {
+                stack[stackSize++] = node.first;
+                stack[stackSize++] = node.first + 1;
+            }
+        }
+        return found;
+    }
+};
+
+#endif //PROJECT_BASE_BVH_H
@@ -0,0 +1,229 @@
+#ifndef PROJECT_BASE_ENTITIES_H
+#define PROJECT_BASE_ENTITIES_H
+
+#include <glm/glm.hpp>
+#include <MojeKlase/Model.h>
+#include <MojeKlase/Lights.h>
+#include <MojeKlase/SceneGraph.h>
+#include <MojeKlase/RenderQueue.h>
+#include <MojeKlase/ShaderPermutations.h>
+#include <MojeKlase/Impostor.h>
+#include <MojeKlase/Frustum.h>
+
+#include <vector>
+#include <cmath>
+
+typedef unsigned int Entity;
+const Entity NO_ENTITY = 0xffffffffu;
+
+// Sparse set: components sit packed in a dense array that systems walk front to back,
+// the sparse array maps an entity to its slot. Removal moves the last component into the hole.
+template <typename T>
+class ComponentArray
+{
+public:
+    T& add(Entity entity, const T& component)
+    {
+        if(entity >= sparse.size())
+            sparse.resize(entity + 1, NO_ENTITY);
+        if(sparse[entity] != NO_ENTITY)
+            return dense[sparse[entity]] = component;
+        sparse[entity] = dense.size();
+        dense.push_back(component);
+        entities.push_back(entity);
+        return dense.back();
+    }
+
+    void remove(Entity entity)
+    {
+        if(!has(entity))
+            return;
+        unsigned int slot = sparse[entity];
+        unsigned int last = dense.size() - 1;
+        dense[slot] = dense[last];
+        entities[slot] = entities[last];
+        sparse[entities[slot]] = slot;
+        dense.pop_back();
+        entities.pop_back();
+        sparse[entity] = NO_ENTITY;
+    }
+
+    bool has(Entity entity) const
+    {
+        return entity < sparse.size() && sparse[entity] != NO_ENTITY;
+    }
+
+    T& get(Entity entity)
+    {
+        return dense[sparse[entity]];
+    }
+
+    const T& get(Entity entity) const
+    {
+        return dense[sparse[entity]];
+    }
+
+    // dense access for system loops
+    unsigned int size() const
+    {
+        return dense.size();
+    }
+
+    T& at(unsigned int slot)
+    {
+        return dense[slot];
+    }
+
+    const T& at(unsigned int slot) const
+    {
+        return dense[slot];
+    }
+
+    Entity entityAt(unsigned int slot) const
+    {
+        return entities[slot];
+    }
+private:
+    std::vector<T> dense;
+    std::vector<Entity> entities;
+    std::vector<unsigned int> sparse;
+};
+
+// scene node holding the entity's world matrix
+struct TransformComponent
+{
+    unsigned int node;
+};
+
+struct RenderableComponent
+{
+    Model* model;
+    ShaderPermutations* shaders;
+    ModelInstance instance;
+};
+
+// world space bounds of a renderable, refreshed when its transform changes
+struct BoundsComponent
+{
+    glm::vec3 min;
+    glm::vec3 max;
+    bool visible;
+};
+
+// a renderable whose bounds center is further than distance from the camera is drawn as the impostor,
+// over fadeRange before that the two are cross-faded
+struct ImpostorComponent
+{
+    Impostor* impostor;
+    float distance;
+    float fadeRange;
+};
+
+// position is where the light shines from; a TransformComponent, if any, places its gizmo
+struct PointLightComponent
+{
+    glm::vec3 position;
+    PointLightParams params;
+};
+
+struct DirLightComponent
+{
+    DirLightParams params;
+};
+
+// Entities are plain ids; everything about them lives in the component arrays.
+// Destroyed ids are reused.
+class Registry
+{
+public:
+    ComponentArray<TransformComponent> transforms;
+    ComponentArray<RenderableComponent> renderables;
+    ComponentArray<BoundsComponent> bounds;
+    ComponentArray<ImpostorComponent> impostors;
+    ComponentArray<PointLightComponent> pointLights;
+    ComponentArray<DirLightComponent> dirLights;
+
+    Entity create()
+    {
+        if(!freeList.empty())
+        {
+            Entity entity = freeList.back();
+            freeList.pop_back();
+            return entity;
+        }
+        return next++;
+    }
+
+    void destroy(Entity entity)
+    {
+        transforms.remove(entity);
+        renderables.remove(entity);
+        bounds.remove(entity);
+        impostors.remove(entity);
+        pointLights.remove(entity);
+        dirLights.remove(entity);
+        freeList.push_back(entity);
+    }
+private:
+    Entity next = 0;
+    std::vector<Entity> freeList;
+};
+
+// recomputes world bounds of renderables whose node moved in the last SceneGraph::update()
+inline void updateBoundsSystem(Registry& registry, const SceneGraph& scene)
+{
+    for(unsigned int i = 0; i < registry.bounds.size(); i++)
+    {
+        Entity entity = registry.bounds.entityAt(i);
+        const TransformComponent& transform = registry.transforms.get(entity);
+        if(!scene.worldChanged(transform.node))
+            continue;
+        const Model* model = registry.renderables.get(entity).model;
+        BoundsComponent& box = registry.bounds.at(i);
+        transformBox(scene.getWorld(transform.node), model->getBoundsMin(), model->getBoundsMax(), box.min, box.max);
+    }
+}
+
+// below this many boxes culling stays on the calling thread
+const unsigned int CULL_BOXES_PER_JOB = 256;
+
+// marks bounds outside the view frustum as invisible
+inline void cullSystem(Registry& registry, const glm::mat4& viewProjection)
+{
+    Frustum frustum(viewProjection);
+    // boxes are independent, ranges of them go to the job system
+    JobSystem::instance().parallelFor(registry.bounds.size(), CULL_BOXES_PER_JOB, [&registry, &frustum](unsigned int begin, unsigned int end) {
+        for(unsigned int i = begin; i < end; i++)
+        {
+            BoundsComponent& box = registry.bounds.at(i);
+            box.visible = frustum.intersects(box.min, box.max);
+        }
+    });
+}
+
+// queues every visible renderable, or hands it to its impostor when it is far enough away
+inline void renderSystem(Registry& registry, const SceneGraph& scene, RenderQueue& queue, const glm::vec3& cameraPosition)
+{
+    for(unsigned int i = 0; i < registry.renderables.size(); i++)
+    {
+        Entity entity = registry.renderables.entityAt(i);
+        if(registry.bounds.has(entity) && !registry.bounds.get(entity).visible)
+            continue;
+        RenderableComponent& renderable = registry.renderables.at(i);
+        float fade = 0.0f;
+        if(registry.impostors.has(entity) && registry.bounds.has(entity))
+        {
+            const ImpostorComponent& impostor = registry.impostors.get(entity);
+            const BoundsComponent& box = registry.bounds.get(entity);
+            float distance = glm::length((box.min + box.max) * 0.5f - cameraPosition);
+            fade = glm::clamp((distance - impostor.distance + impostor.fadeRange) / std::max(impostor.fadeRange, 1e-4f),
+                              0.0f, 1.0f);
+            if(fade > 0.0f)
+                impostor.impostor->add(scene.getWorld(renderable.instance.root), fade);
+        }
+        if(fade < 1.0f)
+            renderable.model->Queue(queue, renderable.shaders, scene, renderable.instance, fade);
+    }
+}
+
+#endif //PROJECT_BASE_ENTITIES_H
@@ -0,0 +1,65 @@
+#ifndef PROJECT_BASE_FRUSTUM_H
+#define PROJECT_BASE_FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+// the box around an object space box under transform: center moves, extents go through |M|
+inline void transformBox(const glm::mat4& transform, const glm::vec3& min, const glm::vec3& max,
+                         glm::vec3& outMin, glm::vec3& outMax)
+{
+    glm::vec3 center = (min + max) * 0.5f;
+    glm::vec3 extent = (max - min) * 0.5f;
+    glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+    glm::vec3 worldExtent;
+    for(int r = 0; r < 3; r++)
+        worldExtent[r] = std::fabs(transform[0][r]) * extent.x + std::fabs(transform[1][r]) * extent.y
+                         + std::fabs(transform[2][r]) * extent.z;
+    outMin = worldCenter - worldExtent;
+    outMax = worldCenter + worldExtent;
+}
+
+// the six clip planes of a view projection matrix, normals point inwards
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    Frustum() {}
+    explicit Frustum(const glm::mat4& viewProjection)
+    {
+        // Gribb/Hartmann planes, rows of the combined matrix
+        glm::vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+        for(int i = 0; i < 3; i++)
+        {
+            glm::vec4 row(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+            planes[i * 2] = w + row;
+            planes[i * 2 + 1] = w - row;
+        }
+    }
+
+    // false only when the world space box is entirely behind one of the planes
+    bool intersects(const glm::vec3& min, const glm::vec3& max) const
+    {
+        for(int p = 0; p < 6; p++)
+        {
+            // corner furthest along the plane normal
+            glm::vec3 corner(planes[p].x > 0.0f ? max.x : min.x,
+                             planes[p].y > 0.0f ? max.y : min.y,
+                             planes[p].z > 0.0f ? max.z : min.z);
+            if(glm::dot(glm::vec3(planes[p]), corner) + planes[p].w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    // object space box under transform, tested as the world space box around it
+    bool intersects(const glm::vec3& min, const glm::vec3& max, const glm::mat4& transform) const
+    {
+        glm::vec3 worldMin, worldMax;
+        transformBox(transform, min, max, worldMin, worldMax);
+        return intersects(worldMin, worldMax);
+    }
+};
+
+#endif //PROJECT_BASE_FRUSTUM_H
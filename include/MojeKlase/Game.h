@@ -11,79 +11,292 @@
 #include <MojeKlase/Shader.h>
 #include <MojeKlase/Camera.h>
 #include <MojeKlase/Model.h>
+#include <MojeKlase/Lights.h>
+#include <MojeKlase/Lightmap.h>
+#include <MojeKlase/ShadowMaps.h>
+#include <MojeKlase/ShaderCompiler.h>
+#include <MojeKlase/RenderState.h>
+#include <MojeKlase/RenderQueue.h>
+#include <MojeKlase/WeightedOIT.h>
+#include <MojeKlase/SceneGraph.h>
+#include <MojeKlase/Entities.h>
+#include <MojeKlase/VirtualFileSystem.h>
+#include <MojeKlase/TaskGraph.h>
+#include <MojeKlase/Arena.h>
 
 #include <iostream>
 
-float deltaTime = 0.0f;
-float lastFrame = 0.0f;
-float lastX;
-float lastY;
-bool firstMouse = true;
-bool mouseCaptured = true;
-Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
-glm::vec3 snapshotPosition = glm::vec3(0.0f, 0.0f, 0.0f);
-glm::vec3 pointLightPositions[] = {
-        glm::vec3( 0.2f,  5.0f,  1.0f),
-        glm::vec3( 2.3f, -3.3f, -4.0f),
-        glm::vec3(-4.0f,  2.0f, -12.0f),
-        glm::vec3( 0.0f,  0.0f, -8.0f)
+// shader.fs has four point light slots but only accumulates the first two
+const unsigned int MAX_POINT_LIGHTS = 4;
+const unsigned int ACTIVE_POINT_LIGHTS = 2;
+
+const char* const ROOM_MODEL_PATH = "resources/objects/SobaProzor4/roomWindow.obj";
+// F4 streams copies of this one in next to the room while the frame loop keeps going
+const char* const STREAMED_ROOM_PATH = "resources/objects/SobaProzor3/roomWindow.obj";
+// per frame, for creating the GL objects of streamed in models
+const double MODEL_UPLOAD_MILLISECONDS = 2.0;
+const char* const SKYBOX_FACES[6] = {
+        "resources/textures/mySkybox2/right.png",
+        "resources/textures/mySkybox2/left.png",
+        "resources/textures/mySkybox2/top.png",
+        "resources/textures/mySkybox2/bottom.png",
+        "resources/textures/mySkybox2/front.png",
+        "resources/textures/mySkybox2/back.png"
+};
+
+// decoded pixels waiting for their upload, free with stbi_image_free
+struct DecodedImage
+{
+    unsigned char* data = nullptr;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
 };
 
 class Game {
 private:
-    Shader *shader;
-    Shader *skyboxShader;
-    Shader *lightShader;
-    Model *room;
-    Model *lamp;
-    unsigned int texture0;
-    unsigned int texture1;
-    unsigned int skyboxTexture;
+    GLFWwindow *mainWindow;
+    ShaderCompiler *compiler;
+    ShaderPermutations *litShaders;
+    Shader *skyboxShader = nullptr;
+    Shader *lightShader = nullptr;
+    std::shared_future<Shader*> skyboxShaderFuture;
+    std::shared_future<Shader*> lightShaderFuture;
+    Model *room = nullptr;
+    ShadowMaps *shadowMaps = nullptr;
+    RenderQueue renderQueue;
+    WeightedOIT *oit = nullptr;
+    InstanceBuffer *lampInstances = nullptr;
+    SceneGraph scene;
+    Registry registry;
+    Entity roomEntity;
+    Impostor* roomImpostor = nullptr;
+    Entity sunEntity;
+    Camera camera;
+    glm::vec3 snapshotPosition = glm::vec3(0.0f, 0.0f, 0.0f);
+    float deltaTime = 0.0f;
+    float lastFrame = 0.0f;
+    float lastX;
+    float lastY;
+    bool firstMouse = true;
+    bool mouseCaptured = true;
+    bool printFrameStats = false;
+    bool statsKeyDown = false;
+    bool residencyKeyDown = false;
+    bool memoryKeyDown = false;
+    bool streamKeyDown = false;
+    ModelLoad* roomLoad = nullptr;
+    int reportedLoadProgress = -1;
+    std::vector<Model*> streamedRooms;
+    float lastStatsTime = 0.0f;
+    unsigned int roomCaster;
+    unsigned int skyboxTexture = 0;
+    unsigned int lightmapTexture = 0;
     unsigned int VAO, VBO;
     unsigned int skyboxVAO, skyboxVBO;
+    DecodedImage skyboxFaces[6];
+
+    // F1 toggles a once per second summary of the previous frame
+    void ReportStats()
+    {
+        float now = static_cast<float>(glfwGetTime());
+        if(!printFrameStats || now - lastStatsTime < 1.0f)
+            return;
+        lastStatsTime = now;
+        const RenderState::Stats& stats = RenderState::instance().getLastFrameStats();
+        const TextureStreamer::Stats& streaming = TextureStreamer::instance().getStats();
+        std::cout << "frame " << deltaTime * 1000.0f << " ms, state changes issued " << stats.issued
+                  << ", skipped " << stats.skipped << ", triangles " << renderQueue.getTriangleCount()
+                  << ", textures " << streaming.residentBytes / (1024 * 1024) << "/" << streaming.budgetBytes / (1024 * 1024)
+                  << " MB (+" << streaming.uploadedBytes / 1024 << " KB, -" << streaming.evictedBytes / 1024 << " KB, "
+                  << streaming.decoding << " decoding, " << streaming.unloaded << " not loaded)"
+                  << ", gpu memory " << GpuMemory::instance().getTotal() / (1024 * 1024) << " MB"
+                  << ", frame scratch " << FrameAllocator::instance().getLastUsed() / 1024 << "/"
+                  << FrameAllocator::instance().getReserved() / 1024 << " KB" << std::endl;
+    }
 
     static void framebuffer_size_callback(GLFWwindow *window, const int width, const int height) {
         glViewport(0, 0, width, height);
     }
 
     static void mouse_callback(GLFWwindow *window, double xposIn, double yposIn) {
+        Game* game = static_cast<Game*>(glfwGetWindowUserPointer(window));
         float xpos = static_cast<float>(xposIn);
         float ypos = static_cast<float>(yposIn);
 
-        if (firstMouse) {
-            lastX = xpos;
-            lastY = ypos;
-            firstMouse = false;
+        if (game->firstMouse) {
+            game->lastX = xpos;
+            game->lastY = ypos;
+            game->firstMouse = false;
         }
 
-        float xoffset = xpos - lastX;
-        float yoffset = lastY - ypos;
-        lastX = xpos;
-        lastY = ypos;
+        float xoffset = xpos - game->lastX;
+        float yoffset = game->lastY - ypos;
+        game->lastX = xpos;
+        game->lastY = ypos;
 
-        camera.processMouseMovement(xoffset, yoffset);
+        game->camera.processMouseMovement(xoffset, yoffset);
     }
 
-    unsigned int loadSkyboxTexture(std::vector<std::string> faces)
+    const DirLightParams& sunLight()
     {
-        unsigned int textureID;
-        glGenTextures(1, &textureID);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+        return registry.dirLights.get(sunEntity).params;
+    }
 
-        int width, height, nrChannels;
-        stbi_set_flip_vertically_on_load(false);
-        for (unsigned int i = 0; i < faces.size(); i++)
+    // the lights that shade and cast shadows, in creation order; returns how many there are
+    unsigned int activePointLights(glm::vec3* positions, PointLightParams* params)
+    {
+        unsigned int count = std::min(registry.pointLights.size(), ACTIVE_POINT_LIGHTS);
+        for(unsigned int i = 0; i < count; i++)
         {
-            unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-            if (data)
+            positions[i] = registry.pointLights.at(i).position;
+            params[i] = registry.pointLights.at(i).params;
+        }
+        return count;
+    }
+
+    // no-ops for lights that did not change since the last call
+    void updateShadowLights()
+    {
+        glm::vec3 positions[ACTIVE_POINT_LIGHTS];
+        PointLightParams params[ACTIVE_POINT_LIGHTS];
+        unsigned int count = activePointLights(positions, params);
+        shadowMaps->setDirLight(sunLight());
+        for(unsigned int i = 0; i < count; i++)
+            shadowMaps->setPointLight(i, positions[i], params[i]);
+    }
+
+    void createLights()
+    {
+        static const DirLightParams sun = {
+                glm::vec3(-0.2f, -1.0f, -0.3f),
+                glm::vec3(0.1f, 0.1f, 0.1f),
+                glm::vec3(0.05f, 0.05f, 0.05f),
+                glm::vec3(0.2f, 0.2f, 0.2f)
+        };
+        static const glm::vec3 positions[MAX_POINT_LIGHTS] = {
+                glm::vec3( 0.2f,  5.0f,  1.0f),
+                glm::vec3( 2.3f, -3.3f, -4.0f),
+                glm::vec3(-4.0f,  2.0f, -12.0f),
+                glm::vec3( 0.0f,  0.0f, -8.0f)
+        };
+        static const PointLightParams params[MAX_POINT_LIGHTS] = {
+                { glm::vec3(0.0f, 0.0f, 0.0f),    glm::vec3(1.0f, 0.6f, 0.0f), glm::vec3(1.0f, 0.6f, 0.0f), 1.0f, 0.07f, 0.017f },
+                { glm::vec3(0.05f, 0.05f, 0.05f), glm::vec3(1.0f, 0.6f, 0.0f), glm::vec3(1.0f, 0.6f, 0.0f), 1.0f, 0.09f, 0.032f },
+                { glm::vec3(0.05f, 0.05f, 0.05f), glm::vec3(0.8f, 0.8f, 0.8f), glm::vec3(1.0f, 1.0f, 1.0f), 3.0f, 0.09f, 0.032f },
+                { glm::vec3(0.05f, 0.05f, 0.05f), glm::vec3(0.8f, 0.8f, 0.8f), glm::vec3(1.0f, 1.0f, 1.0f), 1.0f, 0.09f, 0.032f }
+        };
+
+        sunEntity = registry.create();
+        DirLightComponent sunComponent = { sun };
+        registry.dirLights.add(sunEntity, sunComponent);
+        const TransformComponent& roomTransform = registry.transforms.get(roomEntity);
+        for(unsigned int i = 0; i < MAX_POINT_LIGHTS; i++)
+        {
+            Entity light = registry.create();
+            PointLightComponent component = { positions[i], params[i] };
+            registry.pointLights.add(light, component);
+            // only the lights that shade get a lamp cube, hung off the room so moving the room moves them too
+            if(i < ACTIVE_POINT_LIGHTS)
             {
-                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-                stbi_image_free(data);
+                TransformComponent gizmo = {
+                        scene.addNode(glm::scale(glm::translate(glm::mat4(1.0f), positions[i]), glm::vec3(0.5f)), roomTransform.node)
+                };
+                registry.transforms.add(light, gizmo);
             }
-            else
+        }
+    }
+
+    glm::mat4 roomModelMatrix()
+    {
+        glm::mat4 model = glm::mat4(1.0f);
+        model = glm::translate(model, glm::vec3(0.0f, -0.5f, 0.0f));
+        model = glm::scale(model, glm::vec3(0.2f));
+        return model;
+    }
+
+    // static sampler units, run for every permutation of shader.fs when it is compiled
+    void initializeLitShader(Shader* shader)
+    {
+        shader->use();
+        shader->setInt("lightmap", LIGHTMAP_TEXTURE_UNIT);
+        shader->setBool("useLightmap", lightmapTexture != 0);
+        if(shadowMaps)
+            shadowMaps->setSamplerUnits(shader);
+    }
+
+    // everything but the model matrix, which the render queue sets per draw
+    void setLitUniforms(Shader* shader, const glm::mat4& view, const glm::mat4& projection)
+    {
+        shader->use();
+        shader->setMat4("view", view);
+        shader->setMat4("projection", projection);
+
+        shader->setVec3("material.ambient", 1.0f, 0.5f, 0.31f);
+        shader->setInt("material.diffuse", 0);
+        shader->setVec3("material.specular", 0.5f, 0.5f, 0.5f);
+        shader->setFloat("material.shininess", 32.0f);
+
+        const DirLightParams& dirLight = sunLight();
+        shader->setVec3("dirLight.direction", dirLight.direction);
+        shader->setVec3("dirLight.ambient", dirLight.ambient);
+        shader->setVec3("dirLight.diffuse", dirLight.diffuse);
+        shader->setVec3("dirLight.specular", dirLight.specular);
+
+        unsigned int lights = std::min(registry.pointLights.size(), MAX_POINT_LIGHTS);
+        for(unsigned int i = 0; i < lights; i++)
+        {
+            const PointLightComponent& pointLight = registry.pointLights.at(i);
+            FrameAllocator& frame = FrameAllocator::instance();
+            shader->setVec3(frame.format("pointLights[%u].position", i), pointLight.position);
+            shader->setVec3(frame.format("pointLights[%u].ambient", i), pointLight.params.ambient);
+            shader->setVec3(frame.format("pointLights[%u].diffuse", i), pointLight.params.diffuse);
+            shader->setVec3(frame.format("pointLights[%u].specular", i), pointLight.params.specular);
+            shader->setFloat(frame.format("pointLights[%u].constant", i), pointLight.params.constant);
+            shader->setFloat(frame.format("pointLights[%u].linear", i), pointLight.params.linear);
+            shader->setFloat(frame.format("pointLights[%u].quadratic", i), pointLight.params.quadratic);
+        }
+
+        shader->setVec3("spotLight.position", camera.Position);
+        shader->setVec3("spotLight.direction", camera.Front);
+        shader->setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
+        shader->setVec3("spotLight.diffuse", 0.8f, 0.8f, 0.0f);
+        shader->setVec3("spotLight.specular", 0.8f, 0.8f, 0.0f);
+        shader->setFloat("spotLight.constant", 1.0f);
+        shader->setFloat("spotLight.linear", 0.09f);
+        shader->setFloat("spotLight.quadratic", 0.032f);
+        shader->setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
+        shader->setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
+
+        shader->setVec3("cameraPos", snapshotPosition);
+        shader->setVec3("viewPos", camera.Position);
+        shadowMaps->setUniforms(shader);
+    }
+
+    // any thread, as long as nothing turns stb's vertical flip on meanwhile
+    void decodeSkyboxFace(unsigned int face)
+    {
+        DecodedImage& image = skyboxFaces[face];
+        image.data = loadImage(SKYBOX_FACES[face], &image.width, &image.height, &image.channels);
+        if(!image.data)
+            std::cout << "cubemap texture failed: " << SKYBOX_FACES[face] << std::endl;
+    }
+
+    // uploads and frees the decoded faces
+    unsigned int loadSkyboxTexture(DecodedImage* faces)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        RenderState::instance().bindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+
+        for (unsigned int i = 0; i < 6; i++)
+        {
+            if (faces[i].data)
             {
-                std::cout << "cubemap texture failed: " << faces[i] << std::endl;
-                stbi_image_free(data);
+                GpuMemory::instance().texImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, textureID, 0, GL_RGB, faces[i].width,
+                                                 faces[i].height, GL_RGBA, GL_UNSIGNED_BYTE, faces[i].data, GPU_TEXTURE);
+                stbi_image_free(faces[i].data);
+                faces[i].data = nullptr;
             }
         }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -96,9 +309,13 @@ private:
     }
 
 public:
-    Game() {}
+    Game() : camera(glm::vec3(0.0f, 0.0f, 3.0f)) {}
 
     GLFWwindow *Initialize(const int windowWidth, const int windowHeight, const char *title) {
+        // first use makes the calling thread worker 0
+        JobSystem::instance();
+        // built by the pack target; without it everything is read from resources/ as before
+        VirtualFileSystem::instance().mount("resources.pack");
         glfwInit();
         glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
         glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -111,6 +328,7 @@ public:
             return NULL;
         }
         glfwMakeContextCurrent(window);
+        glfwSetWindowUserPointer(window, this);
         glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
         glfwSetCursorPosCallback(window, mouse_callback);
 
@@ -121,6 +339,9 @@ public:
             return NULL;
         }
 
+        ProgramCache::instance().initialize("resources/shader_cache");
+        mainWindow = window;
+
         lastX = windowWidth / 2.0f;
         lastY = windowHeight / 2.0f;
 
@@ -128,9 +349,13 @@ public:
     }
 
     void shaderInitialization() {
-        shader = new Shader("resources/shaders/shader.vs", "resources/shaders/shader.fs");
-        skyboxShader = new Shader("resources/shaders/skyboxShader.vs", "resources/shaders/skyboxShader.fs");
-        lightShader = new Shader("resources/shaders/lightShader.vs", "resources/shaders/lightShader.fs");
+        // everything except the fallback permutation compiles on the worker while the rest of startup runs
+        compiler = new ShaderCompiler(mainWindow);
+        litShaders = new ShaderPermutations("resources/shaders/shader.vs", "resources/shaders/shader.fs", compiler);
+        litShaders->setInitializer([this](Shader* shader) { initializeLitShader(shader); });
+        skyboxShaderFuture = compiler->compile("resources/shaders/skyboxShader.vs", "resources/shaders/skyboxShader.fs");
+        lightShaderFuture = compiler->compile("resources/shaders/lightShader.vs", "resources/shaders/lightShader.fs");
+        oit = new WeightedOIT(mainWindow);
     }
 
     void arrayAndBufferInitialization() {
@@ -181,66 +406,25 @@ public:
 
         glGenBuffers(1, &VBO);
         glGenVertexArrays(1, &VAO);
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        RenderState& state = RenderState::instance();
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        GpuMemory::instance().bufferData(GL_ARRAY_BUFFER, VBO, sizeof(vertices), vertices, GL_STATIC_DRAW, GPU_VERTEX_BUFFER);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 8, (void *) 0);
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 8, (void *) (3 * sizeof(float)));
         glEnableVertexAttribArray(1);
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 8, (void *) (6 * sizeof(float)));
         glEnableVertexAttribArray(2);
-        glBindVertexArray(0);
-    }
-
-    void textureInitialization() {
-        glBindVertexArray(VAO);
-        glGenTextures(1, &skyboxTexture);
-        glBindTexture(GL_TEXTURE_2D, texture0);
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        // load image, create texture and generate mipmaps
-        int width, height, nrChannels;
-        stbi_set_flip_vertically_on_load(true); // tell stb_image.h to flip loaded texture's on the y-axis.
-        unsigned char *data = stbi_load("resources/textures/container2.png", &width, &height, &nrChannels, 0);
-        if (data) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-            glGenerateMipmap(GL_TEXTURE_2D);
-        } else {
-            std::cout << "Failed to load texture" << std::endl;
-        }
-        stbi_image_free(data);
-
-        glGenTextures(1, &texture1);
-        glBindTexture(GL_TEXTURE_2D, texture1);
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        // load image, create texture and generate mipmaps
-        data = stbi_load("resources/textures/awesomeface.png", &width, &height, &nrChannels, 0);
-        if (data) {
-            // note that the awesomeface.png has transparency and thus an alpha channel, so make sure to tell OpenGL the data type is of GL_RGBA
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-            glGenerateMipmap(GL_TEXTURE_2D);
-        } else {
-            std::cout << "Failed to load texture" << std::endl;
-        }
-        stbi_image_free(data);
-
-        shader->use();
-        shader->setInt("texture0", 0);
-        shader->setInt("texture1", 1);
+        // one lamp cube per point light in a single draw
+        lampInstances = new InstanceBuffer();
+        lampInstances->attach(VAO);
+        state.bindVertexArray(0);
     }
 
     void skyboxInitialization()
     {
+        GpuMemory::Owner owner("skybox");
         float skyboxVertices[] = {
                 // positions
                 -1.0f,  1.0f, -1.0f,
@@ -286,30 +470,104 @@ public:
                 1.0f, -1.0f,  1.0f
         };
         glGenBuffers(1, &skyboxVBO);
-        glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), skyboxVertices, GL_STATIC_DRAW);
+        RenderState& state = RenderState::instance();
+        state.bindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
+        GpuMemory::instance().bufferData(GL_ARRAY_BUFFER, skyboxVBO, sizeof(skyboxVertices), skyboxVertices, GL_STATIC_DRAW,
+                                         GPU_VERTEX_BUFFER);
         glGenVertexArrays(1, &skyboxVAO);
-        glBindVertexArray(skyboxVAO);
+        state.bindVertexArray(skyboxVAO);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(float), (void*)0);
         glEnableVertexAttribArray(0);
 
-        std::vector<std::string> faces
-                {
-                        "resources/textures/mySkybox2/right.png",
-                        "resources/textures/mySkybox2/left.png",
-                        "resources/textures/mySkybox2/top.png",
-                        "resources/textures/mySkybox2/bottom.png",
-                        "resources/textures/mySkybox2/front.png",
-                        "resources/textures/mySkybox2/back.png"
-                };
-        skyboxTexture = loadSkyboxTexture(faces);
-        skyboxShader->use();
-        skyboxShader->setInt("skybox", 0);
+        // Startup() decodes the faces on jobs beforehand, called on its own this decodes them here
+        stbi_set_flip_vertically_on_load(false);
+        for(unsigned int i = 0; i < 6; i++)
+            if(!skyboxFaces[i].data)
+                decodeSkyboxFace(i);
+        skyboxTexture = loadSkyboxTexture(skyboxFaces);
+    }
+
+    // the CPU half of modelInitialization, reads and builds the room's meshes; any thread
+    void modelLoading()
+    {
+        room = new Model(ROOM_MODEL_PATH, LOADER_AUTO, false);
     }
 
     void modelInitialization()
     {
-        room = new Model("resources/objects/SobaProzor4/roomWindow.obj");
+        // material textures only, render targets and the lightmap are not streamed
+        TextureStreamer::instance().setBudget(128 * 1024 * 1024);
+        if(!room)
+            modelLoading();
+        room->upload();
+        room->prepare(litShaders);
+
+        roomEntity = registry.create();
+        RenderableComponent renderable = { room, litShaders, room->instantiate(scene, roomModelMatrix()) };
+        TransformComponent transform = { renderable.instance.root };
+        BoundsComponent bounds = { glm::vec3(0.0f), glm::vec3(0.0f), true };
+        registry.renderables.add(roomEntity, renderable);
+        registry.transforms.add(roomEntity, transform);
+        registry.bounds.add(roomEntity, bounds);
+        createLights();
+
+        scene.update();
+        updateBoundsSystem(registry, scene);
+    }
+
+    void lightmapInitialization()
+    {
+        GpuMemory::Owner owner("lightmap");
+        glm::vec3 positions[ACTIVE_POINT_LIGHTS];
+        PointLightParams params[ACTIVE_POINT_LIGHTS];
+        unsigned int count = activePointLights(positions, params);
+        LightmapBaker baker;
+        lightmapTexture = baker.bake(*room, scene.getWorld(registry.transforms.get(roomEntity).node), sunLight(),
+                                     positions, params, count, "resources/objects/SobaProzor4/roomWindow.lightmap");
+        litShaders->reinitialize();
+    }
+
+    // after the lightmap unwrap, so the baked frames see the final meshes
+    void impostorInitialization()
+    {
+        GpuMemory::Owner owner("room impostor");
+        roomImpostor = new Impostor(*room, ACTIVE_POINT_LIGHTS);
+        ImpostorComponent impostor = { roomImpostor, 40.0f, 8.0f };
+        registry.impostors.add(roomEntity, impostor);
+    }
+
+    void shadowInitialization()
+    {
+        GpuMemory::Owner owner("shadow maps");
+        shadowMaps = new ShadowMaps();
+        roomCaster = shadowMaps->addCaster(room, scene.getWorld(registry.transforms.get(roomEntity).node));
+        updateShadowLights();
+        litShaders->reinitialize();
+    }
+
+    // the initialization steps as a task graph: file reads, parsing and decoding run as jobs while the
+    // steps that need the GL context run here, in their old order; prints the timeline at the end
+    void Startup()
+    {
+        TaskGraph graph;
+        // the face decodes run on jobs, the switch is process wide
+        stbi_set_flip_vertically_on_load(false);
+        unsigned int modelRead = graph.add("read room model", [this]() { modelLoading(); });
+        std::vector<unsigned int> faces;
+        for(unsigned int i = 0; i < 6; i++)
+            faces.push_back(graph.add(std::string("decode skybox face ") + (char)('0' + i), [this, i]() { decodeSkyboxFace(i); }));
+
+        unsigned int shaders = graph.addMain("shaders", [this]() { shaderInitialization(); });
+        unsigned int buffers = graph.addMain("buffers", [this]() { arrayAndBufferInitialization(); }, { shaders });
+        // the room's textures stay lazy, the first frames' draws ask for them and the impostor bakes again when they are in
+        unsigned int model = graph.addMain("upload room model", [this]() { modelInitialization(); }, { buffers, modelRead });
+        unsigned int lightmap = graph.addMain("lightmap", [this]() { lightmapInitialization(); }, { model });
+        unsigned int impostor = graph.addMain("impostor", [this]() { impostorInitialization(); }, { lightmap });
+        graph.addMain("shadow maps", [this]() { shadowInitialization(); }, { impostor });
+        graph.addMain("skybox", [this]() { skyboxInitialization(); }, faces);
+
+        graph.run();
+        graph.printTimeline();
     }
 
     void Input(GLFWwindow* window)
@@ -341,34 +599,107 @@ public:
 
         if(glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
             snapshotPosition = camera.Front;
+
+        bool statsKey = glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS;
+        if(statsKey && !statsKeyDown)
+            printFrameStats = !printFrameStats;
+        statsKeyDown = statsKey;
+
+        bool residencyKey = glfwGetKey(window, GLFW_KEY_F2) == GLFW_PRESS;
+        if(residencyKey && !residencyKeyDown)
+            TextureStreamer::instance().printResidency();
+        residencyKeyDown = residencyKey;
+
+        bool memoryKey = glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS;
+        if(memoryKey && !memoryKeyDown)
+            GpuMemory::instance().printUsage();
+        memoryKeyDown = memoryKey;
+
+        bool streamKey = glfwGetKey(window, GLFW_KEY_F4) == GLFW_PRESS;
+        if(streamKey && !streamKeyDown && !roomLoad)
+        {
+            roomLoad = Model::loadAsync(STREAMED_ROOM_PATH);
+            reportedLoadProgress = -1;
+        }
+        streamKeyDown = streamKey;
+    }
+
+    // uploads a slice of whatever is loading and places a finished room next to the last one
+    void streamRooms()
+    {
+        AllocationScope streaming(SCOPE_STREAMING);
+        Model::updateLoads(MODEL_UPLOAD_MILLISECONDS);
+        if(!roomLoad)
+            return;
+        int progress = (int)(roomLoad->getProgress() * 10.0f);
+        if(progress != reportedLoadProgress)
+        {
+            std::cout << "loading " << roomLoad->getPath() << ": " << progress * 10 << "%" << std::endl;
+            reportedLoadProgress = progress;
+        }
+        if(!roomLoad->isReady())
+            return;
+        Model* model = roomLoad->getModel();
+        delete roomLoad;
+        roomLoad = nullptr;
+        model->prepare(litShaders);
+        streamedRooms.push_back(model);
+
+        // side by side along x, in the room's object space so its scale applies
+        float width = room->getBoundsMax().x - room->getBoundsMin().x;
+        glm::mat4 transform = glm::translate(roomModelMatrix(), glm::vec3(width * streamedRooms.size(), 0.0f, 0.0f));
+        Entity entity = registry.create();
+        RenderableComponent renderable = { model, litShaders, model->instantiate(scene, transform) };
+        TransformComponent transformComponent = { renderable.instance.root };
+        BoundsComponent bounds = { glm::vec3(0.0f), glm::vec3(0.0f), true };
+        registry.renderables.add(entity, renderable);
+        registry.transforms.add(entity, transformComponent);
+        registry.bounds.add(entity, bounds);
     }
 
     void ScreenSettings()
     {
-        glEnable(GL_DEPTH_TEST);
-        //blending
-        glEnable(GL_BLEND);
-        glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
-        glBlendEquation(GL_FUNC_ADD);
+        // first thing in the frame, last frame's temporaries are dead by now
+        FrameAllocator::instance().beginFrame();
+        // redundant after the first frame, RenderState drops them
+        RenderState& state = RenderState::instance();
+        state.enable(GL_DEPTH_TEST);
+        //blending, enabled per pass by the render queue
+        state.blendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
+        state.blendEquation(GL_FUNC_ADD);
 
         glClearColor(0.1f, 0.5f, 0.8f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     }
 
+    // swaps in programs the compiler has finished since the last frame, never waits for one
+    void PollShaders()
+    {
+        litShaders->poll();
+        if(!skyboxShader && (skyboxShader = ShaderCompiler::ready(skyboxShaderFuture)))
+        {
+            skyboxShader->use();
+            skyboxShader->setInt("skybox", 0);
+        }
+        if(!lightShader)
+            lightShader = ShaderCompiler::ready(lightShaderFuture);
+    }
+
     void DrawSkybox()
     {
-        glDepthMask(GL_FALSE);
+        if(!skyboxShader)
+            return;
+        RenderState& state = RenderState::instance();
+        state.depthMask(GL_FALSE);
         skyboxShader->use();
         glm::mat4 view = glm::mat4(glm::mat3(camera.GetViewmatrix()));
         glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f/600.0f, 0.1f, 100.0f);
         skyboxShader->setMat4("view", view);
         skyboxShader->setMat4("projection", projection);
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
+        state.bindVertexArray(skyboxVAO);
+        state.bindTexture(0, GL_TEXTURE_CUBE_MAP, skyboxTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glDepthMask(GL_TRUE);
+        state.depthMask(GL_TRUE);
     }
 
     void Update()
@@ -383,104 +714,110 @@ public:
         projection = glm::perspective(glm::radians(45.0f), 800.0f/600.0f, 0.1f, 100.0f);
 
 
-        shader->use();
-        shader->setMat4("view", view);
-        shader->setMat4("projection", projection);
-
-        shader->setVec3("material.ambient", 1.0f, 0.5f, 0.31f);
-        shader->setInt("material.diffuse", 0);
-        shader->setVec3("material.specular", 0.5f, 0.5f, 0.5f);
-        shader->setFloat("material.shininess", 32.0f);
-
-        shader->setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-        shader->setVec3("dirLight.ambient", 0.1f, 0.1f, 0.1f);
-        shader->setVec3("dirLight.diffuse", 0.05f, 0.05f, 0.05f);
-        shader->setVec3("dirLight.specular", 0.2f, 0.2f, 0.2f);
-
-        // point light 1
-        shader->setVec3("pointLights[0].position", pointLightPositions[0]);
-        shader->setVec3("pointLights[0].ambient", 0.0f, 0.0f, 0.0f);
-        shader->setVec3("pointLights[0].diffuse", 1.0f, 0.6f, 0.0f);
-        shader->setVec3("pointLights[0].specular", 1.0f, 0.6f, 0.0f);
-        shader->setFloat("pointLights[0].constant", 1.0f);
-        shader->setFloat("pointLights[0].linear", 0.07f);
-        shader->setFloat("pointLights[0].quadratic", 0.017f);
-        // point light 2
-        shader->setVec3("pointLights[1].position", pointLightPositions[1]);
-        shader->setVec3("pointLights[1].ambient", 0.05f, 0.05f, 0.05f);
-        shader->setVec3("pointLights[1].diffuse", 1.0f, 0.6f, 0.0f);
-        shader->setVec3("pointLights[1].specular", 1.0f, 0.6f, 0.0f);
-        shader->setFloat("pointLights[1].constant", 1.0f);
-        shader->setFloat("pointLights[1].linear", 0.09f);
-        shader->setFloat("pointLights[1].quadratic", 0.032f);
-        // point light 3
-        shader->setVec3("pointLights[2].position", pointLightPositions[2]);
-        shader->setVec3("pointLights[2].ambient", 0.05f, 0.05f, 0.05f);
-        shader->setVec3("pointLights[2].diffuse", 0.8f, 0.8f, 0.8f);
-        shader->setVec3("pointLights[2].specular", 1.0f, 1.0f, 1.0f);
-        shader->setFloat("pointLights[2].constant", 3.0f);
-        shader->setFloat("pointLights[2].linear", 0.09f);
-        shader->setFloat("pointLights[2].quadratic", 0.032f);
-        // point light 4
-        shader->setVec3("pointLights[3].position", pointLightPositions[3]);
-        shader->setVec3("pointLights[3].ambient", 0.05f, 0.05f, 0.05f);
-        shader->setVec3("pointLights[3].diffuse", 0.8f, 0.8f, 0.8f);
-        shader->setVec3("pointLights[3].specular", 1.0f, 1.0f, 1.0f);
-        shader->setFloat("pointLights[3].constant", 1.0f);
-        shader->setFloat("pointLights[3].linear", 0.09f);
-        shader->setFloat("pointLights[3].quadratic", 0.032f);
-
-        shader->setVec3("spotLight.position", camera.Position);
-        shader->setVec3("spotLight.direction", camera.Front);
-        shader->setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-        shader->setVec3("spotLight.diffuse", 0.8f, 0.8f, 0.0f);
-        shader->setVec3("spotLight.specular", 0.8f, 0.8f, 0.0f);
-        shader->setFloat("spotLight.constant", 1.0f);
-        shader->setFloat("spotLight.linear", 0.09f);
-        shader->setFloat("spotLight.quadratic", 0.032f);
-        shader->setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-        shader->setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
-
-        shader->setVec3("cameraPos", snapshotPosition);
-        shader->setVec3("viewPos", camera.Position);
-
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, -0.5f, 0.0f));
-        model = glm::scale(model, glm::vec3(0.2f));
-        shader->setMat4("model", model);
-
-        lightShader->use();
-        model = glm::translate(model, pointLightPositions[0]);
-        model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-        lightShader->setMat4("view", view);
-        lightShader->setMat4("projection", projection);
-        lightShader->setMat4("model", model);
+        streamRooms();
+        scene.update();
+        updateBoundsSystem(registry, scene);
+        cullSystem(registry, projection * view);
+
+        // no-ops unless something actually moved, in which case only the affected maps are re-rendered
+        unsigned int roomNode = registry.transforms.get(roomEntity).node;
+        if(scene.worldChanged(roomNode))
+            shadowMaps->setCasterTransform(roomCaster, scene.getWorld(roomNode));
+        updateShadowLights();
+        shadowMaps->update();
+        roomImpostor->update();
+
+        const std::vector<Shader*>& variants = litShaders->getVariants();
+        for(unsigned int i = 0; i < variants.size(); i++)
+            setLitUniforms(variants[i], view, projection);
+        setLitUniforms(roomImpostor->getShader(), view, projection);
+
+        // a lamp cube for every point light with a gizmo transform
+        glm::mat4 lampTransforms[MAX_POINT_LIGHTS];
+        glm::vec4 lampTints[MAX_POINT_LIGHTS];
+        unsigned int lamps = 0;
+        for(unsigned int i = 0; i < registry.pointLights.size() && lamps < MAX_POINT_LIGHTS; i++)
+        {
+            Entity light = registry.pointLights.entityAt(i);
+            if(!registry.transforms.has(light))
+                continue;
+            lampTransforms[lamps] = scene.getWorld(registry.transforms.get(light).node);
+            lampTints[lamps] = glm::vec4(registry.pointLights.at(i).params.diffuse, 1.0f);
+            lamps++;
+        }
+        lampInstances->upload(lampTransforms, lamps, lampTints);
+        if(lightShader)
+        {
+            lightShader->use();
+            lightShader->setMat4("view", view);
+            lightShader->setMat4("projection", projection);
+        }
     }
 
     void Draw(GLFWwindow* window)
     {
+        RenderState& state = RenderState::instance();
         //face culling
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
-
-        shader->use();
-        room->Draw(shader);
+        state.enable(GL_CULL_FACE);
+        state.cullFace(GL_BACK);
+
+        shadowMaps->bindTextures();
+        state.bindTexture(LIGHTMAP_TEXTURE_UNIT, GL_TEXTURE_2D, lightmapTexture);
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(mainWindow, &framebufferWidth, &framebufferHeight);
+        renderQueue.begin(camera.Position, 100.0f, framebufferHeight / (2.0f * std::tan(glm::radians(45.0f) * 0.5f)));
+        renderQueue.setFrustum(glm::perspective(glm::radians(45.0f), 800.0f/600.0f, 0.1f, 100.0f) * camera.GetViewmatrix());
+        renderSystem(registry, scene, renderQueue, camera.Position);
+        renderQueue.sort();
+        renderQueue.submit(PASS_OPAQUE);
+        renderQueue.submit(PASS_CUTOUT);
+        roomImpostor->draw();
         //lightShader
-        lightShader->use();
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        if(lightShader)
+        {
+            lightShader->use();
+            state.bindVertexArray(VAO);
+            glDrawArraysInstanced(GL_TRIANGLES, 0, 36, lampInstances->size());
+        }
+        // translucent surfaces last, unsorted, on top of all opaque depth
+        if(renderQueue.count(PASS_BLENDED) > 0)
+        {
+            oit->begin();
+            renderQueue.submit(PASS_BLENDED);
+            oit->composite();
+        }
 
+        // this frame's draws have asked for their mip levels, the uploads show up from the next one
+        TextureStreamer::instance().update();
+        state.beginFrame();
+        ReportStats();
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
     void Deinitialize()
     {
-        shader->deleteProgram();
-        glDeleteBuffers(1, &VBO);
+        delete litShaders;
+        delete compiler;
+        delete shadowMaps;
+        delete oit;
+        delete roomImpostor;
+        delete lampInstances;
+        delete room;
+        // cancels a load still in flight
+        delete roomLoad;
+        for(unsigned int i = 0; i < streamedRooms.size(); i++)
+            delete streamedRooms[i];
+        GpuMemory& memory = GpuMemory::instance();
+        memory.deleteTexture(lightmapTexture);
+        memory.deleteTexture(skyboxTexture);
+        memory.deleteBuffer(VBO);
+        memory.deleteBuffer(skyboxVBO);
+        RenderState::instance().vertexArrayDeleted(VAO);
         glDeleteVertexArrays(1, &VAO);
-        glDeleteBuffers(1, &skyboxVBO);
+        RenderState::instance().vertexArrayDeleted(skyboxVAO);
         glDeleteVertexArrays(1, &skyboxVAO);
+        memory.printLeaks();
         glfwTerminate();
     }
 };
@@ -0,0 +1,285 @@
+#ifndef PROJECT_BASE_GPUMEMORY_H
+#define PROJECT_BASE_GPUMEMORY_H
+
+#include <glad/glad.h>
+#include <MojeKlase/RenderState.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <cstdint>
+
+enum GpuCategory
+{
+    GPU_VERTEX_BUFFER = 0,
+    GPU_INDEX_BUFFER,
+    GPU_INSTANCE_BUFFER,
+    GPU_TEXTURE,            // level 0 of sampled textures
+    GPU_TEXTURE_MIPS,       // their levels 1 and up
+    GPU_RENDER_TARGET,      // attachments, shadow maps, baked atlases
+    GPU_CATEGORY_COUNT
+};
+
+// Bookkeeping for every buffer, texture and renderbuffer allocation. The wrappers issue the GL call
+// and record its estimated size under a category, an internal format and the owner that was current
+// when the object was first allocated. Deleting through it also tells RenderState the name is gone.
+// What is still alive at shutdown is listed by printLeaks().
+class GpuMemory
+{
+public:
+    // allocations made while one is alive are charged to name, e.g. a model's path
+    class Owner
+    {
+    public:
+        Owner(const std::string& name)
+        {
+            GpuMemory::instance().owners.push_back(name);
+        }
+        ~Owner()
+        {
+            GpuMemory::instance().owners.pop_back();
+        }
+    };
+
+    static GpuMemory& instance()
+    {
+        static GpuMemory memory;
+        return memory;
+    }
+
+    // the buffer must be bound to target
+    void bufferData(GLenum target, unsigned int buffer, GLsizeiptr size, const void* data, GLenum usage, GpuCategory category)
+    {
+        glBufferData(target, size, data, usage);
+        record(BUFFER, buffer, 0, size, category, 0);
+    }
+
+    // the texture must be bound; a zero sized level frees that level
+    void texImage2D(GLenum target, unsigned int texture, GLint level, GLint internalFormat, GLsizei width, GLsizei height,
+                    GLenum format, GLenum type, const void* data, GpuCategory category)
+    {
+        glTexImage2D(target, level, internalFormat, width, height, 0, format, type, data);
+        if(level > 0 && category == GPU_TEXTURE)
+            category = GPU_TEXTURE_MIPS;
+        record(TEXTURE, texture, part(target, level), (size_t)width * height * texelBytes(internalFormat), category, internalFormat);
+    }
+
+    // the texture must be bound; records the levels glGenerateMipmap creates from level 0 of every face
+    void generateMipmap(GLenum target, unsigned int texture)
+    {
+        glGenerateMipmap(target);
+        std::unordered_map<uint64_t, Allocation>::iterator it = allocations.find(key(TEXTURE, texture));
+        if(it == allocations.end())
+            return;
+        Allocation& allocation = it->second;
+        GpuCategory category = allocation.category == GPU_TEXTURE ? GPU_TEXTURE_MIPS : allocation.category;
+        std::map<unsigned int, Part> base;
+        for(std::map<unsigned int, Part>::iterator p = allocation.parts.begin(); p != allocation.parts.end(); ++p)
+            if(p->first % MAX_LEVELS == 0)
+                base[p->first] = p->second;
+        for(std::map<unsigned int, Part>::iterator p = base.begin(); p != base.end(); ++p)
+        {
+            size_t bytes = p->second.bytes / 4;
+            for(unsigned int level = 1; bytes > 0 && level < MAX_LEVELS; level++, bytes /= 4)
+                record(TEXTURE, texture, p->first + level, bytes, category, allocation.internalFormat);
+        }
+    }
+
+    // the renderbuffer must be bound
+    void renderbufferStorage(unsigned int renderbuffer, GLenum internalFormat, GLsizei width, GLsizei height)
+    {
+        glRenderbufferStorage(GL_RENDERBUFFER, internalFormat, width, height);
+        record(RENDERBUFFER, renderbuffer, 0, (size_t)width * height * texelBytes(internalFormat), GPU_RENDER_TARGET,
+               internalFormat);
+    }
+
+    void deleteBuffer(unsigned int& buffer)
+    {
+        RenderState::instance().bufferDeleted(buffer);
+        glDeleteBuffers(1, &buffer);
+        release(BUFFER, buffer);
+        buffer = 0;
+    }
+
+    void deleteTexture(unsigned int& texture)
+    {
+        RenderState::instance().textureDeleted(texture);
+        glDeleteTextures(1, &texture);
+        release(TEXTURE, texture);
+        texture = 0;
+    }
+
+    void deleteRenderbuffer(unsigned int& renderbuffer)
+    {
+        glDeleteRenderbuffers(1, &renderbuffer);
+        release(RENDERBUFFER, renderbuffer);
+        renderbuffer = 0;
+    }
+
+    size_t getTotal() const
+    {
+        return total;
+    }
+
+    size_t getCategory(GpuCategory category) const
+    {
+        return categories[category];
+    }
+
+    // totals by category, texture format and owner
+    void printUsage() const
+    {
+        static const char* names[GPU_CATEGORY_COUNT] = {
+                "vertex buffers", "index buffers", "instance buffers", "textures", "texture mips", "render targets"
+        };
+        std::map<GLenum, size_t> formats;
+        std::map<std::string, size_t> byOwner;
+        for(std::unordered_map<uint64_t, Allocation>::const_iterator it = allocations.begin(); it != allocations.end(); ++it)
+        {
+            if(it->second.internalFormat != 0)
+                formats[it->second.internalFormat] += it->second.bytes;
+            byOwner[ownerNames[it->second.owner]] += it->second.bytes;
+        }
+        std::cout << "gpu memory " << total / 1024 << " KB in " << allocations.size() << " objects" << std::endl;
+        for(unsigned int c = 0; c < GPU_CATEGORY_COUNT; c++)
+            std::cout << "  " << names[c] << ": " << categories[c] / 1024 << " KB" << std::endl;
+        for(std::map<GLenum, size_t>::iterator it = formats.begin(); it != formats.end(); ++it)
+            std::cout << "  format 0x" << std::hex << it->first << std::dec << ": " << it->second / 1024 << " KB" << std::endl;
+        for(std::map<std::string, size_t>::iterator it = byOwner.begin(); it != byOwner.end(); ++it)
+            std::cout << "  " << it->first << ": " << it->second / 1024 << " KB" << std::endl;
+    }
+
+    // everything not deleted yet, meant for the end of Deinitialize
+    void printLeaks() const
+    {
+        static const char* kinds[] = { "buffer", "texture", "renderbuffer" };
+        if(allocations.empty())
+        {
+            std::cout << "gpu memory: nothing leaked" << std::endl;
+            return;
+        }
+        std::cout << "gpu memory: " << allocations.size() << " objects, " << total / 1024 << " KB still alive" << std::endl;
+        for(std::unordered_map<uint64_t, Allocation>::const_iterator it = allocations.begin(); it != allocations.end(); ++it)
+            std::cout << "  " << kinds[it->first >> 32] << " " << (unsigned int)(it->first & 0xffffffffu) << ", "
+                      << it->second.bytes << " bytes, " << ownerNames[it->second.owner] << std::endl;
+    }
+private:
+    enum Kind
+    {
+        BUFFER = 0,
+        TEXTURE = 1,
+        RENDERBUFFER = 2
+    };
+    static const unsigned int MAX_LEVELS = 32;
+
+    struct Part
+    {
+        size_t bytes;
+        GpuCategory category;
+    };
+
+    struct Allocation
+    {
+        std::map<unsigned int, Part> parts;     // texture face * MAX_LEVELS + level, 0 for the rest
+        size_t bytes = 0;
+        GpuCategory category;                   // of the first allocation, parts may differ
+        GLenum internalFormat = 0;
+        unsigned int owner = 0;
+    };
+
+    std::unordered_map<uint64_t, Allocation> allocations;
+    std::vector<std::string> owners;
+    std::vector<std::string> ownerNames;
+    std::unordered_map<std::string, unsigned int> ownerIndices;
+    size_t categories[GPU_CATEGORY_COUNT] = {0};
+    size_t total = 0;
+
+    GpuMemory()
+    {
+        ownerNames.push_back("(no owner)");
+    }
+
+    static uint64_t key(Kind kind, unsigned int name)
+    {
+        return ((uint64_t)kind << 32) | name;
+    }
+
+    static unsigned int part(GLenum target, GLint level)
+    {
+        unsigned int face = target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
+                            ? target - GL_TEXTURE_CUBE_MAP_POSITIVE_X : 0;
+        return face * MAX_LEVELS + level;
+    }
+
+    // estimate; drivers pad three component formats to four
+    static size_t texelBytes(GLenum internalFormat)
+    {
+        switch(internalFormat)
+        {
+            case GL_RED: case GL_R8:
+                return 1;
+            case GL_RG: case GL_RG8: case GL_R16F:
+                return 2;
+            case GL_RGBA16F: case GL_RGB16F:
+                return 8;
+            case GL_RGBA32F: case GL_RGB32F:
+                return 16;
+            default:
+                return 4;
+        }
+    }
+
+    unsigned int currentOwner()
+    {
+        if(owners.empty())
+            return 0;
+        std::unordered_map<std::string, unsigned int>::iterator it = ownerIndices.find(owners.back());
+        if(it != ownerIndices.end())
+            return it->second;
+        ownerIndices[owners.back()] = ownerNames.size();
+        ownerNames.push_back(owners.back());
+        return ownerNames.size() - 1;
+    }
+
+    void record(Kind kind, unsigned int name, unsigned int index, size_t bytes, GpuCategory category, GLenum internalFormat)
+    {
+        uint64_t k = key(kind, name);
+        std::unordered_map<uint64_t, Allocation>::iterator it = allocations.find(k);
+        if(it == allocations.end())
+        {
+            Allocation allocation;
+            allocation.category = category;
+            allocation.internalFormat = internalFormat;
+            allocation.owner = currentOwner();
+            it = allocations.insert(std::make_pair(k, allocation)).first;
+        }
+        Allocation& allocation = it->second;
+        std::map<unsigned int, Part>::iterator previous = allocation.parts.find(index);
+        if(previous != allocation.parts.end())
+        {
+            categories[previous->second.category] -= previous->second.bytes;
+            allocation.bytes -= previous->second.bytes;
+            total -= previous->second.bytes;
+        }
+        Part p = { bytes, category };
+        allocation.parts[index] = p;
+        categories[category] += bytes;
+        allocation.bytes += bytes;
+        total += bytes;
+    }
+
+    void release(Kind kind, unsigned int name)
+    {
+        std::unordered_map<uint64_t, Allocation>::iterator it = allocations.find(key(kind, name));
+        if(it == allocations.end())
+            return;
+        for(std::map<unsigned int, Part>::iterator p = it->second.parts.begin(); p != it->second.parts.end(); ++p)
+            categories[p->second.category] -= p->second.bytes;
+        total -= it->second.bytes;
+        allocations.erase(it);
+    }
+};
+
+#endif //PROJECT_BASE_GPUMEMORY_H
@@ -0,0 +1,276 @@
+#ifndef PROJECT_BASE_IMPOSTOR_H
+#define PROJECT_BASE_IMPOSTOR_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <MojeKlase/Shader.h>
+#include <MojeKlase/Model.h>
+#include <MojeKlase/RenderState.h>
+#include <MojeKlase/GpuMemory.h>
+#include <MojeKlase/InstanceBuffer.h>
+#include <MojeKlase/TextureStreaming.h>
+#include <MojeKlase/AllocationTracker.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+
+const unsigned int IMPOSTOR_ALBEDO_TEXTURE_UNIT = 13;
+const unsigned int IMPOSTOR_NORMAL_TEXTURE_UNIT = 14;
+
+// Octahedral impostor: the model is rendered once from frames x frames directions spread over the
+// sphere into an albedo and a normal+depth atlas. Far away copies are then one instanced quad each,
+// facing the camera with the frame nearest to the view direction and lit from the baked normals.
+// Instances are faded in with a dither that is the complement of the one shader.fs fades geometry out with.
+class Impostor
+{
+public:
+    // pointLights is how many of the pointLights uniforms are lit, compiled into the shader
+    Impostor(Model& model, unsigned int pointLights, unsigned int frames = 8, unsigned int frameSize = 128)
+    {
+        this->frames = frames;
+        this->frameSize = frameSize;
+        boundsCenter = (model.getBoundsMin() + model.getBoundsMax()) * 0.5f;
+        boundsRadius = std::max(glm::length(model.getBoundsMax() - model.getBoundsMin()) * 0.5f, 1e-4f);
+
+        shader = new Shader("resources/shaders/impostor.vs", "resources/shaders/impostor.fs", nullptr,
+                            "#define ACTIVE_POINT_LIGHTS " + std::to_string(pointLights) + "\n");
+        shader->use();
+        shader->setInt("albedoAtlas", IMPOSTOR_ALBEDO_TEXTURE_UNIT);
+        shader->setInt("normalDepthAtlas", IMPOSTOR_NORMAL_TEXTURE_UNIT);
+        shader->setVec3("boundsCenter", boundsCenter);
+        shader->setFloat("boundsRadius", boundsRadius);
+        shader->setFloat("frames", (float)frames);
+
+        unsigned int size = frames * frameSize;
+        albedoTexture = createAtlas(size);
+        normalDepthTexture = createAtlas(size);
+        // lazy textures are still placeholders here, update() bakes again once they have come in
+        this->model = &model;
+        bakedLoadCount = TextureStreamer::instance().getLoadCount();
+        complete = model.texturesLoaded();
+        bake();
+        setupQuad();
+    }
+
+    ~Impostor()
+    {
+        GpuMemory& memory = GpuMemory::instance();
+        memory.deleteTexture(albedoTexture);
+        memory.deleteTexture(normalDepthTexture);
+        memory.deleteBuffer(quadVBO);
+        RenderState::instance().vertexArrayDeleted(quadVAO);
+        glDeleteVertexArrays(1, &quadVAO);
+        delete instances;
+        shader->deleteProgram();
+        delete shader;
+    }
+
+    // queues one copy for the next draw(); fade goes from 0, invisible, to 1, fully replacing the geometry
+    void add(const glm::mat4& transform, float fade)
+    {
+        transforms.push_back(transform);
+        fades.push_back(glm::vec4(1.0f, 1.0f, 1.0f, fade));
+    }
+
+    // once per frame outside the passes, re-bakes when the last of the model's textures has been decoded
+    void update()
+    {
+        TextureStreamer& streamer = TextureStreamer::instance();
+        if(complete || streamer.getLoadCount() == bakedLoadCount)
+            return;
+        bakedLoadCount = streamer.getLoadCount();
+        if(!model->texturesLoaded())
+            return;
+        AllocationScope streaming(SCOPE_STREAMING);
+        complete = true;
+        bake();
+    }
+
+    // draws and forgets everything added since the last call; lights, view and projection must already be set
+    void draw()
+    {
+        instances->upload(transforms.empty() ? nullptr : &transforms[0], transforms.size(),
+                          fades.empty() ? nullptr : &fades[0]);
+        unsigned int count = transforms.size();
+        transforms.clear();
+        fades.clear();
+        if(count == 0)
+            return;
+        // a model only ever seen from far away has no draws asking for its maps
+        if(!complete)
+            model->loadTextures();
+
+        RenderState& state = RenderState::instance();
+        state.bindTexture(IMPOSTOR_ALBEDO_TEXTURE_UNIT, GL_TEXTURE_2D, albedoTexture);
+        state.bindTexture(IMPOSTOR_NORMAL_TEXTURE_UNIT, GL_TEXTURE_2D, normalDepthTexture);
+        // the quad turns with the camera, its winding does not
+        bool cullFace = state.isEnabled(GL_CULL_FACE);
+        state.disable(GL_CULL_FACE);
+        shader->use();
+        state.bindVertexArray(quadVAO);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+        if(cullFace)
+            state.enable(GL_CULL_FACE);
+    }
+
+    Shader* getShader()
+    {
+        return shader;
+    }
+
+    // full sphere octahedral mapping, y up, must match impostor.vs
+    static glm::vec2 octEncode(glm::vec3 d)
+    {
+        d /= std::fabs(d.x) + std::fabs(d.y) + std::fabs(d.z);
+        glm::vec2 p(d.x, d.z);
+        if(d.y < 0.0f)
+            p = glm::vec2((1.0f - std::fabs(d.z)) * (d.x >= 0.0f ? 1.0f : -1.0f),
+                          (1.0f - std::fabs(d.x)) * (d.z >= 0.0f ? 1.0f : -1.0f));
+        return p * 0.5f + glm::vec2(0.5f);
+    }
+
+    static glm::vec3 octDecode(const glm::vec2& uv)
+    {
+        glm::vec2 p = uv * 2.0f - glm::vec2(1.0f);
+        glm::vec3 d(p.x, 1.0f - std::fabs(p.x) - std::fabs(p.y), p.y);
+        if(d.y < 0.0f)
+            d = glm::vec3((1.0f - std::fabs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f), d.y,
+                          (1.0f - std::fabs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+        return glm::normalize(d);
+    }
+private:
+    Model* model;
+    unsigned int bakedLoadCount;    // TextureStreamer's when update() last looked
+    bool complete;                  // baked with every texture the model has
+    Shader* shader;
+    InstanceBuffer* instances = nullptr;
+    unsigned int albedoTexture, normalDepthTexture;
+    unsigned int quadVAO, quadVBO;
+    unsigned int frames;
+    unsigned int frameSize;
+    glm::vec3 boundsCenter;
+    float boundsRadius;
+    std::vector<glm::mat4> transforms;
+    std::vector<glm::vec4> fades;
+
+    // renders all the frames into the atlases, which are reused when update() bakes again
+    void bake()
+    {
+        unsigned int size = frames * frameSize;
+        unsigned int FBO, depthBuffer;
+        RenderState& state = RenderState::instance();
+        glGenFramebuffers(1, &FBO);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        GpuMemory::instance().renderbufferStorage(depthBuffer, GL_DEPTH_COMPONENT24, size, size);
+        state.bindFramebuffer(FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalDepthTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, attachments);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "impostor framebuffer is not complete" << std::endl;
+
+        int viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        bool cullFace = state.isEnabled(GL_CULL_FACE);
+        state.disable(GL_CULL_FACE);
+        state.disable(GL_BLEND);
+        state.enable(GL_DEPTH_TEST);
+        state.depthMask(GL_TRUE);
+        glViewport(0, 0, size, size);
+        static const float clearColor[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        static const float clearDepth = 1.0f;
+        glClearBufferfv(GL_COLOR, 0, clearColor);
+        glClearBufferfv(GL_COLOR, 1, clearColor);
+        glClearBufferfv(GL_DEPTH, 0, &clearDepth);
+
+        // node transforms relative to the model root, parents come before their children
+        model->refreshMaterials();
+        const std::vector<ModelNode>& nodes = model->getNodes();
+        std::vector<glm::mat4> nodeTransforms(nodes.size());
+        for(unsigned int n = 0; n < nodes.size(); n++)
+            nodeTransforms[n] = nodes[n].parent == SceneGraph::NO_PARENT ? nodes[n].transform
+                                                                        : nodeTransforms[nodes[n].parent] * nodes[n].transform;
+
+        Shader bakeShader("resources/shaders/impostorBake.vs", "resources/shaders/impostorBake.fs");
+        bakeShader.use();
+        bakeShader.setMat4("projection", glm::ortho(-boundsRadius, boundsRadius, -boundsRadius, boundsRadius,
+                                                    0.0f, 2.0f * boundsRadius));
+        std::vector<Mesh>& meshes = model->getMeshes();
+        for(unsigned int y = 0; y < frames; y++)
+        {
+            for(unsigned int x = 0; x < frames; x++)
+            {
+                glm::vec3 direction = octDecode((glm::vec2(x, y) + glm::vec2(0.5f)) / (float)frames);
+                glm::vec3 reference = std::fabs(direction.y) > 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+                bakeShader.setMat4("view", glm::lookAt(boundsCenter + direction * boundsRadius, boundsCenter, reference));
+                glViewport(x * frameSize, y * frameSize, frameSize, frameSize);
+                for(unsigned int n = 0; n < nodes.size(); n++)
+                {
+                    bakeShader.setMat4("model", nodeTransforms[n]);
+                    for(unsigned int m = 0; m < nodes[n].meshes.size(); m++)
+                    {
+                        Mesh& mesh = meshes[nodes[n].meshes[m]];
+                        // translucent surfaces would need their own layer, the impostor shows what is behind them
+                        if(mesh.alphaMode == ALPHA_BLENDED)
+                            continue;
+                        bakeShader.setBool("useDiffuseMap", (mesh.materialFeatures & MATERIAL_DIFFUSE_MAP) != 0);
+                        mesh.Draw(&bakeShader);
+                    }
+                }
+            }
+        }
+        bakeShader.deleteProgram();
+
+        state.bindFramebuffer(0);
+        state.framebufferDeleted(FBO);
+        glDeleteFramebuffers(1, &FBO);
+        GpuMemory::instance().deleteRenderbuffer(depthBuffer);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        if(cullFace)
+            state.enable(GL_CULL_FACE);
+
+        // the frames have empty margins around the bounds sphere, so mips bleed very little across them
+        state.bindTexture(IMPOSTOR_ALBEDO_TEXTURE_UNIT, GL_TEXTURE_2D, albedoTexture);
+        GpuMemory::instance().generateMipmap(GL_TEXTURE_2D, albedoTexture);
+        state.bindTexture(IMPOSTOR_NORMAL_TEXTURE_UNIT, GL_TEXTURE_2D, normalDepthTexture);
+        GpuMemory::instance().generateMipmap(GL_TEXTURE_2D, normalDepthTexture);
+    }
+
+    unsigned int createAtlas(unsigned int size)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        RenderState::instance().bindTexture(IMPOSTOR_ALBEDO_TEXTURE_UNIT, GL_TEXTURE_2D, texture);
+        GpuMemory::instance().texImage2D(GL_TEXTURE_2D, texture, 0, GL_RGBA8, size, size, GL_RGBA, GL_UNSIGNED_BYTE, NULL,
+                                         GPU_RENDER_TARGET);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    void setupQuad()
+    {
+        static const float corners[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+        glGenVertexArrays(1, &quadVAO);
+        glGenBuffers(1, &quadVBO);
+        RenderState& state = RenderState::instance();
+        state.bindVertexArray(quadVAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        GpuMemory::instance().bufferData(GL_ARRAY_BUFFER, quadVBO, sizeof(corners), corners, GL_STATIC_DRAW, GPU_VERTEX_BUFFER);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        instances = new InstanceBuffer();
+        instances->attach(quadVAO);
+        state.bindVertexArray(0);
+    }
+};
+
+#endif //PROJECT_BASE_IMPOSTOR_H
@@ -0,0 +1,92 @@
+#ifndef PROJECT_BASE_INSTANCEBUFFER_H
+#define PROJECT_BASE_INSTANCEBUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <MojeKlase/RenderState.h>
+#include <MojeKlase/GpuMemory.h>
+
+#include <vector>
+#include <cstddef>
+
+// attribute locations read by the INSTANCED shaders, the transform takes four consecutive ones
+const unsigned int INSTANCE_TRANSFORM_LOCATION = 5;
+const unsigned int INSTANCE_TINT_LOCATION = 9;
+
+struct InstanceData
+{
+    glm::mat4 transform;
+    glm::vec4 tint;
+};
+
+// Per instance transforms and tints in one vertex buffer, read through divisor 1 attributes
+// by every VAO it is attached to.
+class InstanceBuffer
+{
+public:
+    InstanceBuffer()
+    {
+        glGenBuffers(1, &VBO);
+    }
+
+    ~InstanceBuffer()
+    {
+        GpuMemory::instance().deleteBuffer(VBO);
+    }
+
+    // tints default to white; the buffer only grows, smaller uploads reuse it
+    void upload(const glm::mat4* transforms, unsigned int count, const glm::vec4* tints = nullptr)
+    {
+        staging.resize(count);
+        for(unsigned int i = 0; i < count; i++)
+        {
+            staging[i].transform = transforms[i];
+            staging[i].tint = tints ? tints[i] : glm::vec4(1.0f);
+        }
+        this->count = count;
+        if(count == 0)
+            return;
+
+        RenderState::instance().bindBuffer(GL_ARRAY_BUFFER, VBO);
+        if(count > capacity)
+        {
+            capacity = count;
+            GpuMemory::instance().bufferData(GL_ARRAY_BUFFER, VBO, capacity * sizeof(InstanceData), &staging[0], GL_DYNAMIC_DRAW,
+                                             GPU_INSTANCE_BUFFER);
+        }
+        else
+            glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(InstanceData), &staging[0]);
+    }
+
+    // adds the instance attributes to a VAO, once per VAO
+    void attach(unsigned int VAO) const
+    {
+        RenderState& state = RenderState::instance();
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        for(unsigned int column = 0; column < 4; column++)
+        {
+            unsigned int location = INSTANCE_TRANSFORM_LOCATION + column;
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                                  (void*)(offsetof(InstanceData, transform) + column * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+        glVertexAttribPointer(INSTANCE_TINT_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              (void*)offsetof(InstanceData, tint));
+        glEnableVertexAttribArray(INSTANCE_TINT_LOCATION);
+        glVertexAttribDivisor(INSTANCE_TINT_LOCATION, 1);
+    }
+
+    unsigned int size() const
+    {
+        return count;
+    }
+private:
+    unsigned int VBO;
+    unsigned int capacity = 0;
+    unsigned int count = 0;
+    std::vector<InstanceData> staging;
+};
+
+#endif //PROJECT_BASE_INSTANCEBUFFER_H
@@ -0,0 +1,381 @@
+#ifndef PROJECT_BASE_JOBSYSTEM_H
+#define PROJECT_BASE_JOBSYSTEM_H
+
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+// counts jobs that have not finished yet, JobSystem::wait() returns once it drops to zero
+struct JobCounter
+{
+    std::atomic<unsigned int> pending;
+
+    JobCounter() : pending(0) {}
+    bool done() const
+    {
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+};
+
+// Work stealing scheduler. Every worker, the main thread being worker 0, owns a Chase-Lev deque: it pushes
+// and pops its own jobs at the bottom without locks while idle workers steal the oldest ones from the top.
+// A job counts as finished only once the children it spawned with runChild() have, so waiting on the
+// counter of a parent waits for its whole tree. Threads that wait run other jobs meanwhile instead of blocking.
+// Background jobs (long ones like texture decodes) go to a shared queue that only the worker threads
+// take from, so a frame waiting on its own jobs never picks one of them up.
+class JobSystem
+{
+public:
+    static JobSystem& instance()
+    {
+        static JobSystem jobs;
+        return jobs;
+    }
+
+    // counter, when given, is raised now and lowered once fn and all of its children have finished
+    void run(std::function<void()> fn, JobCounter* counter = nullptr, bool background = false)
+    {
+        Job* job = allocateJob(std::move(fn), nullptr, counter, background);
+        if(counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        push(job);
+    }
+
+    // only from inside a job: the running job does not finish before this one has
+    void runChild(std::function<void()> fn)
+    {
+        Job* parent = currentJob();
+        Job* job = allocateJob(std::move(fn), parent, nullptr, parent && parent->background);
+        if(parent)
+            parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+        push(job);
+    }
+
+    // runs other jobs until counter is done; background jobs only if nothing else would ever run them
+    void wait(JobCounter& counter)
+    {
+        int index = workerIndex();
+        bool background = index != 0 || threads.empty();
+        while(!counter.done())
+        {
+            Job* job = take(index, background);
+            if(job)
+                execute(job);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    // runs one queued job on the calling thread, the same ones wait() would; false if there was none
+    bool runOne()
+    {
+        int index = workerIndex();
+        Job* job = take(index, index != 0 || threads.empty());
+        if(!job)
+            return false;
+        execute(job);
+        return true;
+    }
+
+    // body(begin, end) over [0, count) in ranges of about grain, the calling thread takes the first range;
+    // called from a background job the ranges are background jobs as well
+    void parallelFor(unsigned int count, unsigned int grain, const std::function<void(unsigned int, unsigned int)>& body)
+    {
+        grain = std::max(grain, 1u);
+        if(count <= grain || queues.size() == 1)
+        {
+            body(0, count);
+            return;
+        }
+        unsigned int ranges = std::min<unsigned int>((count + grain - 1) / grain, queues.size() * 4);
+        unsigned int size = (count + ranges - 1) / ranges;
+        JobCounter counter;
+        bool background = currentJob() && currentJob()->background;
+        for(unsigned int begin = size; begin < count; begin += size)
+        {
+            unsigned int end = std::min(begin + size, count);
+            run([&body, begin, end]() { body(begin, end); }, &counter, background);
+        }
+        body(0, std::min(size, count));
+        wait(counter);
+    }
+
+    // workers including the main thread; only call while no jobs are queued or running
+    void setWorkerCount(unsigned int count)
+    {
+        stop();
+        for(unsigned int i = 0; i < queues.size(); i++)
+            delete queues[i];
+        queues.clear();
+        start(std::max(count, 1u));
+    }
+
+    unsigned int getWorkerCount() const
+    {
+        return queues.size();
+    }
+private:
+    struct Job
+    {
+        std::function<void()> function;
+        Job* parent;
+        JobCounter* counter;
+        std::atomic<unsigned int> unfinished;   // the job itself plus its unfinished children
+        bool background;
+
+        Job(std::function<void()> function, Job* parent, JobCounter* counter, bool background)
+            : function(std::move(function)), parent(parent), counter(counter), unfinished(1), background(background) {}
+    };
+
+    // Chase-Lev deque with the memory orders of Le et al., "Correct and Efficient Work-Stealing for Weak
+    // Memory Models"; fixed size, a full one makes push() fail and the caller run the job itself
+    class WorkQueue
+    {
+    public:
+        WorkQueue() : top(0), bottom(0)
+        {
+            for(unsigned int i = 0; i < CAPACITY; i++)
+                slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+
+        // owner only
+        bool push(Job* job)
+        {
+            long long b = bottom.load(std::memory_order_relaxed);
+            long long t = top.load(std::memory_order_acquire);
+            if(b - t >= (long long)CAPACITY)
+                return false;
+            slots[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // owner only, newest first
+        Job* pop()
+        {
+            long long b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long long t = top.load(std::memory_order_relaxed);
+            if(t > b)
+            {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            Job* job = slots[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+            if(t == b)
+            {
+                // the last one, a thief may be taking it right now
+                if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    job = nullptr;
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return job;
+        }
+
+        // any thread, oldest first; nullptr when empty or when another thread got there first
+        Job* steal()
+        {
+            long long t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long long b = bottom.load(std::memory_order_acquire);
+            if(t >= b)
+                return nullptr;
+            Job* job = slots[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+            if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+            return job;
+        }
+    private:
+        static const unsigned int CAPACITY = 4096;
+        std::atomic<long long> top;
+        std::atomic<long long> bottom;
+        std::atomic<Job*> slots[CAPACITY];
+    };
+
+    std::vector<WorkQueue*> queues;         // one per worker, index 0 belongs to the main thread
+    std::vector<std::thread> threads;
+    std::mutex sharedMutex;
+    std::deque<Job*> shared;                // jobs from threads that are not workers
+    std::deque<Job*> backgroundJobs;
+    std::atomic<unsigned int> available;    // queued jobs, roughly; sleeping workers wake up when it is not 0
+    std::atomic<unsigned int> sleeping;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::mutex poolMutex;
+    std::vector<Job*> freeJobs;             // finished jobs for reuse, a frame's jobs do not go to the heap
+
+    // the thread that first uses the job system becomes worker 0, which is meant to be the main thread
+    JobSystem() : available(0), sleeping(0)
+    {
+        start(std::max(std::thread::hardware_concurrency(), 1u));
+    }
+    ~JobSystem()
+    {
+        stop();
+        for(unsigned int i = 0; i < queues.size(); i++)
+            delete queues[i];
+        for(unsigned int i = 0; i < freeJobs.size(); i++)
+            delete freeJobs[i];
+    }
+
+    void start(unsigned int count)
+    {
+        workerIndex() = 0;
+        for(unsigned int i = 0; i < count; i++)
+            queues.push_back(new WorkQueue());
+        stopping = false;
+        for(unsigned int i = 1; i < count; i++)
+            threads.push_back(std::thread(&JobSystem::work, this, i));
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(unsigned int i = 0; i < threads.size(); i++)
+            threads[i].join();
+        threads.clear();
+    }
+
+    // -1 on threads that are not workers
+    static int& workerIndex()
+    {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    static Job*& currentJob()
+    {
+        static thread_local Job* job = nullptr;
+        return job;
+    }
+
+    void push(Job* job)
+    {
+        int index = workerIndex();
+        if(job->background || index < 0)
+        {
+            std::lock_guard<std::mutex> lock(sharedMutex);
+            (job->background ? backgroundJobs : shared).push_back(job);
+        }
+        else if(!queues[index]->push(job))
+        {
+            execute(job);
+            return;
+        }
+        available.fetch_add(1, std::memory_order_seq_cst);
+        if(sleeping.load(std::memory_order_seq_cst) > 0)
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wake.notify_one();
+        }
+    }
+
+    // own deque, then the others', then the shared queues
+    Job* take(int index, bool background)
+    {
+        Job* job = index >= 0 ? queues[index]->pop() : nullptr;
+        unsigned int start = index >= 0 ? index : 0;
+        for(unsigned int k = 1; !job && k <= queues.size(); k++)
+        {
+            unsigned int victim = (start + k) % queues.size();
+            if((int)victim != index)
+                job = queues[victim]->steal();
+        }
+        if(!job)
+        {
+            std::lock_guard<std::mutex> lock(sharedMutex);
+            std::deque<Job*>* queue = !shared.empty() ? &shared : background && !backgroundJobs.empty() ? &backgroundJobs : nullptr;
+            if(queue)
+            {
+                job = queue->front();
+                queue->pop_front();
+            }
+        }
+        if(job)
+            available.fetch_sub(1, std::memory_order_relaxed);
+        return job;
+    }
+
+    void execute(Job* job)
+    {
+        Job* previous = currentJob();
+        currentJob() = job;
+        job->function();
+        currentJob() = previous;
+        finish(job);
+    }
+
+    void finish(Job* job)
+    {
+        if(job->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        if(job->parent)
+            finish(job->parent);
+        if(job->counter)
+            job->counter->pending.fetch_sub(1, std::memory_order_release);
+        recycleJob(job);
+    }
+
+    Job* allocateJob(std::function<void()> fn, Job* parent, JobCounter* counter, bool background)
+    {
+        Job* job = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            if(!freeJobs.empty())
+            {
+                job = freeJobs.back();
+                freeJobs.pop_back();
+            }
+        }
+        if(!job)
+            return new Job(std::move(fn), parent, counter, background);
+        job->function = std::move(fn);
+        job->parent = parent;
+        job->counter = counter;
+        job->unfinished.store(1, std::memory_order_relaxed);
+        job->background = background;
+        return job;
+    }
+
+    void recycleJob(Job* job)
+    {
+        // whatever the function captured goes now, not when the job is reused
+        job->function = nullptr;
+        std::lock_guard<std::mutex> lock(poolMutex);
+        freeJobs.push_back(job);
+    }
+
+    void work(unsigned int index)
+    {
+        workerIndex() = index;
+        for(;;)
+        {
+            Job* job = take(index, true);
+            if(job)
+            {
+                execute(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleeping.fetch_add(1, std::memory_order_seq_cst);
+            wake.wait(lock, [this]() { return stopping || available.load(std::memory_order_seq_cst) > 0; });
+            sleeping.fetch_sub(1, std::memory_order_relaxed);
+            if(stopping)
+                break;
+        }
+    }
+};
+
+#endif //PROJECT_BASE_JOBSYSTEM_H
@@ -0,0 +1,577 @@
+#ifndef PROJECT_BASE_LIGHTMAP_H
+#define PROJECT_BASE_LIGHTMAP_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <MojeKlase/Model.h>
+#include <MojeKlase/Lights.h>
+#include <MojeKlase/BVH.h>
+#include <MojeKlase/GpuMemory.h>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <cstdint>
+#include <cmath>
+#include <cfloat>
+
+const unsigned int LIGHTMAP_TEXTURE_UNIT = 7;
+
+struct LightmapSettings
+{
+    int resolution = 512;
+    int padding = 2;
+    int indirectSamples = 32;
+    float albedo = 0.5f;      // bounce albedo, the baker has no CPU copy of the diffuse maps
+    float shadowBias = 0.002f;
+};
+
+// Bakes ambient + diffuse irradiance of the static lights (direct and one bounce) into a lightmap atlas.
+// Specular and the camera spotlight stay dynamic in shader.fs, which multiplies the baked value by the albedo.
+class LightmapBaker
+{
+public:
+    LightmapBaker(const LightmapSettings& settings = LightmapSettings())
+    {
+        this->settings = settings;
+    }
+
+    // unwraps the model into the lightmap UV set, then loads the atlas from cachePath or bakes and caches it
+    unsigned int bake(Model& model, const glm::mat4& modelMatrix, const DirLightParams& dirLight,
+                      const glm::vec3* pointPositions, const PointLightParams* pointLights, unsigned int pointCount,
+                      const std::string& cachePath)
+    {
+        this->modelMatrix = modelMatrix;
+        this->dirLight = dirLight;
+        this->pointPositions.assign(pointPositions, pointPositions + pointCount);
+        this->pointLights.assign(pointLights, pointLights + pointCount);
+
+        generateUVs(model);
+        uint64_t key = cacheKey(model);
+
+        std::vector<float> pixels;
+        if(!loadCache(cachePath, key, pixels))
+        {
+            std::cout << "baking lightmap " << cachePath << std::endl;
+            double start = glfwGetTime();
+            buildScene(model);
+            rasterize(model);
+            pixels.assign(settings.resolution * settings.resolution * 3, 0.0f);
+            bakeTexels(pixels);
+            dilate(pixels);
+            std::cout << "lightmap baked in " << glfwGetTime() - start << "s on "
+                      << workerCount() << " threads" << std::endl;
+            saveCache(cachePath, key, pixels);
+        }
+        return upload(pixels);
+    }
+private:
+    struct Chart
+    {
+        unsigned int mesh;
+        int axis;
+        std::vector<unsigned int> triangles;
+        glm::vec2 boundsMin, boundsMax;
+        int x, y, width, height;
+    };
+
+    struct Texel
+    {
+        unsigned int pixel;
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec3 faceNormal;
+    };
+
+    LightmapSettings settings;
+    glm::mat4 modelMatrix;
+    DirLightParams dirLight;
+    std::vector<glm::vec3> pointPositions;
+    std::vector<PointLightParams> pointLights;
+    BVH bvh;
+    std::vector<Texel> texels;
+
+    static unsigned int workerCount()
+    {
+        unsigned int n = std::thread::hardware_concurrency();
+        return n ? n : 4;
+    }
+
+    glm::vec3 toWorld(const glm::vec3& p) const
+    {
+        return glm::vec3(modelMatrix * glm::vec4(p, 1.0f));
+    }
+
+    static glm::vec2 project(const glm::vec3& p, int axis)
+    {
+        if(axis == 0)
+            return glm::vec2(p.z, p.y);
+        if(axis == 1)
+            return glm::vec2(p.x, p.z);
+        return glm::vec2(p.x, p.y);
+    }
+
+    static unsigned int findRoot(std::vector<unsigned int>& parent, unsigned int i)
+    {
+        while(parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    // Charts are connected triangles (welded by position) sharing the dominant axis of their normal,
+    // projected onto that axis plane and shelf packed into the atlas at a uniform world-space texel density.
+    void generateUVs(Model& model)
+    {
+        std::vector<Mesh>& meshes = model.getMeshes();
+        std::vector<Chart> charts;
+        float totalArea = 0.0f;
+
+        for(unsigned int m = 0; m < meshes.size(); m++)
+        {
+            const std::vector<Vertex>& vertices = meshes[m].vertices;
+            const std::vector<unsigned int>& indices = meshes[m].indices;
+            unsigned int triangleCount = indices.size() / 3;
+
+            std::vector<int> axis(triangleCount);
+            std::vector<unsigned int> parent(triangleCount);
+            std::unordered_map<uint64_t, unsigned int> firstByCorner;
+            for(unsigned int t = 0; t < triangleCount; t++)
+            {
+                parent[t] = t;
+                glm::vec3 p0 = toWorld(vertices[indices[t*3]].Position);
+                glm::vec3 n = glm::cross(toWorld(vertices[indices[t*3+1]].Position) - p0,
+                                         toWorld(vertices[indices[t*3+2]].Position) - p0);
+                glm::vec3 a = glm::abs(n);
+                int dominant = a.x >= a.y && a.x >= a.z ? 0 : (a.y >= a.z ? 1 : 2);
+                axis[t] = dominant * 2 + (n[dominant] < 0.0f ? 1 : 0);
+
+                for(unsigned int j = 0; j < 3; j++)
+                {
+                    const glm::vec3& p = vertices[indices[t*3+j]].Position;
+                    uint64_t qx = (uint64_t)(int64_t)std::floor(p.x * 1e4f) & 0xfffff;
+                    uint64_t qy = (uint64_t)(int64_t)std::floor(p.y * 1e4f) & 0xfffff;
+                    uint64_t qz = (uint64_t)(int64_t)std::floor(p.z * 1e4f) & 0xfffff;
+                    uint64_t corner = (qx << 43) | (qy << 23) | (qz << 3) | (uint64_t)axis[t];
+                    std::unordered_map<uint64_t, unsigned int>::iterator it = firstByCorner.find(corner);
+                    if(it == firstByCorner.end())
+                        firstByCorner[corner] = t;
+                    else
+                        parent[findRoot(parent, t)] = findRoot(parent, it->second);
+                }
+            }
+
+            std::unordered_map<unsigned int, unsigned int> chartByRoot;
+            for(unsigned int t = 0; t < triangleCount; t++)
+            {
+                unsigned int root = findRoot(parent, t);
+                std::unordered_map<unsigned int, unsigned int>::iterator it = chartByRoot.find(root);
+                if(it == chartByRoot.end())
+                {
+                    it = chartByRoot.insert(std::make_pair(root, (unsigned int)charts.size())).first;
+                    Chart chart;
+                    chart.mesh = m;
+                    chart.axis = axis[t];
+                    chart.boundsMin = glm::vec2(FLT_MAX);
+                    chart.boundsMax = glm::vec2(-FLT_MAX);
+                    charts.push_back(chart);
+                }
+                Chart& chart = charts[it->second];
+                chart.triangles.push_back(t);
+                for(unsigned int j = 0; j < 3; j++)
+                {
+                    glm::vec2 uv = project(toWorld(vertices[indices[t*3+j]].Position), chart.axis / 2);
+                    chart.boundsMin = glm::min(chart.boundsMin, uv);
+                    chart.boundsMax = glm::max(chart.boundsMax, uv);
+                }
+            }
+        }
+        for(unsigned int c = 0; c < charts.size(); c++)
+        {
+            glm::vec2 extent = charts[c].boundsMax - charts[c].boundsMin;
+            totalArea += extent.x * extent.y;
+        }
+
+        float scale = std::sqrt(0.5f * settings.resolution * settings.resolution / std::max(totalArea, 1e-6f));
+        while(!pack(charts, scale) && scale > 1e-3f)
+            scale *= 0.9f;
+
+        // rewrite every mesh chart by chart, duplicating vertices that end up on more than one chart
+        for(unsigned int m = 0; m < meshes.size(); m++)
+        {
+            std::vector<Vertex> vertices;
+            std::vector<unsigned int> indices;
+            std::vector<int> remapChart(meshes[m].vertices.size(), -1);
+            std::vector<unsigned int> remap(meshes[m].vertices.size());
+            for(unsigned int c = 0; c < charts.size(); c++)
+            {
+                const Chart& chart = charts[c];
+                if(chart.mesh != m)
+                    continue;
+                for(unsigned int i = 0; i < chart.triangles.size(); i++)
+                {
+                    for(unsigned int j = 0; j < 3; j++)
+                    {
+                        unsigned int original = meshes[m].indices[chart.triangles[i]*3 + j];
+                        if(remapChart[original] != (int)c)
+                        {
+                            Vertex vertex = meshes[m].vertices[original];
+                            glm::vec2 uv = (project(toWorld(vertex.Position), chart.axis / 2) - chart.boundsMin) * scale;
+                            vertex.LightmapCoords = (glm::vec2(chart.x + settings.padding, chart.y + settings.padding) + uv)
+                                                    / (float)settings.resolution;
+                            remapChart[original] = c;
+                            remap[original] = vertices.size();
+                            vertices.push_back(vertex);
+                        }
+                        indices.push_back(remap[original]);
+                    }
+                }
+            }
+            if(vertices.empty())
+                continue;
+            meshes[m].vertices.swap(vertices);
+            meshes[m].indices.swap(indices);
+            meshes[m].updateBuffers();
+        }
+    }
+
+    bool pack(std::vector<Chart>& charts, float scale)
+    {
+        std::vector<unsigned int> order(charts.size());
+        for(unsigned int c = 0; c < charts.size(); c++)
+        {
+            glm::vec2 extent = (charts[c].boundsMax - charts[c].boundsMin) * scale;
+            charts[c].width = (int)std::ceil(extent.x) + 2 * settings.padding + 1;
+            charts[c].height = (int)std::ceil(extent.y) + 2 * settings.padding + 1;
+            order[c] = c;
+        }
+        std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+            return charts[a].height > charts[b].height;
+        });
+
+        int x = 0, y = 0, shelfHeight = 0;
+        for(unsigned int i = 0; i < order.size(); i++)
+        {
+            Chart& chart = charts[order[i]];
+            if(chart.width > settings.resolution)
+                return false;
+            if(x + chart.width > settings.resolution)
+            {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            if(y + chart.height > settings.resolution)
+                return false;
+            chart.x = x;
+            chart.y = y;
+            x += chart.width;
+            shelfHeight = std::max(shelfHeight, chart.height);
+        }
+        return true;
+    }
+
+    void buildScene(Model& model)
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<Mesh>& meshes = model.getMeshes();
+        for(unsigned int m = 0; m < meshes.size(); m++)
+            for(unsigned int i = 0; i < meshes[m].indices.size(); i++)
+                positions.push_back(toWorld(meshes[m].vertices[meshes[m].indices[i]].Position));
+        bvh.build(positions);
+    }
+
+    // finds the surface point behind every covered texel of the atlas
+    void rasterize(Model& model)
+    {
+        int res = settings.resolution;
+        std::vector<int> owner(res * res, -1);
+        texels.clear();
+        glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(modelMatrix)));
+
+        std::vector<Mesh>& meshes = model.getMeshes();
+        for(unsigned int m = 0; m < meshes.size(); m++)
+        {
+            const std::vector<Vertex>& vertices = meshes[m].vertices;
+            const std::vector<unsigned int>& indices = meshes[m].indices;
+            for(unsigned int t = 0; t + 2 < indices.size(); t += 3)
+            {
+                const Vertex* v[3] = { &vertices[indices[t]], &vertices[indices[t+1]], &vertices[indices[t+2]] };
+                glm::vec2 a = v[0]->LightmapCoords * (float)res;
+                glm::vec2 b = v[1]->LightmapCoords * (float)res;
+                glm::vec2 c = v[2]->LightmapCoords * (float)res;
+                float area = (b.x - a.x)*(c.y - a.y) - (c.x - a.x)*(b.y - a.y);
+                if(std::fabs(area) < 1e-8f)
+                    continue;
+
+                glm::vec3 p[3] = { toWorld(v[0]->Position), toWorld(v[1]->Position), toWorld(v[2]->Position) };
+                glm::vec3 faceNormal = glm::normalize(glm::cross(p[1] - p[0], p[2] - p[0]));
+
+                int x0 = std::max(0, (int)std::floor(std::min(a.x, std::min(b.x, c.x))));
+                int x1 = std::min(res - 1, (int)std::ceil(std::max(a.x, std::max(b.x, c.x))));
+                int y0 = std::max(0, (int)std::floor(std::min(a.y, std::min(b.y, c.y))));
+                int y1 = std::min(res - 1, (int)std::ceil(std::max(a.y, std::max(b.y, c.y))));
+                for(int y = y0; y <= y1; y++)
+                {
+                    for(int x = x0; x <= x1; x++)
+                    {
+                        glm::vec2 s(x + 0.5f, y + 0.5f);
+                        float w0 = ((b.x - s.x)*(c.y - s.y) - (c.x - s.x)*(b.y - s.y)) / area;
+                        float w1 = ((c.x - s.x)*(a.y - s.y) - (a.x - s.x)*(c.y - s.y)) / area;
+                        float w2 = 1.0f - w0 - w1;
+                        // slightly conservative so texels straddling chart edges still get a sample
+                        const float eps = -0.05f;
+                        if(w0 < eps || w1 < eps || w2 < eps)
+                            continue;
+                        w0 = glm::clamp(w0, 0.0f, 1.0f);
+                        w1 = glm::clamp(w1, 0.0f, 1.0f);
+                        w2 = glm::clamp(w2, 0.0f, 1.0f);
+                        float sum = w0 + w1 + w2;
+
+                        Texel texel;
+                        texel.pixel = y * res + x;
+                        texel.position = (p[0]*w0 + p[1]*w1 + p[2]*w2) / sum;
+                        texel.normal = glm::normalize(normalMatrix * (v[0]->Normal*w0 + v[1]->Normal*w1 + v[2]->Normal*w2));
+                        texel.faceNormal = faceNormal;
+                        if(owner[texel.pixel] < 0)
+                        {
+                            owner[texel.pixel] = texels.size();
+                            texels.push_back(texel);
+                        }
+                        else
+                            texels[owner[texel.pixel]] = texel;
+                    }
+                }
+            }
+        }
+    }
+
+    // ambient + diffuse irradiance from the static lights, matching CalcDirLight and calcPointLight
+    glm::vec3 directIrradiance(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& faceNormal, bool withAmbient) const
+    {
+        glm::vec3 origin = position + faceNormal * settings.shadowBias;
+        glm::vec3 result(0.0f);
+
+        glm::vec3 lightDir = glm::normalize(-dirLight.direction);
+        if(withAmbient)
+            result += dirLight.ambient;
+        float diff = std::max(glm::dot(normal, lightDir), 0.0f);
+        if(diff > 0.0f && !bvh.occluded(origin, lightDir, FLT_MAX))
+            result += dirLight.diffuse * diff;
+
+        for(unsigned int i = 0; i < pointLights.size(); i++)
+        {
+            glm::vec3 toLight = pointPositions[i] - position;
+            float distance = glm::length(toLight);
+            float attenuation = pointLightAttenuation(pointLights[i], distance);
+            if(withAmbient)
+                result += pointLights[i].ambient * attenuation;
+            toLight /= distance;
+            diff = std::max(glm::dot(normal, toLight), 0.0f);
+            if(diff > 0.0f && !bvh.occluded(origin, toLight, distance))
+                result += pointLights[i].diffuse * diff * attenuation;
+        }
+        return result;
+    }
+
+    glm::vec3 indirectIrradiance(const Texel& texel, std::minstd_rand& rng) const
+    {
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        glm::vec3 n = texel.normal;
+        glm::vec3 helper = std::fabs(n.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 tangent = glm::normalize(glm::cross(helper, n));
+        glm::vec3 bitangent = glm::cross(n, tangent);
+        glm::vec3 origin = texel.position + texel.faceNormal * settings.shadowBias;
+
+        glm::vec3 sum(0.0f);
+        for(int i = 0; i < settings.indirectSamples; i++)
+        {
+            // cosine weighted, so the estimator is just the average of the reflected irradiance
+            float r1 = uniform(rng), r2 = uniform(rng);
+            float r = std::sqrt(r1), phi = 6.2831853f * r2;
+            glm::vec3 dir = tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + n * std::sqrt(1.0f - r1);
+
+            RayHit hit;
+            if(!bvh.intersect(origin, dir, FLT_MAX, hit))
+                continue;
+            glm::vec3 hitNormal = bvh.triangleNormal(hit.triangle);
+            if(glm::dot(hitNormal, dir) > 0.0f)
+                hitNormal = -hitNormal;
+            glm::vec3 hitPosition = origin + dir * hit.t;
+            sum += directIrradiance(hitPosition, hitNormal, hitNormal, false) * settings.albedo;
+        }
+        return settings.indirectSamples > 0 ? sum / (float)settings.indirectSamples : sum;
+    }
+
+    void bakeTexels(std::vector<float>& pixels)
+    {
+        std::atomic<unsigned int> next(0);
+        const unsigned int chunk = 64;
+        std::vector<std::thread> workers;
+        for(unsigned int w = 0; w < workerCount(); w++)
+        {
+            workers.push_back(std::thread([&]() {
+                for(;;)
+                {
+                    unsigned int begin = next.fetch_add(chunk);
+                    if(begin >= texels.size())
+                        break;
+                    unsigned int end = std::min<unsigned int>(begin + chunk, texels.size());
+                    for(unsigned int i = begin; i < end; i++)
+                    {
+                        const Texel& texel = texels[i];
+                        std::minstd_rand rng(i * 9781u + 1u);
+                        glm::vec3 irradiance = directIrradiance(texel.position, texel.normal, texel.faceNormal, true)
+                                               + indirectIrradiance(texel, rng);
+                        pixels[texel.pixel*3] = irradiance.x;
+                        pixels[texel.pixel*3+1] = irradiance.y;
+                        pixels[texel.pixel*3+2] = irradiance.z;
+                    }
+                }
+            }));
+        }
+        for(unsigned int w = 0; w < workers.size(); w++)
+            workers[w].join();
+    }
+
+    // grows the charts into their padding so bilinear filtering never reads unbaked texels
+    void dilate(std::vector<float>& pixels)
+    {
+        int res = settings.resolution;
+        std::vector<unsigned char> filled(res * res, 0);
+        for(unsigned int i = 0; i < texels.size(); i++)
+            filled[texels[i].pixel] = 1;
+
+        for(int pass = 0; pass < settings.padding; pass++)
+        {
+            std::vector<unsigned char> nextFilled = filled;
+            for(int y = 0; y < res; y++)
+            {
+                for(int x = 0; x < res; x++)
+                {
+                    int index = y * res + x;
+                    if(filled[index])
+                        continue;
+                    glm::vec3 sum(0.0f);
+                    int count = 0;
+                    for(int dy = -1; dy <= 1; dy++)
+                    {
+                        for(int dx = -1; dx <= 1; dx++)
+                        {
+                            int nx = x + dx, ny = y + dy;
+                            if(nx < 0 || ny < 0 || nx >= res || ny >= res || !filled[ny * res + nx])
+                                continue;
+                            int n = ny * res + nx;
+                            sum += glm::vec3(pixels[n*3], pixels[n*3+1], pixels[n*3+2]);
+                            count++;
+                        }
+                    }
+                    if(count == 0)
+                        continue;
+                    sum /= (float)count;
+                    pixels[index*3] = sum.x;
+                    pixels[index*3+1] = sum.y;
+                    pixels[index*3+2] = sum.z;
+                    nextFilled[index] = 1;
+                }
+            }
+            filled.swap(nextFilled);
+        }
+    }
+
+    static void hashBytes(uint64_t& hash, const void* data, size_t size)
+    {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for(size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    }
+
+    uint64_t cacheKey(Model& model) const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        std::vector<Mesh>& meshes = model.getMeshes();
+        for(unsigned int m = 0; m < meshes.size(); m++)
+        {
+            if(!meshes[m].vertices.empty())
+                hashBytes(hash, &meshes[m].vertices[0], meshes[m].vertices.size() * sizeof(Vertex));
+            if(!meshes[m].indices.empty())
+                hashBytes(hash, &meshes[m].indices[0], meshes[m].indices.size() * sizeof(unsigned int));
+        }
+        hashBytes(hash, &modelMatrix, sizeof(modelMatrix));
+        hashBytes(hash, &dirLight, sizeof(dirLight));
+        if(!pointLights.empty())
+        {
+            hashBytes(hash, &pointPositions[0], pointPositions.size() * sizeof(glm::vec3));
+            hashBytes(hash, &pointLights[0], pointLights.size() * sizeof(PointLightParams));
+        }
+        hashBytes(hash, &settings, sizeof(settings));
+        return hash;
+    }
+
+    bool loadCache(const std::string& path, uint64_t key, std::vector<float>& pixels) const
+    {
+        std::ifstream in(path, std::ios::binary);
+        if(!in)
+            return false;
+        char magic[4];
+        uint64_t storedKey;
+        int32_t width, height;
+        in.read(magic, 4);
+        in.read((char*)&storedKey, sizeof(storedKey));
+        in.read((char*)&width, sizeof(width));
+        in.read((char*)&height, sizeof(height));
+        if(!in || std::string(magic, 4) != "LMAP" || storedKey != key
+           || width != settings.resolution || height != settings.resolution)
+        {
+            std::cout << "lightmap cache out of date: " << path << std::endl;
+            return false;
+        }
+        pixels.resize(width * height * 3);
+        in.read((char*)&pixels[0], pixels.size() * sizeof(float));
+        return (bool)in;
+    }
+
+    void saveCache(const std::string& path, uint64_t key, const std::vector<float>& pixels) const
+    {
+        std::ofstream out(path, std::ios::binary);
+        if(!out)
+        {
+            std::cout << "failed to write lightmap cache " << path << std::endl;
+            return;
+        }
+        int32_t size = settings.resolution;
+        out.write("LMAP", 4);
+        out.write((const char*)&key, sizeof(key));
+        out.write((const char*)&size, sizeof(size));
+        out.write((const char*)&size, sizeof(size));
+        out.write((const char*)&pixels[0], pixels.size() * sizeof(float));
+    }
+
+    unsigned int upload(const std::vector<float>& pixels) const
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        RenderState::instance().bindTexture(GL_TEXTURE_2D, textureID);
+        GpuMemory::instance().texImage2D(GL_TEXTURE_2D, textureID, 0, GL_RGB16F, settings.resolution, settings.resolution,
+                                         GL_RGB, GL_FLOAT, &pixels[0], GPU_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        return textureID;
+    }
+};
+
+#endif //PROJECT_BASE_LIGHTMAP_H
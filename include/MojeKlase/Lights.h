@@ -0,0 +1,30 @@
+#ifndef PROJECT_BASE_LIGHTS_H
+#define PROJECT_BASE_LIGHTS_H
+
+#include <glm/glm.hpp>
+
+// CPU side mirrors of the DirLight and PointLight structs in shader.fs
+struct DirLightParams
+{
+    glm::vec3 direction;
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+};
+
+struct PointLightParams
+{
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+inline float pointLightAttenuation(const PointLightParams& light, float distance)
+{
+    return 1.0f / (light.constant + light.linear*distance + light.quadratic*(distance*distance));
+}
+
+#endif //PROJECT_BASE_LIGHTS_H
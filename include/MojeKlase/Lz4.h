@@ -0,0 +1,170 @@
+#ifndef PROJECT_BASE_LZ4_H
+#define PROJECT_BASE_LZ4_H
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+// LZ4 block format, compatible with the reference LZ4_compress_default/LZ4_decompress_safe.
+// The compressor is a plain greedy one with a single hash table; good enough for packing assets
+// offline. The decompressor checks every length against both buffers, so a corrupt pack fails
+// instead of writing out of bounds.
+class Lz4
+{
+public:
+    static size_t compressBound(size_t size)
+    {
+        return size + size / 255 + 16;
+    }
+
+    // returns the compressed size, 0 if it does not fit into capacity
+    static size_t compress(const char* source, size_t size, char* destination, size_t capacity)
+    {
+        std::vector<uint32_t> table(1 << HASH_BITS, 0);    // position + 1 of the last sequence with that hash
+        char* out = destination;
+        char* outEnd = destination + capacity;
+        size_t anchor = 0;
+        size_t i = 0;
+        // the format wants the last match to start MATCH_LIMIT bytes before the end and leaves the
+        // last LAST_LITERALS bytes as literals
+        while(size > MATCH_LIMIT && i < size - MATCH_LIMIT)
+        {
+            uint32_t sequence = read32(source + i);
+            uint32_t& slot = table[hash(sequence)];
+            size_t candidate = slot;
+            slot = (uint32_t)(i + 1);
+            if(candidate == 0 || i - (candidate - 1) > MAX_OFFSET || read32(source + candidate - 1) != sequence)
+            {
+                i++;
+                continue;
+            }
+            candidate--;
+            size_t length = MIN_MATCH;
+            while(i + length < size - LAST_LITERALS && source[candidate + length] == source[i + length])
+                length++;
+            if(!writeSequence(out, outEnd, source + anchor, i - anchor, i - candidate, length))
+                return 0;
+            i += length;
+            anchor = i;
+        }
+        if(!writeSequence(out, outEnd, source + anchor, size - anchor, 0, 0))
+            return 0;
+        return out - destination;
+    }
+
+    // size is the exact decompressed size, stored next to the block
+    static bool decompress(const char* source, size_t sourceSize, char* destination, size_t size)
+    {
+        const unsigned char* in = reinterpret_cast<const unsigned char*>(source);
+        const unsigned char* inEnd = in + sourceSize;
+        char* out = destination;
+        char* outEnd = destination + size;
+        while(in < inEnd)
+        {
+            unsigned int token = *in++;
+            size_t literals = token >> 4;
+            if(literals == 15 && !readLength(in, inEnd, literals))
+                return false;
+            if((size_t)(inEnd - in) < literals || (size_t)(outEnd - out) < literals)
+                return false;
+            std::memcpy(out, in, literals);
+            in += literals;
+            out += literals;
+            // the last sequence has no match
+            if(in == inEnd)
+                break;
+            if(inEnd - in < 2)
+                return false;
+            size_t offset = in[0] | (in[1] << 8);
+            in += 2;
+            if(offset == 0 || offset > (size_t)(out - destination))
+                return false;
+            size_t length = token & 15;
+            if(length == 15 && !readLength(in, inEnd, length))
+                return false;
+            length += MIN_MATCH;
+            if((size_t)(outEnd - out) < length)
+                return false;
+            // matches may overlap what they produce, copy forwards byte by byte
+            const char* match = out - offset;
+            for(size_t k = 0; k < length; k++)
+                out[k] = match[k];
+            out += length;
+        }
+        return out == outEnd;
+    }
+private:
+    static const unsigned int HASH_BITS = 16;
+    static const size_t MIN_MATCH = 4;
+    static const size_t MATCH_LIMIT = 12;
+    static const size_t LAST_LITERALS = 5;
+    static const size_t MAX_OFFSET = 65535;
+
+    static uint32_t read32(const char* p)
+    {
+        uint32_t value;
+        std::memcpy(&value, p, 4);
+        return value;
+    }
+
+    static uint32_t hash(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    // lengths of 15 and more continue in bytes of 255 and a final smaller one
+    static bool readLength(const unsigned char*& in, const unsigned char* inEnd, size_t& length)
+    {
+        unsigned int byte;
+        do
+        {
+            if(in == inEnd)
+                return false;
+            byte = *in++;
+            length += byte;
+        } while(byte == 255);
+        return true;
+    }
+
+    static bool writeLength(char*& out, char* outEnd, size_t length)
+    {
+        for(; length >= 255; length -= 255)
+        {
+            if(out == outEnd)
+                return false;
+            *out++ = (char)255;
+        }
+        if(out == outEnd)
+            return false;
+        *out++ = (char)length;
+        return true;
+    }
+
+    // matchLength 0 writes the final literals only sequence
+    static bool writeSequence(char*& out, char* outEnd, const char* literals, size_t literalCount, size_t offset,
+                              size_t matchLength)
+    {
+        if(out == outEnd)
+            return false;
+        char* token = out++;
+        *token = (char)((literalCount >= 15 ? 15 : literalCount) << 4);
+        if(literalCount >= 15 && !writeLength(out, outEnd, literalCount - 15))
+            return false;
+        if((size_t)(outEnd - out) < literalCount)
+            return false;
+        std::memcpy(out, literals, literalCount);
+        out += literalCount;
+        if(matchLength == 0)
+            return true;
+        if(outEnd - out < 2)
+            return false;
+        *out++ = (char)(offset & 0xff);
+        *out++ = (char)(offset >> 8);
+        size_t length = matchLength - MIN_MATCH;
+        *token |= (char)(length >= 15 ? 15 : length);
+        return length < 15 || writeLength(out, outEnd, length - 15);
+    }
+};
+
+#endif //PROJECT_BASE_LZ4_H
@@ -0,0 +1,73 @@
+#ifndef PROJECT_BASE_MAPPEDFILE_H
+#define PROJECT_BASE_MAPPEDFILE_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+
+// Read only view of a whole file. Pages come in as they are touched, so parsers can work on the
+// bytes directly without copying them into a buffer first. Not copyable, unmapped on destruction.
+class MappedFile
+{
+public:
+    MappedFile(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            std::cout << "could not open " << path << std::endl;
+            return;
+        }
+        struct stat info;
+        if(fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            void* view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(view != MAP_FAILED)
+            {
+                bytes = static_cast<const char*>(view);
+                length = info.st_size;
+                // parsers walk the file front to back
+                madvise(view, length, MADV_SEQUENTIAL);
+            }
+            else
+                std::cout << "could not map " << path << std::endl;
+        }
+        close(fd);
+    }
+    ~MappedFile()
+    {
+        if(bytes)
+            munmap(const_cast<char*>(bytes), length);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // false for missing, unreadable and empty files
+    bool isOpen() const
+    {
+        return bytes != nullptr;
+    }
+    const char* data() const
+    {
+        return bytes;
+    }
+    size_t size() const
+    {
+        return length;
+    }
+    // asks the kernel to read the whole file in now, one sequential read instead of faults on first touch
+    void prefetch() const
+    {
+        if(bytes)
+            madvise(const_cast<char*>(bytes), length, MADV_WILLNEED);
+    }
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+};
+
+#endif //PROJECT_BASE_MAPPEDFILE_H
@@ -5,9 +5,17 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <MojeKlase/Shader.h>
+#include <MojeKlase/RenderState.h>
+#include <MojeKlase/GpuMemory.h>
+#include <MojeKlase/TextureAlpha.h>
+#include <MojeKlase/MeshSimplifier.h>
+#include <MojeKlase/TextureStreaming.h>
+#include <MojeKlase/AllocationTracker.h>
 
 #include <iostream>
 #include <vector>
+#include <string>
+#include <atomic>
 
 struct Vertex
 {
@@ -15,6 +23,7 @@ struct Vertex
     glm::vec3 Normal;
     glm::vec2 TexCoords;
     glm::vec3 Tangent;
+    glm::vec2 LightmapCoords;
 };
 
 struct Texture
@@ -22,6 +31,97 @@ struct Texture
     unsigned int id;
     std::string type;
     std::string path;
+    AlphaMode alpha = ALPHA_OPAQUE;     // only for opacity maps, known once TextureStreamer has decoded the map
+};
+
+// which maps a material provides, used to pick the shader permutation that renders it
+enum MaterialFeature
+{
+    MATERIAL_DIFFUSE_MAP  = 1 << 0,
+    MATERIAL_SPECULAR_MAP = 1 << 1,
+    MATERIAL_NORMAL_MAP   = 1 << 2,
+    MATERIAL_HEIGHT_MAP   = 1 << 3,
+    MATERIAL_OPACITY_MAP  = 1 << 4,
+    MATERIAL_ALPHA_CUTOUT = 1 << 5,     // opacity map is binary, alpha test instead of blending
+    MATERIAL_WEIGHTED_OIT = 1 << 6,     // translucent, writes the WeightedOIT targets instead of a color
+    MATERIAL_INSTANCED    = 1 << 7,     // transform and tint per instance from an InstanceBuffer, not a material property
+    MATERIAL_FEATURE_COUNT = 8
+};
+
+// one level of detail: a range of the mesh's element buffer, all levels share the vertex buffer
+struct MeshLod
+{
+    unsigned int indexOffset;
+    unsigned int indexCount;
+    float error;        // object space deviation from level 0
+};
+
+// levels are halved in triangle count until they stop shrinking or get this small
+const unsigned int LOD_MAX_LEVELS = 5;
+const unsigned int LOD_MIN_TRIANGLES = 64;
+
+// MTL colors used in place of the maps a material does not have
+struct MaterialConstants
+{
+    glm::vec3 diffuseColor = glm::vec3(0.8f);
+    glm::vec3 specularColor = glm::vec3(0.5f);
+};
+
+// MaterialSlot of a Texture::type, MATERIAL_SLOT_COUNT for types no shader samples
+inline unsigned int materialSlot(const std::string& type)
+{
+    static const char* const types[MATERIAL_SLOT_COUNT] = {
+            "texture_diffuse", "texture_specular", "texture_normal", "texture_height", "texture_opacity"
+    };
+    for(unsigned int i = 0; i < MATERIAL_SLOT_COUNT; i++)
+        if(type == types[i])
+            return i;
+    return MATERIAL_SLOT_COUNT;
+}
+
+// A mesh's maps and colors resolved once, when its textures are set: every map has its texture name and fixed
+// unit, so binding is a bindTexture per map plus the colors, which the shader skips when it already holds them.
+// Only the first map of each type is used, the shaders have one sampler per type.
+class Material
+{
+public:
+    Material() {}
+    Material(const std::vector<Texture>& textures, const MaterialConstants& constants) : constants(constants)
+    {
+        static std::atomic<unsigned int> nextId(1);
+        id = nextId++;
+        bool used[MATERIAL_SLOT_COUNT] = {};
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            unsigned int slot = materialSlot(textures[i].type);
+            if(slot == MATERIAL_SLOT_COUNT || used[slot])
+                continue;
+            used[slot] = true;
+            Binding binding = { MATERIAL_SLOT_DIFFUSE + slot, textures[i].id };
+            bindings[count++] = binding;
+        }
+    }
+
+    // the shader must be in use
+    void bind(Shader* shader) const
+    {
+        RenderState& state = RenderState::instance();
+        for(unsigned int i = 0; i < count; i++)
+            state.bindTexture(bindings[i].unit, GL_TEXTURE_2D, bindings[i].texture);
+        // set regardless of the maps, the shader may be a fallback permutation without them
+        shader->setMaterialColors(id, constants.diffuseColor, constants.specularColor);
+    }
+private:
+    struct Binding
+    {
+        unsigned int unit;
+        unsigned int texture;
+    };
+
+    Binding bindings[MATERIAL_SLOT_COUNT];
+    unsigned int count = 0;
+    unsigned int id = 0;
+    MaterialConstants constants;
 };
 
 class Mesh
@@ -30,49 +130,237 @@ public:
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
     std::vector<Texture> textures;
+    MaterialConstants constants;
+    unsigned int materialFeatures;
+    AlphaMode alphaMode;
+    // identifies the bound texture set, draws with equal keys share texture bindings
+    unsigned int materialKey;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    // average UV units per object space unit, sqrt of UV area over surface area
+    float uvDensity = 0.0f;
 
-    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+    // uploadNow false only does the CPU work and leaves the GL objects to upload(), so meshes can be
+    // built on job threads; the render thread uploads them
+    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures,
+         const MaterialConstants& constants = MaterialConstants(), bool uploadNow = true)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        // the vectors are the caller's copies, taken over instead of copied a second time
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->textures = std::move(textures);
+        this->constants = constants;
+        updateMaterial();
 
+        for(unsigned int i = 0; i < this->vertices.size(); i++)
+        {
+            boundsMin = i == 0 ? this->vertices[i].Position : glm::min(boundsMin, this->vertices[i].Position);
+            boundsMax = i == 0 ? this->vertices[i].Position : glm::max(boundsMax, this->vertices[i].Position);
+        }
+
+        float uvArea = 0.0f, surfaceArea = 0.0f;
+        for(unsigned int i = 0; i + 2 < this->indices.size(); i += 3)
+        {
+            const Vertex& a = this->vertices[this->indices[i]];
+            const Vertex& b = this->vertices[this->indices[i + 1]];
+            const Vertex& c = this->vertices[this->indices[i + 2]];
+            glm::vec2 du = b.TexCoords - a.TexCoords, dv = c.TexCoords - a.TexCoords;
+            uvArea += std::fabs(du.x * dv.y - du.y * dv.x) * 0.5f;
+            surfaceArea += glm::length(glm::cross(b.Position - a.Position, c.Position - a.Position)) * 0.5f;
+        }
+        if(surfaceArea > 0.0f)
+            uvDensity = std::sqrt(uvArea / surfaceArea);
+
+        buildLods();
+        if(uploadNow)
+            setupMesh();
+    }
+
+    void upload()
+    {
         setupMesh();
     }
 
-    void Draw(Shader* shader)
+    // for meshes built before their textures existed
+    void setTextures(const std::vector<Texture>& textures)
+    {
+        this->textures = textures;
+        updateMaterial();
+    }
+
+    void Draw(Shader* shader, unsigned int lod = 0)
     {
-        unsigned int diffuseNr = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr   = 1;
-        unsigned int heightNr   = 1;
-        unsigned int opacityNr = 1;
-        for(unsigned int i = 0; i<textures.size(); i++)
+        material.bind(shader);
+        // no unbind afterwards, the next mesh binds its own VAO and consecutive draws of this one skip the bind
+        RenderState::instance().bindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, lods[lod].indexCount, GL_UNSIGNED_INT,
+                       (void*)(lods[lod].indexOffset * sizeof(unsigned int)));
+    }
+
+    // the VAO needs an InstanceBuffer attached
+    void DrawInstanced(Shader* shader, unsigned int count)
+    {
+        material.bind(shader);
+        RenderState::instance().bindVertexArray(VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, count);
+    }
+
+    // tells TextureStreamer how much detail this draw can show, unitsPerPixel is object space size of a pixel;
+    // the first call is what starts loading lazy textures
+    void requestTextureDetail(float unitsPerPixel)
+    {
+        TextureStreamer& streamer = TextureStreamer::instance();
+        for(unsigned int i = 0; i < textures.size(); i++)
+            streamer.request(textures[i].id, uvDensity * unitsPerPixel);
+        refreshMaterial();
+    }
+
+    // for draws that have no distance to derive the detail from
+    void loadTextures()
+    {
+        TextureStreamer& streamer = TextureStreamer::instance();
+        for(unsigned int i = 0; i < textures.size(); i++)
+            streamer.load(textures[i].id);
+        refreshMaterial();
+    }
+
+    // opacity maps are classified when they are decoded, until then the mesh renders as opaque;
+    // picks the pass and permutation up once that happens
+    void refreshMaterial()
+    {
+        TextureStreamer& streamer = TextureStreamer::instance();
+        if(streamer.getLoadCount() == loadCount)
+            return;
+        loadCount = streamer.getLoadCount();
+        AllocationScope streaming(SCOPE_STREAMING);
+        for(unsigned int i = 0; i < textures.size(); i++)
+            if(textures[i].type == "texture_opacity")
+                streamer.getAlpha(textures[i].id, textures[i].alpha);
+        updateMaterial();
+    }
+
+    unsigned int getVAO() const
+    {
+        return VAO;
+    }
+
+    const std::vector<MeshLod>& getLods() const
+    {
+        return lods;
+    }
+
+    // coarsest level whose object space error stays within maxError
+    unsigned int selectLod(float maxError) const
+    {
+        unsigned int lod = 0;
+        while(lod + 1 < lods.size() && lods[lod + 1].error <= maxError)
+            lod++;
+        return lod;
+    }
+
+    // re-uploads vertices and indices after they were rewritten on the CPU side (e.g. lightmap unwrapping),
+    // the levels of detail are rebuilt from the new indices
+    void updateBuffers()
+    {
+        buildLods();
+        RenderState& state = RenderState::instance();
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        GpuMemory::instance().bufferData(GL_ARRAY_BUFFER, VBO, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW,
+                                         GPU_VERTEX_BUFFER);
+        state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        uploadIndices();
+    }
+
+    // meshes are copied around by value, so the owner frees the GL objects explicitly
+    void release()
+    {
+        RenderState::instance().vertexArrayDeleted(VAO);
+        glDeleteVertexArrays(1, &VAO);
+        GpuMemory::instance().deleteBuffer(VBO);
+        GpuMemory::instance().deleteBuffer(EBO);
+    }
+private:
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    unsigned int loadCount = 0;     // TextureStreamer's when the material was last updated
+    Material material;
+    std::vector<MeshLod> lods;
+    // indices of levels 1 and up, stored in the element buffer right after indices
+    std::vector<unsigned int> lodIndices;
+
+    void buildLods()
+    {
+        lods.clear();
+        lodIndices.clear();
+        MeshLod full = { 0, (unsigned int)indices.size(), 0.0f };
+        lods.push_back(full);
+        if(indices.size() / 3 < LOD_MIN_TRIANGLES * 2)
+            return;
+
+        std::vector<glm::vec3> positions(vertices.size());
+        for(unsigned int i = 0; i < vertices.size(); i++)
+            positions[i] = vertices[i].Position;
+        MeshSimplifier simplifier(positions, indices);
+        unsigned int target = indices.size();
+        while(lods.size() < LOD_MAX_LEVELS)
+        {
+            target = target / 6 * 3;
+            if(target / 3 < LOD_MIN_TRIANGLES || !simplifier.simplify(target))
+                break;
+            const std::vector<unsigned int>& simplified = simplifier.getIndices();
+            // locked seams and borders can stall the reduction, a level that barely shrinks is not worth keeping
+            if(simplified.size() > lods.back().indexCount * 3 / 4)
+                break;
+            MeshLod lod = { (unsigned int)(indices.size() + lodIndices.size()), (unsigned int)simplified.size(),
+                            simplifier.getError() };
+            lods.push_back(lod);
+            lodIndices.insert(lodIndices.end(), simplified.begin(), simplified.end());
+            target = simplified.size();
+        }
+    }
+
+    // level 0 followed by the coarser levels, the element buffer must be bound
+    void uploadIndices()
+    {
+        unsigned int total = indices.size() + lodIndices.size();
+        GpuMemory::instance().bufferData(GL_ELEMENT_ARRAY_BUFFER, EBO, total * sizeof(unsigned int), NULL, GL_STATIC_DRAW,
+                                         GPU_INDEX_BUFFER);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices.size() * sizeof(unsigned int), &indices[0]);
+        if(!lodIndices.empty())
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+                            lodIndices.size() * sizeof(unsigned int), &lodIndices[0]);
+    }
+
+    void updateMaterial()
+    {
+        materialFeatures = 0;
+        alphaMode = ALPHA_OPAQUE;
+        for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i);
-            std::string number;
-            std::string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++);
-            else if(name == "texture_normal")
-                number = std::to_string(normalNr++);
-            else if(name == "texture_height")
-                number = std::to_string(heightNr++);
-            else if(name == "texture_opacity")
-                number = std::to_string(opacityNr++);
-
-            shader->setInt(("material." + name + number).c_str(), i);
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            const std::string& type = textures[i].type;
+            if(type == "texture_diffuse")
+                materialFeatures |= MATERIAL_DIFFUSE_MAP;
+            else if(type == "texture_specular")
+                materialFeatures |= MATERIAL_SPECULAR_MAP;
+            else if(type == "texture_normal")
+                materialFeatures |= MATERIAL_NORMAL_MAP;
+            else if(type == "texture_height")
+                materialFeatures |= MATERIAL_HEIGHT_MAP;
+            else if(type == "texture_opacity")
+                alphaMode = std::max(alphaMode, textures[i].alpha);
         }
+        // a fully opaque map is not sampled at all
+        if(alphaMode == ALPHA_CUTOUT)
+            materialFeatures |= MATERIAL_OPACITY_MAP | MATERIAL_ALPHA_CUTOUT;
+        else if(alphaMode == ALPHA_BLENDED)
+            materialFeatures |= MATERIAL_OPACITY_MAP | MATERIAL_WEIGHTED_OIT;
 
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        materialKey = 2166136261u ^ materialFeatures;
+        for(unsigned int i = 0; i < textures.size(); i++)
+            materialKey = (materialKey ^ textures[i].id) * 16777619u;
+        material = Material(textures, constants);
     }
-private:
-    unsigned int VAO, VBO, EBO;
+
     void setupMesh()
     {
         //generisanje bafera
@@ -81,14 +369,16 @@ private:
         glGenBuffers(1, &EBO);
 
         //slanje vertexa
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        RenderState& state = RenderState::instance();
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, VBO);
 
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        GpuMemory::instance().bufferData(GL_ARRAY_BUFFER, VBO, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW,
+                                         GPU_VERTEX_BUFFER);
 
         //slanje indicesa
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        uploadIndices();
 
         //vertex atributi
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
@@ -103,7 +393,10 @@ private:
         glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
         glEnableVertexAttribArray(3);
 
-        glBindVertexArray(0);
+        glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, LightmapCoords));
+        glEnableVertexAttribArray(4);
+
+        state.bindVertexArray(0);
     }
 };
 
@@ -0,0 +1,305 @@
+#ifndef PROJECT_BASE_MESHSIMPLIFIER_H
+#define PROJECT_BASE_MESHSIMPLIFIER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+// Quadric error metric edge collapse (Garland and Heckbert). A vertex only ever collapses onto one of
+// its neighbours, never onto a new position, so every level indexes the original vertex buffer.
+// Vertices with equal positions are welded for the topology; where they differ in other attributes
+// (UV or lightmap chart seams) they are locked, as are open borders, so levels do not crack or smear.
+// Quadrics accumulate across calls, so successive simplify() calls build a chain of coarser levels.
+class MeshSimplifier
+{
+public:
+    MeshSimplifier(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices)
+    {
+        this->positions = positions;
+        this->indices = indices;
+        remap.resize(positions.size());
+        for(unsigned int i = 0; i < positions.size(); i++)
+            remap[i] = i;
+
+        // weld by position; a welded vertex made of several originals is a seam
+        std::unordered_map<uint64_t, unsigned int> welded;
+        canonical.resize(positions.size());
+        std::vector<unsigned int> originals(positions.size(), 0);
+        for(unsigned int i = 0; i < positions.size(); i++)
+        {
+            uint64_t key = positionKey(positions[i]);
+            std::unordered_map<uint64_t, unsigned int>::iterator it = welded.find(key);
+            while(it != welded.end() && positions[it->second] != positions[i])
+                it = welded.find(++key);
+            if(it == welded.end())
+            {
+                welded[key] = i;
+                canonical[i] = i;
+            }
+            else
+                canonical[i] = it->second;
+            originals[canonical[i]]++;
+        }
+
+        quadrics.assign(positions.size(), Quadric());
+        locked.assign(positions.size(), 0);
+        std::unordered_map<uint64_t, unsigned int> edgeUses;
+        for(unsigned int t = 0; t + 2 < indices.size(); t += 3)
+        {
+            unsigned int v[3] = { canonical[indices[t]], canonical[indices[t + 1]], canonical[indices[t + 2]] };
+            glm::dvec3 p0(positions[v[0]]), p1(positions[v[1]]), p2(positions[v[2]]);
+            glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+            double length = glm::length(normal);
+            if(length > 0.0)
+            {
+                normal /= length;
+                Quadric plane(normal, -glm::dot(normal, p0));
+                for(unsigned int j = 0; j < 3; j++)
+                    quadrics[v[j]].add(plane);
+            }
+            for(unsigned int j = 0; j < 3; j++)
+                edgeUses[edgeKey(v[j], v[(j + 1) % 3])]++;
+        }
+        for(unsigned int i = 0; i < positions.size(); i++)
+            if(originals[i] > 1)
+                locked[i] = 1;
+        for(std::unordered_map<uint64_t, unsigned int>::iterator it = edgeUses.begin(); it != edgeUses.end(); ++it)
+        {
+            if(it->second != 1)
+                continue;
+            locked[(unsigned int)(it->first >> 32)] = 1;
+            locked[(unsigned int)(it->first & 0xffffffffu)] = 1;
+        }
+    }
+
+    // collapses edges, cheapest first, until at most targetIndexCount indices remain or nothing more can go;
+    // returns false if not a single edge could be collapsed
+    bool simplify(unsigned int targetIndexCount)
+    {
+        bool collapsedAny = false;
+        while(indices.size() > targetIndexCount)
+        {
+            unsigned int collapsed = collapsePass((indices.size() - targetIndexCount) / 3);
+            if(collapsed == 0)
+                break;
+            collapsedAny = true;
+        }
+        return collapsedAny;
+    }
+
+    const std::vector<unsigned int>& getIndices() const
+    {
+        return indices;
+    }
+
+    // bound on how far, in object space, the current level strays from the original surface
+    float getError() const
+    {
+        return error;
+    }
+private:
+    // symmetric 4x4 matrix, upper triangle
+    struct Quadric
+    {
+        double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+        double a11 = 0, a12 = 0, a13 = 0;
+        double a22 = 0, a23 = 0;
+        double a33 = 0;
+
+        Quadric() {}
+        Quadric(const glm::dvec3& n, double d)
+        {
+            a00 = n.x * n.x; a01 = n.x * n.y; a02 = n.x * n.z; a03 = n.x * d;
+            a11 = n.y * n.y; a12 = n.y * n.z; a13 = n.y * d;
+            a22 = n.z * n.z; a23 = n.z * d;
+            a33 = d * d;
+        }
+
+        void add(const Quadric& q)
+        {
+            a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+            a11 += q.a11; a12 += q.a12; a13 += q.a13;
+            a22 += q.a22; a23 += q.a23;
+            a33 += q.a33;
+        }
+
+        // sum of squared distances to the accumulated planes
+        double evaluate(const glm::vec3& p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double result = a00 * x * x + 2.0 * a01 * x * y + 2.0 * a02 * x * z + 2.0 * a03 * x
+                            + a11 * y * y + 2.0 * a12 * y * z + 2.0 * a13 * y
+                            + a22 * z * z + 2.0 * a23 * z
+                            + a33;
+            return std::max(result, 0.0);
+        }
+    };
+
+    struct Collapse
+    {
+        unsigned int from;      // original vertex index that disappears
+        unsigned int to;
+        double cost;
+
+        bool operator<(const Collapse& other) const
+        {
+            return cost < other.cost;
+        }
+    };
+
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    std::vector<unsigned int> canonical;
+    std::vector<unsigned int> remap;
+    std::vector<Quadric> quadrics;
+    std::vector<uint8_t> locked;
+    float error = 0.0f;
+
+    static uint64_t positionKey(const glm::vec3& p)
+    {
+        uint32_t bits[3];
+        std::memcpy(bits, &p[0], sizeof(bits));
+        uint64_t hash = 14695981039346656037ull;
+        for(unsigned int i = 0; i < 3; i++)
+            hash = (hash ^ bits[i]) * 1099511628211ull;
+        return hash;
+    }
+
+    static uint64_t edgeKey(unsigned int a, unsigned int b)
+    {
+        if(a > b)
+            std::swap(a, b);
+        return ((uint64_t)a << 32) | b;
+    }
+
+    // one round of independent collapses: no two touch the same neighbourhood, so the flip test
+    // of each one sees final positions; returns how many happened
+    unsigned int collapsePass(unsigned int trianglesToRemove)
+    {
+        std::vector<Collapse> candidates;
+        for(unsigned int t = 0; t + 2 < indices.size(); t += 3)
+        {
+            for(unsigned int j = 0; j < 3; j++)
+            {
+                unsigned int a = indices[t + j];
+                unsigned int b = indices[t + (j + 1) % 3];
+                unsigned int ca = canonical[a], cb = canonical[b];
+                // interior edges show up once in each direction, take them where they run low to high;
+                // edges seen only one way are borders with both ends locked
+                if(ca >= cb)
+                    continue;
+                Quadric q = quadrics[ca];
+                q.add(quadrics[cb]);
+                Collapse collapse;
+                collapse.cost = -1.0;
+                if(!locked[ca])
+                {
+                    collapse.from = a;
+                    collapse.to = b;
+                    collapse.cost = q.evaluate(positions[cb]);
+                }
+                if(!locked[cb])
+                {
+                    double cost = q.evaluate(positions[ca]);
+                    if(collapse.cost < 0.0 || cost < collapse.cost)
+                    {
+                        collapse.from = b;
+                        collapse.to = a;
+                        collapse.cost = cost;
+                    }
+                }
+                if(collapse.cost >= 0.0)
+                    candidates.push_back(collapse);
+            }
+        }
+        if(candidates.empty())
+            return 0;
+        std::sort(candidates.begin(), candidates.end());
+
+        // triangles around every welded vertex
+        std::vector<unsigned int> offsets(positions.size() + 1, 0);
+        for(unsigned int i = 0; i < indices.size(); i++)
+            offsets[canonical[indices[i]] + 1]++;
+        for(unsigned int i = 1; i < offsets.size(); i++)
+            offsets[i] += offsets[i - 1];
+        std::vector<unsigned int> triangles(indices.size());
+        std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for(unsigned int i = 0; i < indices.size(); i++)
+            triangles[fill[canonical[indices[i]]]++] = i / 3;
+
+        std::vector<uint8_t> touched(positions.size(), 0);
+        unsigned int collapsed = 0;
+        unsigned int removed = 0;
+        for(unsigned int c = 0; c < candidates.size() && removed < trianglesToRemove; c++)
+        {
+            const Collapse& collapse = candidates[c];
+            unsigned int from = canonical[collapse.from];
+            unsigned int to = canonical[collapse.to];
+            if(touched[from] || touched[to] || flips(from, to, offsets, triangles))
+                continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[to].add(quadrics[from]);
+            error = std::max(error, (float)std::sqrt(collapse.cost));
+            // the neighbourhood of both ends changed shape, leave it alone until the next pass
+            for(unsigned int i = offsets[from]; i < offsets[from + 1]; i++)
+            {
+                unsigned int t = triangles[i];
+                bool shared = false;
+                for(unsigned int j = 0; j < 3; j++)
+                {
+                    touched[canonical[indices[t * 3 + j]]] = 1;
+                    shared = shared || canonical[indices[t * 3 + j]] == to;
+                }
+                if(shared)
+                    removed++;
+            }
+            touched[to] = 1;
+            collapsed++;
+        }
+
+        // rewrite the index buffer and drop the triangles that became degenerate
+        unsigned int write = 0;
+        for(unsigned int t = 0; t + 2 < indices.size(); t += 3)
+        {
+            unsigned int v0 = remap[indices[t]], v1 = remap[indices[t + 1]], v2 = remap[indices[t + 2]];
+            unsigned int c0 = canonical[v0], c1 = canonical[v1], c2 = canonical[v2];
+            if(c0 == c1 || c1 == c2 || c0 == c2)
+                continue;
+            indices[write++] = v0;
+            indices[write++] = v1;
+            indices[write++] = v2;
+        }
+        indices.resize(write);
+        return collapsed;
+    }
+
+    // whether moving welded vertex from onto to turns any surviving triangle around it over
+    bool flips(unsigned int from, unsigned int to, const std::vector<unsigned int>& offsets,
+               const std::vector<unsigned int>& triangles) const
+    {
+        for(unsigned int i = offsets[from]; i < offsets[from + 1]; i++)
+        {
+            unsigned int t = triangles[i];
+            unsigned int v[3] = { canonical[indices[t * 3]], canonical[indices[t * 3 + 1]], canonical[indices[t * 3 + 2]] };
+            if(v[0] == to || v[1] == to || v[2] == to)
+                continue;
+            glm::vec3 before = glm::cross(positions[v[1]] - positions[v[0]], positions[v[2]] - positions[v[0]]);
+            glm::vec3 p[3];
+            for(unsigned int j = 0; j < 3; j++)
+                p[j] = positions[v[j] == from ? to : v[j]];
+            glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+            // more than ~75 degrees of rotation counts too, that also catches folds into slivers
+            if(glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after))
+                return true;
+        }
+        return false;
+    }
+};
+
+#endif //PROJECT_BASE_MESHSIMPLIFIER_H
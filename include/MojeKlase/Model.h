@@ -4,6 +4,15 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <MojeKlase/Mesh.h>
+#include <MojeKlase/ShaderPermutations.h>
+#include <MojeKlase/RenderQueue.h>
+#include <MojeKlase/InstanceBuffer.h>
+#include <MojeKlase/SceneGraph.h>
+#include <MojeKlase/TextureStreaming.h>
+#include <MojeKlase/ObjLoader.h>
+#include <MojeKlase/VirtualFileSystem.h>
+#include <MojeKlase/AssimpIO.h>
+#include <MojeKlase/JobSystem.h>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -12,29 +21,502 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
 
-unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma = false);
+// stbi_load through the VirtualFileSystem, decodes straight from the pack; free with stbi_image_free
+unsigned char* loadImage(const std::string& path, int* width, int* height, int* channels);
+
+// creates the texture with a flat stand in for its type, TextureStreamer decodes the file when a draw first needs it
+unsigned int TextureFromFile(const char* path, const std::string& directory, const std::string& typeName, bool gamma = false);
+
+// one node of the file's hierarchy, parents come before their children
+struct ModelNode
+{
+    glm::mat4 transform;
+    unsigned int parent;
+    std::vector<unsigned int> meshes;
+};
+
+// AUTO reads .obj files with ObjLoader and everything else, or an OBJ the fast path rejects, with assimp
+enum ModelLoader
+{
+    LOADER_AUTO,
+    LOADER_ASSIMP
+};
+
+// a texture a material refers to, created when the model is uploaded
+struct MaterialMap
+{
+    std::string path;
+    std::string type;
+};
+
+// a model placed in a SceneGraph, one scene node per ModelNode
+struct ModelInstance
+{
+    unsigned int root;
+    std::vector<unsigned int> nodes;
+};
+
+class Model;
+
+// Handle of a Model::loadAsync. The file is read and its meshes are built on jobs, then Model::updateLoads()
+// creates their GL objects a slice at a time on the render thread. Deleting the handle once it is ready
+// leaves the model to the caller; deleting it earlier cancels the load.
+class ModelLoad
+{
+public:
+    ~ModelLoad();
+
+    bool isReady() const
+    {
+        return ready;
+    }
+    // 0 to 1, reading the file is the first tenth, building the meshes the next six, uploading the rest
+    float getProgress() const
+    {
+        if(ready)
+            return 1.0f;
+        unsigned int count = meshCount.load(std::memory_order_acquire);
+        if(count == 0)
+            return 0.0f;
+        return 0.1f + 0.6f * built.load(std::memory_order_relaxed) / count + 0.3f * uploaded / count;
+    }
+    // nullptr until ready
+    Model* getModel() const
+    {
+        return ready ? model : nullptr;
+    }
+    const std::string& getPath() const
+    {
+        return path;
+    }
+private:
+    friend class Model;
+    std::string path;
+    Model* model = nullptr;
+    JobCounter parsing;
+    std::atomic<unsigned int> meshCount;
+    std::atomic<unsigned int> built;
+    unsigned int uploaded = 0;
+    bool ready = false;
+
+    ModelLoad() : meshCount(0), built(0) {}
+};
 
 class Model
 {
 public:
-    Model(const char* path)
+    // uploadNow false only reads the file and builds the meshes on the CPU, which is safe on any thread;
+    // upload() then creates the textures and buffers on the render thread
+    Model(const char* path, ModelLoader loader = LOADER_AUTO, bool uploadNow = true)
+    {
+        loadModel(path, loader);
+        if(uploadNow)
+            upload();
+    }
+    void upload()
+    {
+        uploadUntil(std::chrono::steady_clock::time_point::max());
+    }
+    // upload() a mesh at a time until deadline, always at least one; true once every mesh is done
+    bool uploadUntil(std::chrono::steady_clock::time_point deadline)
+    {
+        // everything the meshes and their textures allocate is charged to the file
+        GpuMemory::Owner owner(path);
+        while(uploadedMeshes < meshes.size())
+        {
+            unsigned int i = uploadedMeshes++;
+            std::vector<Texture> textures;
+            for(unsigned int m = 0; m < meshMaps[i].size(); m++)
+                textures.push_back(loadTexture(meshMaps[i][m].path, meshMaps[i][m].type));
+            meshes[i].setTextures(textures);
+            meshes[i].upload();
+            if(std::chrono::steady_clock::now() >= deadline)
+                break;
+        }
+        if(uploadedMeshes < meshes.size())
+            return false;
+        meshMaps.clear();
+        return true;
+    }
+
+    // starts loading without blocking, see ModelLoad; the file is parsed on a job
+    static ModelLoad* loadAsync(const std::string& path, ModelLoader loader = LOADER_AUTO)
     {
-        loadModel(path);
+        ModelLoad* load = new ModelLoad();
+        load->path = path;
+        pendingLoads().push_back(load);
+        // background, so a frame waiting on its own jobs never ends up parsing a whole file
+        JobSystem::instance().run([load, loader]() {
+            load->model = new Model(load->path, loader, load);
+        }, &load->parsing, true);
+        return load;
+    }
+    // render thread, once a frame: uploads parsed async loads for about budgetMilliseconds, oldest first
+    static void updateLoads(double budgetMilliseconds)
+    {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+                + std::chrono::microseconds((long long)(budgetMilliseconds * 1000.0));
+        std::vector<ModelLoad*>& loads = pendingLoads();
+        for(unsigned int i = 0; i < loads.size(); )
+        {
+            ModelLoad* load = loads[i];
+            if(!load->parsing.done())
+            {
+                i++;
+                continue;
+            }
+            bool done = load->model->uploadUntil(deadline);
+            load->uploaded = load->model->uploadedMeshes;
+            if(!done)
+                return;
+            load->ready = true;
+            loads.erase(loads.begin() + i);
+            if(std::chrono::steady_clock::now() >= deadline)
+                return;
+        }
+    }
+    ~Model()
+    {
+        delete instances;
+        for(unsigned int i = 0; i<meshes.size(); i++)
+            meshes[i].release();
+        for(unsigned int i = 0; i<textures_loaded.size(); i++)
+        {
+            TextureStreamer::instance().remove(textures_loaded[i].id);
+            GpuMemory::instance().deleteTexture(textures_loaded[i].id);
+        }
     }
     void Draw(Shader* shader)
     {
         for(unsigned int i = 0; i<meshes.size(); i++)
             meshes[i].Draw(shader);
     }
+    // draws every mesh with the cheapest permutation that covers its material
+    void Draw(ShaderPermutations* permutations)
+    {
+        Shader* current = nullptr;
+        for(unsigned int i = 0; i<meshes.size(); i++)
+        {
+            Shader* shader = permutations->get(meshes[i].materialFeatures);
+            if(shader != current)
+            {
+                shader->use();
+                current = shader;
+            }
+            meshes[i].Draw(shader);
+        }
+    }
+    // adds every mesh to the queue instead of drawing it, in the pass its opacity map was classified for
+    void Queue(RenderQueue& queue, ShaderPermutations* permutations, const glm::mat4& model)
+    {
+        static const RenderPass passes[] = { PASS_OPAQUE, PASS_CUTOUT, PASS_BLENDED };
+        unsigned int transform = queue.pushTransform(model);
+        for(unsigned int i = 0; i<meshes.size(); i++)
+        {
+            RenderPass pass = passes[meshes[i].alphaMode];
+            Shader* shader = permutations->get(meshes[i].materialFeatures);
+            // the fallback writes plain color, which the OIT targets cannot take
+            if(pass == PASS_BLENDED && !permutations->has(meshes[i].materialFeatures))
+                continue;
+            if(!queue.isVisible(&meshes[i], transform))
+                continue;
+            queue.push(pass, &meshes[i], shader, transform);
+        }
+    }
+    // one draw per mesh for all copies; uniforms other than the model matrix must already be set
+    // on the INSTANCED variants, meshes are skipped until theirs has compiled
+    void DrawInstanced(ShaderPermutations* permutations, const glm::mat4* transforms, unsigned int count,
+                       const glm::vec4* tints = nullptr)
+    {
+        if(!instances)
+        {
+            instances = new InstanceBuffer();
+            for(unsigned int i = 0; i<meshes.size(); i++)
+                instances->attach(meshes[i].getVAO());
+        }
+        instances->upload(transforms, count, tints);
+        if(count == 0)
+            return;
+
+        Shader* current = nullptr;
+        for(unsigned int i = 0; i<meshes.size(); i++)
+        {
+            meshes[i].loadTextures();
+            unsigned int features = meshes[i].materialFeatures | MATERIAL_INSTANCED;
+            Shader* shader = permutations->get(features);
+            if(!permutations->has(features))
+                continue;
+            if(shader != current)
+            {
+                shader->use();
+                current = shader;
+            }
+            meshes[i].DrawInstanced(shader, count);
+        }
+    }
+    // adds the node hierarchy under parent, the root node gets the given local transform
+    ModelInstance instantiate(SceneGraph& graph, const glm::mat4& transform,
+                              unsigned int parent = SceneGraph::NO_PARENT) const
+    {
+        ModelInstance instance;
+        instance.root = graph.addNode(transform, parent);
+        for(unsigned int i = 0; i<nodes.size(); i++)
+        {
+            unsigned int nodeParent = nodes[i].parent == SceneGraph::NO_PARENT ? instance.root
+                                                                                : instance.nodes[nodes[i].parent];
+            instance.nodes.push_back(graph.addNode(nodes[i].transform, nodeParent));
+        }
+        return instance;
+    }
+    // like Queue above, but every mesh uses the world matrix of its node; fadeOut is passed on to pushTransform
+    void Queue(RenderQueue& queue, ShaderPermutations* permutations, const SceneGraph& graph,
+               const ModelInstance& instance, float fadeOut = 0.0f)
+    {
+        static const RenderPass passes[] = { PASS_OPAQUE, PASS_CUTOUT, PASS_BLENDED };
+        for(unsigned int n = 0; n<nodes.size(); n++)
+        {
+            if(nodes[n].meshes.empty())
+                continue;
+            unsigned int transform = queue.pushTransform(graph.getWorld(instance.nodes[n]), fadeOut);
+            for(unsigned int m = 0; m<nodes[n].meshes.size(); m++)
+            {
+                Mesh& mesh = meshes[nodes[n].meshes[m]];
+                RenderPass pass = passes[mesh.alphaMode];
+                Shader* shader = permutations->get(mesh.materialFeatures);
+                if(pass == PASS_BLENDED && !permutations->has(mesh.materialFeatures))
+                    continue;
+                // the whole model can be in view while most of its meshes are not, those must not
+                // stream in their textures
+                if(!queue.isVisible(&mesh, transform))
+                    continue;
+                queue.push(pass, &mesh, shader, transform);
+            }
+        }
+    }
+    const std::vector<ModelNode>& getNodes() const
+    {
+        return nodes;
+    }
+    // compiles the permutations this model needs up front
+    void prepare(ShaderPermutations* permutations)
+    {
+        for(unsigned int i = 0; i<meshes.size(); i++)
+            permutations->get(meshes[i].materialFeatures);
+    }
+    // starts decoding every texture in the background without waiting for a draw to ask for it
+    void loadTextures()
+    {
+        for(unsigned int i = 0; i < textures_loaded.size(); i++)
+            TextureStreamer::instance().load(textures_loaded[i].id);
+    }
+    // true once every texture has been decoded or has failed to, so nothing more will come in for it
+    bool texturesLoaded() const
+    {
+        for(unsigned int i = 0; i < textures_loaded.size(); i++)
+            if(!TextureStreamer::instance().isLoaded(textures_loaded[i].id))
+                return false;
+        return true;
+    }
+    // picks up opacity classifications and maps that came in without a draw asking for them
+    void refreshMaterials()
+    {
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].refreshMaterial();
+    }
+    std::vector<Mesh>& getMeshes()
+    {
+        return meshes;
+    }
+    const std::string& getDirectory() const
+    {
+        return directory;
+    }
+    // object space bounds of all meshes
+    const glm::vec3& getBoundsMin() const
+    {
+        return boundsMin;
+    }
+    const glm::vec3& getBoundsMax() const
+    {
+        return boundsMax;
+    }
+    // reads an OBJ with both loaders, without touching GL, and prints where their meshes differ;
+    // indices and texture lists must match exactly, attributes within float parsing noise
+    static bool compareLoaders(const std::string& path)
+    {
+        ObjLoader loader;
+        if(!loader.load(path))
+            return false;
+        Assimp::Importer import;
+        import.SetIOHandler(new VfsIOSystem());
+        const aiScene* scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_CalcTangentSpace);
+        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+        {
+            std::cout << "assimp loading failed " << import.GetErrorString() << std::endl;
+            return false;
+        }
+        std::vector<unsigned int> order;
+        collectMeshes(scene->mRootNode, order);
+        std::vector<ObjMesh>& objMeshes = loader.getMeshes();
+        bool same = order.size() == objMeshes.size();
+        std::cout << "meshes: assimp " << order.size() << ", obj " << objMeshes.size() << std::endl;
+        for(unsigned int i = 0; i < std::min<size_t>(order.size(), objMeshes.size()); i++)
+        {
+            const aiMesh* mesh = scene->mMeshes[order[i]];
+            std::vector<Vertex> vertices;
+            std::vector<unsigned int> indices;
+            readMesh(mesh, vertices, indices);
+            const ObjMesh& objMesh = objMeshes[i];
+            std::cout << "mesh " << i << ": vertices " << vertices.size() << "/" << objMesh.vertices.size()
+                      << ", indices " << indices.size() << "/" << objMesh.indices.size();
+            bool meshSame = vertices.size() == objMesh.vertices.size() && indices == objMesh.indices;
+            float position = 0.0f, normal = 0.0f, texCoord = 0.0f, tangent = 0.0f;
+            for(unsigned int v = 0; meshSame && v < vertices.size(); v++)
+            {
+                position = std::max(position, maxDifference(vertices[v].Position, objMesh.vertices[v].Position));
+                normal = std::max(normal, maxDifference(vertices[v].Normal, objMesh.vertices[v].Normal));
+                texCoord = std::max(texCoord, maxDifference(glm::vec3(vertices[v].TexCoords, 0.0f),
+                                                            glm::vec3(objMesh.vertices[v].TexCoords, 0.0f)));
+                tangent = std::max(tangent, maxDifference(vertices[v].Tangent, objMesh.vertices[v].Tangent));
+            }
+            meshSame = meshSame && position < 1e-5f && normal < 1e-5f && texCoord < 1e-5f && tangent < 1e-3f;
+            std::cout << ", max difference position " << position << " normal " << normal << " uv " << texCoord
+                      << " tangent " << tangent;
+
+            // texture lists in the order processMesh builds them
+            static const aiTextureType types[OBJ_MAP_COUNT] = {
+                    aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_HEIGHT, aiTextureType_DISPLACEMENT,
+                    aiTextureType_OPACITY
+            };
+            const aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+            const ObjMaterial& objMaterial = loader.getMaterials()[objMesh.material];
+            for(unsigned int m = 0; m < OBJ_MAP_COUNT; m++)
+            {
+                std::string assimpPath;
+                if(material->GetTextureCount(types[m]) > 0)
+                {
+                    aiString str;
+                    material->GetTexture(types[m], 0, &str);
+                    assimpPath = str.C_Str();
+                }
+                if(assimpPath != objMaterial.maps[m])
+                {
+                    std::cout << ", " << OBJ_MAP_TYPES[m] << " \"" << assimpPath << "\" vs \"" << objMaterial.maps[m] << "\"";
+                    meshSame = false;
+                }
+            }
+            aiColor3D diffuse(0.8f, 0.8f, 0.8f), specular(0.5f, 0.5f, 0.5f);
+            material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuse);
+            material->Get(AI_MATKEY_COLOR_SPECULAR, specular);
+            float color = std::max(maxDifference(glm::vec3(diffuse.r, diffuse.g, diffuse.b), objMaterial.constants.diffuseColor),
+                                   maxDifference(glm::vec3(specular.r, specular.g, specular.b), objMaterial.constants.specularColor));
+            if(color > 1e-5f)
+            {
+                std::cout << ", colors differ by " << color;
+                meshSame = false;
+            }
+            std::cout << (meshSame ? ", same" : ", DIFFERENT") << std::endl;
+            same = same && meshSame;
+        }
+        return same;
+    }
+    // builds the meshes of an OBJ, without GL, with 1 to hardware_concurrency workers and prints how the time scales
+    static void measureJobScaling(const std::string& path)
+    {
+        ObjLoader loader;
+        if(!loader.load(path))
+            return;
+        std::vector<ObjMesh>& objMeshes = loader.getMeshes();
+        JobSystem& jobs = JobSystem::instance();
+        unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+        double single = 0.0;
+        for(unsigned int workers = 1; workers <= cores; workers++)
+        {
+            jobs.setWorkerCount(workers);
+            // glfw is not initialized for this, so no glfwGetTime
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::vector<Mesh*> built(objMeshes.size());
+            JobCounter counter;
+            for(unsigned int i = 0; i < objMeshes.size(); i++)
+            {
+                jobs.run([&loader, &objMeshes, &built, i]() {
+                    const ObjMaterial& material = loader.getMaterials()[objMeshes[i].material];
+                    built[i] = new Mesh(objMeshes[i].vertices, objMeshes[i].indices, std::vector<Texture>(), material.constants, false);
+                }, &counter);
+            }
+            jobs.wait(counter);
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            for(unsigned int i = 0; i < built.size(); i++)
+                delete built[i];
+            if(workers == 1)
+                single = milliseconds;
+            std::cout << workers << " workers: " << milliseconds << " ms, speedup " << single / milliseconds << std::endl;
+        }
+    }
 private:
     std::vector<Mesh> meshes;
+    std::vector<ModelNode> nodes;
+    InstanceBuffer* instances = nullptr;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
     std::vector<Texture> textures_loaded;
     std::string directory;
+    std::string path;
+    // per mesh, until upload()
+    std::vector<std::vector<MaterialMap> > meshMaps;
+    unsigned int uploadedMeshes = 0;
+    // set while loadAsync's job builds the model
+    ModelLoad* progress = nullptr;
+
+    friend class ModelLoad;
+
+    Model(const std::string& path, ModelLoader loader, ModelLoad* progress)
+    {
+        this->progress = progress;
+        loadModel(path, loader);
+        if(progress)
+            progress->meshCount.store(std::max<size_t>(meshes.size(), 1), std::memory_order_release);
+        this->progress = nullptr;
+    }
+
+    static std::vector<ModelLoad*>& pendingLoads()
+    {
+        static std::vector<ModelLoad*> loads;
+        return loads;
+    }
+
+    // progress of the mesh jobs for loadAsync; count is known once the file is parsed
+    void meshesParsed(unsigned int count)
+    {
+        if(progress)
+            progress->meshCount.store(std::max(count, 1u), std::memory_order_release);
+    }
+    void meshBuilt()
+    {
+        if(progress)
+            progress->built.fetch_add(1, std::memory_order_relaxed);
+    }
+    // the mesh jobs of loadAsync are background jobs like its parse job, startup loads stay normal ones
+    bool backgroundBuild() const
+    {
+        return progress != nullptr;
+    }
 
-    void loadModel(std::string path)
+    void loadModel(std::string path, ModelLoader loader)
     {
+        this->path = path;
+        if(loader == LOADER_AUTO && isObj(path))
+        {
+            if(loadObj(path))
+                return;
+            std::cout << "falling back to assimp for " << path << std::endl;
+        }
         Assimp::Importer import;
+        import.SetIOHandler(new VfsIOSystem());
         const aiScene* scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_CalcTangentSpace);
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
         {
@@ -44,31 +526,180 @@ private:
         directory = path.substr(0, path.find_last_of('/'));
         std::cout << "uci" << std::endl;
 
-        processNode(scene->mRootNode, scene);
+        std::vector<PendingMesh> pending;
+        processNode(scene->mRootNode, scene, SceneGraph::NO_PARENT, pending);
+        // one job per aiMesh for the geometry, the GL objects are created by upload()
+        std::vector<Mesh*> built(pending.size());
+        JobCounter counter;
+        meshesParsed(pending.size());
+        for(unsigned int i = 0; i < pending.size(); i++)
+        {
+            JobSystem::instance().run([this, &pending, &built, i]() {
+                std::vector<Vertex> vertices;
+                std::vector<unsigned int> indices;
+                readMesh(pending[i].mesh, vertices, indices);
+                built[i] = new Mesh(std::move(vertices), std::move(indices), std::vector<Texture>(), pending[i].constants, false);
+                meshBuilt();
+            }, &counter, backgroundBuild());
+        }
+        JobSystem::instance().wait(counter);
+        for(unsigned int i = 0; i < built.size(); i++)
+        {
+            meshes.push_back(std::move(*built[i]));
+            meshMaps.push_back(pending[i].maps);
+            delete built[i];
+        }
+        calculateBounds();
     }
 
-    void processNode(aiNode* node, const aiScene* scene)
+    // what processNode collects for a mesh before its geometry is read
+    struct PendingMesh
+    {
+        const aiMesh* mesh;
+        std::vector<MaterialMap> maps;
+        MaterialConstants constants;
+    };
+
+    static bool isObj(const std::string& path)
+    {
+        if(path.size() < 4)
+            return false;
+        std::string extension = path.substr(path.size() - 4);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        return extension == ".obj";
+    }
+
+    // one child of an identity root per OBJ object, as assimp builds it
+    bool loadObj(const std::string& path)
+    {
+        ObjLoader loader;
+        if(!loader.load(path))
+            return false;
+        directory = path.substr(0, path.find_last_of('/'));
+
+        ModelNode root;
+        root.transform = glm::mat4(1.0f);
+        root.parent = SceneGraph::NO_PARENT;
+        nodes.push_back(root);
+        for(unsigned int o = 0; o < loader.getObjectCount(); o++)
+        {
+            ModelNode node;
+            node.transform = glm::mat4(1.0f);
+            node.parent = 0;
+            nodes.push_back(node);
+        }
+        std::vector<ObjMesh>& objMeshes = loader.getMeshes();
+        meshMaps.resize(objMeshes.size());
+        for(unsigned int i = 0; i < objMeshes.size(); i++)
+        {
+            const ObjMaterial& material = loader.getMaterials()[objMeshes[i].material];
+            for(unsigned int m = 0; m < OBJ_MAP_COUNT; m++)
+            {
+                if(material.maps[m].empty())
+                    continue;
+                MaterialMap map = { material.maps[m], OBJ_MAP_TYPES[m] };
+                meshMaps[i].push_back(map);
+            }
+            nodes[1 + objMeshes[i].object].meshes.push_back(i);
+        }
+        std::vector<Mesh*> built(objMeshes.size());
+        JobCounter counter;
+        meshesParsed(objMeshes.size());
+        for(unsigned int i = 0; i < objMeshes.size(); i++)
+        {
+            JobSystem::instance().run([this, &loader, &objMeshes, &built, i]() {
+                const ObjMaterial& material = loader.getMaterials()[objMeshes[i].material];
+                // the loader is done with them, the mesh takes the vectors over
+                built[i] = new Mesh(std::move(objMeshes[i].vertices), std::move(objMeshes[i].indices), std::vector<Texture>(),
+                                    material.constants, false);
+                meshBuilt();
+            }, &counter, backgroundBuild());
+        }
+        JobSystem::instance().wait(counter);
+        for(unsigned int i = 0; i < built.size(); i++)
+        {
+            meshes.push_back(std::move(*built[i]));
+            delete built[i];
+        }
+        calculateBounds();
+        return true;
+    }
+
+    // assimp matrices are row major
+    static glm::mat4 toGlm(const aiMatrix4x4& m)
+    {
+        glm::mat4 result;
+        result[0] = glm::vec4(m.a1, m.b1, m.c1, m.d1);
+        result[1] = glm::vec4(m.a2, m.b2, m.c2, m.d2);
+        result[2] = glm::vec4(m.a3, m.b3, m.c3, m.d3);
+        result[3] = glm::vec4(m.a4, m.b4, m.c4, m.d4);
+        return result;
+    }
+
+    static float maxDifference(const glm::vec3& a, const glm::vec3& b)
+    {
+        glm::vec3 d = glm::abs(a - b);
+        return std::max(d.x, std::max(d.y, d.z));
+    }
+
+    // mesh indices in the order processNode visits them
+    static void collectMeshes(const aiNode* node, std::vector<unsigned int>& order)
     {
+        for(unsigned int i = 0; i < node->mNumMeshes; i++)
+            order.push_back(node->mMeshes[i]);
+        for(unsigned int i = 0; i < node->mNumChildren; i++)
+            collectMeshes(node->mChildren[i], order);
+    }
+
+    // every mesh's box under its node's transform relative to the model root, as Queue places it
+    void calculateBounds()
+    {
+        bool first = true;
+        std::vector<glm::mat4> nodeTransforms(nodes.size());
+        for(unsigned int n = 0; n < nodes.size(); n++)
+        {
+            // parents come before their children
+            nodeTransforms[n] = nodes[n].parent == SceneGraph::NO_PARENT ? nodes[n].transform
+                                                                        : nodeTransforms[nodes[n].parent] * nodes[n].transform;
+            for(unsigned int m = 0; m < nodes[n].meshes.size(); m++)
+            {
+                const Mesh& mesh = meshes[nodes[n].meshes[m]];
+                if(mesh.vertices.empty())
+                    continue;
+                glm::vec3 min, max;
+                transformBox(nodeTransforms[n], mesh.boundsMin, mesh.boundsMax, min, max);
+                boundsMin = first ? min : glm::min(boundsMin, min);
+                boundsMax = first ? max : glm::max(boundsMax, max);
+                first = false;
+            }
+        }
+    }
+
+    void processNode(aiNode* node, const aiScene* scene, unsigned int parent, std::vector<PendingMesh>& pending)
+    {
+        ModelNode modelNode;
+        modelNode.transform = toGlm(node->mTransformation);
+        modelNode.parent = parent;
         for(unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            modelNode.meshes.push_back(pending.size());
+            pending.push_back(processMesh(mesh, scene));
         }
+        unsigned int index = nodes.size();
+        nodes.push_back(modelNode);
 
         for(unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, index, pending);
         }
 
         std::cout << "usao" << std::endl;
     }
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    // vertices and triangle indices of an imported mesh
+    static void readMesh(const aiMesh* mesh, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
     {
-        std::vector<Vertex> vertices;
-        std::vector<unsigned int> indices;
-        std::vector<Texture> textures;
-
         for(unsigned int i = 0; i<mesh->mNumVertices; i++)
         {
             Vertex vertex;
@@ -99,6 +730,7 @@ private:
             }
             else
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+            vertex.LightmapCoords = glm::vec2(0.0f, 0.0f);
 
             vertices.push_back(vertex);
         }
@@ -109,60 +741,86 @@ private:
             for(unsigned int j = 0; j<face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);
         }
+    }
+
+    // the material part, the geometry is read by a job
+    PendingMesh processMesh(aiMesh* mesh, const aiScene* scene)
+    {
+        std::vector<MaterialMap> maps;
 
         //procesiranje materijala
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-        std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-        std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_DISPLACEMENT, "texture_height");
-        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-        std::vector<Texture> opacityMaps = loadMaterialTextures(material, aiTextureType_OPACITY, "texture_opacity");
-        textures.insert(textures.end(), opacityMaps.begin(), opacityMaps.end());
+        loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", maps);
+        loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", maps);
+        loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", maps);
+        loadMaterialTextures(material, aiTextureType_DISPLACEMENT, "texture_height", maps);
+        loadMaterialTextures(material, aiTextureType_OPACITY, "texture_opacity", maps);
 
+        MaterialConstants constants;
+        aiColor3D color(0.8f, 0.8f, 0.8f);
+        if(material->Get(AI_MATKEY_COLOR_DIFFUSE, color) == aiReturn_SUCCESS)
+            constants.diffuseColor = glm::vec3(color.r, color.g, color.b);
+        color = aiColor3D(0.5f, 0.5f, 0.5f);
+        if(material->Get(AI_MATKEY_COLOR_SPECULAR, color) == aiReturn_SUCCESS)
+            constants.specularColor = glm::vec3(color.r, color.g, color.b);
 
-        return Mesh(vertices, indices, textures);
+        PendingMesh pending;
+        pending.mesh = mesh;
+        pending.maps = maps;
+        pending.constants = constants;
+        return pending;
     }
 
-    std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName)
+    // only collects the paths, upload() creates the textures
+    void loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName, std::vector<MaterialMap>& maps)
     {
         std::cout << typeName << std::endl;
-        std::vector<Texture> textures;
         for(unsigned int i = 0; i<mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            MaterialMap map = { str.C_Str(), typeName };
+            maps.push_back(map);
         }
+    }
 
-        return textures;
+    Texture loadTexture(const std::string& path, const std::string& typeName)
+    {
+        // check if texture was loaded before and if so, skip loading a new texture
+        for(unsigned int j = 0; j < textures_loaded.size(); j++)
+        {
+            if(textures_loaded[j].path == path)
+                return textures_loaded[j];
+        }
+        Texture texture;
+        texture.id = TextureFromFile(path.c_str(), this->directory, typeName);
+        texture.type = typeName;
+        texture.path = path;
+        textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+        return texture;
     }
 };
 
-unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma)
+ModelLoad::~ModelLoad()
+{
+    if(ready)
+        return;
+    // cancelled: the parse job writes into this, and nothing else owns the half loaded model
+    JobSystem::instance().wait(parsing);
+    std::vector<ModelLoad*>& loads = Model::pendingLoads();
+    loads.erase(std::remove(loads.begin(), loads.end(), this), loads.end());
+    delete model;
+}
+
+unsigned int TextureFromFile(const char* path, const std::string& directory, const std::string& typeName, bool gamma)
 {
+    // mid grey albedo, no specular, an unperturbed normal, no height, fully opaque
+    static const unsigned char DIFFUSE[4] = { 128, 128, 128, 255 };
+    static const unsigned char SPECULAR[4] = { 0, 0, 0, 255 };
+    static const unsigned char NORMAL[4] = { 128, 128, 255, 255 };
+    static const unsigned char HEIGHT[4] = { 0, 0, 0, 255 };
+    static const unsigned char OPACITY[4] = { 255, 255, 255, 255 };
+
     std::string filename = std::string(path);
     filename = directory + '/' + filename;
 
@@ -170,38 +828,25 @@ unsigned int TextureFromFile(const char* path, const std::string& directory, boo
     glGenTextures(1, &textureID);
 
     std::cout << filename << std::endl;
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    stbi_set_flip_vertically_on_load(true);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        std::cout << nrComponents << std::endl;
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
+    const unsigned char* placeholder = typeName == "texture_specular" ? SPECULAR : typeName == "texture_normal" ? NORMAL
+                                     : typeName == "texture_height" ? HEIGHT : typeName == "texture_opacity" ? OPACITY : DIFFUSE;
+    RenderState::instance().bindTexture(GL_TEXTURE_2D, textureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // nothing is read now, the first draw that survives culling with this texture starts the decode
+    TextureStreamer::instance().addLazy(textureID, filename, placeholder, typeName == "texture_opacity");
 
     return textureID;
 }
 
+unsigned char* loadImage(const std::string& path, int* width, int* height, int* channels)
+{
+    FileData file = VirtualFileSystem::instance().read(path);
+    if(!file.isValid())
+        return nullptr;
+    return stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(file.data()), (int)file.size(), width, height, channels, 0);
+}
+
 #endif //PROJECT_BASE_MODEL_H
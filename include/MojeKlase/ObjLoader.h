@@ -0,0 +1,933 @@
+#ifndef PROJECT_BASE_OBJLOADER_H
+#define PROJECT_BASE_OBJLOADER_H
+
+#include <glm/glm.hpp>
+#include <MojeKlase/Mesh.h>
+#include <MojeKlase/VirtualFileSystem.h>
+#include <MojeKlase/Arena.h>
+#include <MojeKlase/JobSystem.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+
+// MTL maps Model loads, in the order it loads them
+enum ObjMap
+{
+    OBJ_MAP_DIFFUSE = 0,    // map_Kd
+    OBJ_MAP_SPECULAR,       // map_Ks
+    OBJ_MAP_BUMP,           // map_Bump, bump; assimp's HEIGHT, which Model treats as the normal map
+    OBJ_MAP_DISPLACEMENT,   // disp, map_disp
+    OBJ_MAP_OPACITY,        // map_d
+    OBJ_MAP_COUNT
+};
+
+// Texture::type of each ObjMap
+static const char* const OBJ_MAP_TYPES[OBJ_MAP_COUNT] = {
+        "texture_diffuse", "texture_specular", "texture_normal", "texture_height", "texture_opacity"
+};
+
+struct ObjMaterial
+{
+    std::string name;
+    MaterialConstants constants;
+    std::string maps[OBJ_MAP_COUNT];    // paths relative to the model, empty if the material has none
+};
+
+// one usemtl run of one object
+struct ObjMesh
+{
+    unsigned int object;        // o/g statement the mesh belongs to, in file order
+    unsigned int material;      // index into getMaterials()
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+};
+
+// Fast path for Wavefront OBJ/MTL. The file, a view into the asset pack or a mapping, is cut into line aligned chunks that
+// are parsed as JobSystem ranges; a serial pass then stitches the chunks' objects, usemtl runs and
+// relative indices together, and the meshes are built in parallel again.
+// The output matches what Model's assimp import (Triangulate | CalcTangentSpace) gives: one vertex per
+// face corner, quads split at their concave corner, assimp's tangent projection and smoothing, and its
+// defaults for missing materials. Polygons with more than four corners are fanned instead of ear
+// clipped, corners without a normal get their face's, a repeated o name starts a new object instead
+// of reopening the old one, and l/p primitives are skipped.
+class ObjLoader
+{
+public:
+    bool load(const std::string& path)
+    {
+        FileData file = VirtualFileSystem::instance().read(path);
+        if(!file.isValid())
+            return false;
+        directory = path.substr(0, path.find_last_of('/'));
+
+        ObjMaterial fallback;
+        fallback.name = "DefaultMaterial";
+        materials.push_back(fallback);
+
+        // chunk borders move forward to the next line start
+        size_t size = file.size();
+        unsigned int count = (unsigned int)std::max<size_t>(1, std::min<size_t>(JobSystem::instance().getWorkerCount(), size / CHUNK_BYTES));
+        std::vector<Chunk> chunks(count);
+        const char* end = file.data() + size;
+        for(unsigned int c = 0; c < count; c++)
+        {
+            chunks[c].begin = c == 0 ? file.data() : chunks[c - 1].end;
+            if(c + 1 == count)
+            {
+                chunks[c].end = end;
+                continue;
+            }
+            const char* split = std::max(chunks[c].begin, file.data() + size / count * (c + 1));
+            const char* newline = static_cast<const char*>(std::memchr(split, '\n', end - split));
+            chunks[c].end = newline ? newline + 1 : end;
+        }
+        JobSystem::instance().parallelFor(count, 1, [&chunks](unsigned int begin, unsigned int end) {
+            for(unsigned int c = begin; c < end; c++)
+                parseChunk(chunks[c]);
+        });
+
+        std::vector<Run> runs;
+        merge(chunks, runs);
+        if(!buildMeshes(chunks, runs))
+        {
+            std::cout << "OBJ: face index out of range in " << path << std::endl;
+            meshes.clear();
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<ObjMesh>& getMeshes()
+    {
+        return meshes;
+    }
+
+    // index 0 is assimp's DefaultMaterial, for faces before any usemtl
+    const std::vector<ObjMaterial>& getMaterials() const
+    {
+        return materials;
+    }
+
+    unsigned int getObjectCount() const
+    {
+        return objectCount;
+    }
+private:
+    // below this much per chunk the jobs cost more than they save
+    static const size_t CHUNK_BYTES = 256 * 1024;
+
+    // a corner as written, 1 based, negative counts back from the face, 0 if absent
+    struct Corner
+    {
+        int position;
+        int texCoord;
+        int normal;
+    };
+
+    // the counts are how many of each attribute the chunk had read when it reached the face
+    struct Face
+    {
+        unsigned int firstCorner;
+        unsigned int cornerCount;
+        unsigned int positions;
+        unsigned int texCoords;
+        unsigned int normals;
+    };
+
+    enum Keyword
+    {
+        KEY_OBJECT,
+        KEY_GROUP,
+        KEY_USEMTL,
+        KEY_MTLLIB
+    };
+
+    // face is how many faces of the chunk come before it
+    struct Statement
+    {
+        Keyword keyword;
+        unsigned int face;
+        std::string name;
+    };
+
+    // the parsed arrays only live until the meshes are built, in an arena of the chunk's own since
+    // chunks are parsed on different threads
+    struct Chunk
+    {
+        const char* begin;
+        const char* end;
+        std::unique_ptr<Arena> scratch;
+        ArenaVector<glm::vec3> positions;
+        ArenaVector<glm::vec2> texCoords;
+        ArenaVector<glm::vec3> normals;
+        ArenaVector<Corner> corners;
+        ArenaVector<Face> faces;
+        std::vector<Statement> statements;
+        // where the chunk's attributes start in the merged arrays
+        unsigned int positionBase = 0;
+        unsigned int texCoordBase = 0;
+        unsigned int normalBase = 0;
+
+        Chunk() : scratch(new Arena(CHUNK_BYTES)), positions(ArenaAllocator<glm::vec3>(scratch.get())),
+                  texCoords(ArenaAllocator<glm::vec2>(scratch.get())), normals(ArenaAllocator<glm::vec3>(scratch.get())),
+                  corners(ArenaAllocator<Corner>(scratch.get())), faces(ArenaAllocator<Face>(scratch.get())) {}
+    };
+
+    struct FaceRange
+    {
+        unsigned int chunk;
+        unsigned int begin;
+        unsigned int end;
+    };
+
+    // faces of one mesh to be, possibly spread over several chunks
+    struct Run
+    {
+        unsigned int object;
+        unsigned int material;
+        std::vector<FaceRange> faces;
+    };
+
+    std::string directory;
+    std::vector<ObjMesh> meshes;
+    std::vector<ObjMaterial> materials;
+    std::unordered_map<std::string, unsigned int> materialIndices;
+    // merged attributes, freed with the loader once Model has its meshes
+    Arena scratch;
+    ArenaVector<glm::vec3> positions{ArenaAllocator<glm::vec3>(&scratch)};
+    ArenaVector<glm::vec2> texCoords{ArenaAllocator<glm::vec2>(&scratch)};
+    ArenaVector<glm::vec3> normals{ArenaAllocator<glm::vec3>(&scratch)};
+    unsigned int objectCount = 0;
+
+    static bool isSpace(char c)
+    {
+        return c == ' ' || c == '\t';
+    }
+
+    static bool isDigit(char c)
+    {
+        return (unsigned char)(c - '0') < 10;
+    }
+
+    static const char* skipSpaces(const char* p, const char* end)
+    {
+        while(p < end && isSpace(*p))
+            p++;
+        return p;
+    }
+
+    static std::string restOfLine(const char* p, const char* end)
+    {
+        p = skipSpaces(p, end);
+        while(end > p && (isSpace(end[-1]) || end[-1] == '\r'))
+            end--;
+        return std::string(p, end);
+    }
+
+    // whether the line starts with keyword followed by whitespace
+    static bool startsWith(const char* p, const char* end, const char* keyword)
+    {
+        size_t length = std::strlen(keyword);
+        return (size_t)(end - p) > length && std::memcmp(p, keyword, length) == 0 && isSpace(p[length]);
+    }
+
+    // eight ASCII digits in a little endian word to their value, three multiplies instead of eight
+    static uint32_t eightDigits(uint64_t word)
+    {
+        const uint64_t mask = 0x000000FF000000FFull;
+        const uint64_t mul1 = 100 + (1000000ull << 32);
+        const uint64_t mul2 = 1 + (10000ull << 32);
+        word -= 0x3030303030303030ull;
+        word = word * 10 + (word >> 8);
+        return (uint32_t)((((word & mask) * mul1) + (((word >> 16) & mask) * mul2)) >> 32);
+    }
+
+    // appends the run of digits at p to mantissa, up to eight at a time, returns how many there were
+    static unsigned int readDigits(const char*& p, const char* end, uint64_t& mantissa, unsigned int& significant)
+    {
+        static const uint64_t powers[9] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+        unsigned int total = 0;
+        while(end - p >= 8 && significant <= 11)
+        {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            // nonzero bytes where the character is not a digit
+            uint64_t other = ((word & 0xF0F0F0F0F0F0F0F0ull) ^ 0x3030303030303030ull)
+                             | (((word + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) ^ 0x3030303030303030ull);
+            unsigned int n = other ? __builtin_ctzll(other) / 8 : 8;
+            if(n == 0)
+                return total;
+            // shift the digits to the top, the bytes below become leading '0's
+            if(n < 8)
+                word = (word << (64 - 8 * n)) | (0x3030303030303030ull >> (8 * n));
+            mantissa = mantissa * powers[n] + eightDigits(word);
+            significant += mantissa ? n : 0;
+            total += n;
+            p += n;
+            if(n < 8)
+                return total;
+        }
+        while(p < end && isDigit(*p))
+        {
+            if(significant < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                significant += mantissa ? 1 : 0;
+            }
+            else
+                significant++;
+            total++;
+            p++;
+        }
+        return total;
+    }
+
+    // decimal to float without strtod's locale and NUL terminator; values a double cannot represent
+    // exactly before the final scaling (over 15 digits, huge exponents, inf, nan) go through strtod
+    static float parseFloat(const char*& p, const char* end)
+    {
+        static const double powers[23] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        p = skipSpaces(p, end);
+        const char* start = p;
+        bool negative = false;
+        if(p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+        uint64_t mantissa = 0;
+        unsigned int significant = 0;
+        unsigned int integerDigits = readDigits(p, end, mantissa, significant);
+        int exponent = 0;
+        unsigned int fractionDigits = 0;
+        if(p < end && *p == '.')
+        {
+            p++;
+            fractionDigits = readDigits(p, end, mantissa, significant);
+            exponent -= fractionDigits;
+        }
+        if(integerDigits + fractionDigits == 0)
+            return slowFloat(start, p, end);
+        if(p < end && (*p == 'e' || *p == 'E'))
+        {
+            const char* e = p + 1;
+            bool negativeExponent = false;
+            if(e < end && (*e == '-' || *e == '+'))
+                negativeExponent = *e++ == '-';
+            int value = 0;
+            if(e < end && isDigit(*e))
+            {
+                while(e < end && isDigit(*e))
+                    value = std::min(value * 10 + (*e++ - '0'), 10000);
+                exponent += negativeExponent ? -value : value;
+                p = e;
+            }
+        }
+        if(significant > 15 || exponent < -22 || exponent > 22)
+            return slowFloat(start, p, end);
+        double value = exponent < 0 ? (double)mantissa / powers[-exponent] : (double)mantissa * powers[exponent];
+        return (float)(negative ? -value : value);
+    }
+
+    static float slowFloat(const char* start, const char*& p, const char* end)
+    {
+        char buffer[64];
+        size_t length = 0;
+        while(start + length < end && length + 1 < sizeof(buffer) && !isSpace(start[length])
+              && start[length] != '\r' && start[length] != '\n')
+        {
+            buffer[length] = start[length];
+            length++;
+        }
+        buffer[length] = 0;
+        char* stop;
+        float value = std::strtof(buffer, &stop);
+        p = start + (stop - buffer);
+        // skip whatever could not be read so the caller does not loop on it
+        if(stop == buffer)
+            while(p < end && !isSpace(*p) && *p != '\r' && *p != '\n')
+                p++;
+        return value;
+    }
+
+    static int parseInt(const char*& p, const char* end)
+    {
+        bool negative = false;
+        if(p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+        int value = 0;
+        while(p < end && isDigit(*p))
+            value = value * 10 + (*p++ - '0');
+        return negative ? -value : value;
+    }
+
+    // v, v/vt, v//vn or v/vt/vn per corner
+    static void parseFace(Chunk& chunk, const char* p, const char* end)
+    {
+        Face face;
+        face.firstCorner = chunk.corners.size();
+        face.positions = chunk.positions.size();
+        face.texCoords = chunk.texCoords.size();
+        face.normals = chunk.normals.size();
+        for(;;)
+        {
+            p = skipSpaces(p, end);
+            if(p >= end || !(isDigit(*p) || *p == '-' || *p == '+'))
+                break;
+            Corner corner = { parseInt(p, end), 0, 0 };
+            if(p < end && *p == '/')
+            {
+                p++;
+                if(p < end && *p != '/')
+                    corner.texCoord = parseInt(p, end);
+                if(p < end && *p == '/')
+                {
+                    p++;
+                    corner.normal = parseInt(p, end);
+                }
+            }
+            chunk.corners.push_back(corner);
+            while(p < end && !isSpace(*p))
+                p++;
+        }
+        face.cornerCount = chunk.corners.size() - face.firstCorner;
+        if(face.cornerCount < 3)
+        {
+            chunk.corners.resize(face.firstCorner);
+            return;
+        }
+        chunk.faces.push_back(face);
+    }
+
+    static void parseLine(Chunk& chunk, const char* p, const char* end)
+    {
+        p = skipSpaces(p, end);
+        if(end - p < 2)
+            return;
+        Statement statement;
+        statement.face = chunk.faces.size();
+        switch(*p)
+        {
+            case 'v':
+                if(isSpace(p[1]))
+                {
+                    p += 2;
+                    glm::vec3 position;
+                    position.x = parseFloat(p, end);
+                    position.y = parseFloat(p, end);
+                    position.z = parseFloat(p, end);
+                    chunk.positions.push_back(position);
+                }
+                else if(p[1] == 't' && end - p > 2 && isSpace(p[2]))
+                {
+                    p += 3;
+                    glm::vec2 texCoord;
+                    texCoord.x = parseFloat(p, end);
+                    texCoord.y = parseFloat(p, end);
+                    chunk.texCoords.push_back(texCoord);
+                }
+                else if(p[1] == 'n' && end - p > 2 && isSpace(p[2]))
+                {
+                    p += 3;
+                    glm::vec3 normal;
+                    normal.x = parseFloat(p, end);
+                    normal.y = parseFloat(p, end);
+                    normal.z = parseFloat(p, end);
+                    chunk.normals.push_back(normal);
+                }
+                return;
+            case 'f':
+                if(isSpace(p[1]))
+                    parseFace(chunk, p + 2, end);
+                return;
+            case 'o':
+            case 'g':
+                if(!isSpace(p[1]))
+                    return;
+                statement.keyword = *p == 'o' ? KEY_OBJECT : KEY_GROUP;
+                statement.name = restOfLine(p + 2, end);
+                break;
+            case 'u':
+                if(!startsWith(p, end, "usemtl"))
+                    return;
+                statement.keyword = KEY_USEMTL;
+                statement.name = restOfLine(p + 6, end);
+                break;
+            case 'm':
+                if(!startsWith(p, end, "mtllib"))
+                    return;
+                statement.keyword = KEY_MTLLIB;
+                statement.name = restOfLine(p + 6, end);
+                break;
+            default:
+                return;
+        }
+        chunk.statements.push_back(statement);
+    }
+
+    static void parseChunk(Chunk& chunk)
+    {
+        // a rough guess at the mix of a typical file, saves most of the regrowing
+        size_t lines = (chunk.end - chunk.begin) / 32;
+        chunk.positions.reserve(lines / 4);
+        chunk.faces.reserve(lines / 2);
+        chunk.corners.reserve(lines * 3 / 2);
+        const char* p = chunk.begin;
+        while(p < chunk.end)
+        {
+            const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', chunk.end - p));
+            if(!lineEnd)
+                lineEnd = chunk.end;
+            parseLine(chunk, p, lineEnd);
+            p = lineEnd + 1;
+        }
+    }
+
+    // walks the chunks' statements in file order and groups their faces the way assimp's OBJ parser does:
+    // o and g start objects, usemtl starts a new mesh within the object unless nothing used the old one yet
+    void merge(std::vector<Chunk>& chunks, std::vector<Run>& runs)
+    {
+        // sized up front, growing in the arena would leave every outgrown buffer behind
+        size_t positionCount = 0, texCoordCount = 0, normalCount = 0;
+        for(unsigned int c = 0; c < chunks.size(); c++)
+        {
+            positionCount += chunks[c].positions.size();
+            texCoordCount += chunks[c].texCoords.size();
+            normalCount += chunks[c].normals.size();
+        }
+        positions.reserve(positionCount);
+        texCoords.reserve(texCoordCount);
+        normals.reserve(normalCount);
+
+        unsigned int material = 0;
+        int mesh = -1;
+        std::string group;
+        bool haveGroup = false;
+        for(unsigned int c = 0; c < chunks.size(); c++)
+        {
+            Chunk& chunk = chunks[c];
+            chunk.positionBase = positions.size();
+            chunk.texCoordBase = texCoords.size();
+            chunk.normalBase = normals.size();
+            positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+            texCoords.insert(texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+            normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+
+            unsigned int face = 0;
+            for(unsigned int s = 0; s <= chunk.statements.size(); s++)
+            {
+                unsigned int next = s < chunk.statements.size() ? chunk.statements[s].face : chunk.faces.size();
+                if(next > face)
+                {
+                    // faces before any o or g go into assimp's default object
+                    if(mesh < 0)
+                        mesh = startObject(runs, material);
+                    FaceRange range = { c, face, next };
+                    runs[mesh].faces.push_back(range);
+                    face = next;
+                }
+                if(s == chunk.statements.size())
+                    break;
+
+                const Statement& statement = chunk.statements[s];
+                if(statement.keyword == KEY_OBJECT)
+                    mesh = startObject(runs, material);
+                else if(statement.keyword == KEY_GROUP && (!haveGroup || statement.name != group))
+                {
+                    mesh = startObject(runs, material);
+                    group = statement.name;
+                    haveGroup = true;
+                }
+                else if(statement.keyword == KEY_MTLLIB)
+                    loadMaterials(directory + '/' + statement.name);
+                else if(statement.keyword == KEY_USEMTL)
+                {
+                    std::unordered_map<std::string, unsigned int>::iterator it = materialIndices.find(statement.name);
+                    if(it == materialIndices.end())
+                    {
+                        // like assimp: later objects get the default, the current mesh keeps going
+                        std::cout << "OBJ: unknown material " << statement.name << std::endl;
+                        material = 0;
+                        continue;
+                    }
+                    material = it->second;
+                    if(mesh < 0)
+                        continue;
+                    if(!runs[mesh].faces.empty() && runs[mesh].material != material)
+                    {
+                        Run run;
+                        run.object = runs[mesh].object;
+                        run.material = material;
+                        runs.push_back(run);
+                        mesh = runs.size() - 1;
+                    }
+                    runs[mesh].material = material;
+                }
+            }
+        }
+    }
+
+    int startObject(std::vector<Run>& runs, unsigned int material)
+    {
+        Run run;
+        run.object = objectCount++;
+        run.material = material;
+        runs.push_back(run);
+        return runs.size() - 1;
+    }
+
+    // 1 based or counted back from count, 0 based into the merged array; -1 if out of range
+    static int resolve(int index, unsigned int base, unsigned int count, unsigned int total)
+    {
+        long long resolved = index > 0 ? (long long)index - 1 : (long long)base + count + index;
+        return index != 0 && resolved >= 0 && resolved < total ? (int)resolved : -1;
+    }
+
+    bool buildMeshes(const std::vector<Chunk>& chunks, const std::vector<Run>& runs)
+    {
+        std::vector<unsigned int> used;
+        for(unsigned int r = 0; r < runs.size(); r++)
+            if(!runs[r].faces.empty())
+                used.push_back(r);
+        meshes.resize(used.size());
+
+        std::atomic<bool> valid(true);
+        JobSystem::instance().parallelFor(used.size(), 1, [&](unsigned int begin, unsigned int end) {
+            for(unsigned int m = begin; m < end; m++)
+            {
+                if(!buildMesh(chunks, runs[used[m]], meshes[m]))
+                    valid = false;
+            }
+        });
+        return valid;
+    }
+
+    bool buildMesh(const std::vector<Chunk>& chunks, const Run& run, ObjMesh& mesh) const
+    {
+        mesh.object = run.object;
+        mesh.material = run.material;
+        bool anyTexCoords = false;
+        for(unsigned int r = 0; r < run.faces.size(); r++)
+        {
+            const FaceRange& range = run.faces[r];
+            const Chunk& chunk = chunks[range.chunk];
+            for(unsigned int f = range.begin; f < range.end; f++)
+            {
+                const Face& face = chunk.faces[f];
+                unsigned int first = mesh.vertices.size();
+                bool missingNormal = false;
+                for(unsigned int k = 0; k < face.cornerCount; k++)
+                {
+                    const Corner& corner = chunk.corners[face.firstCorner + k];
+                    int position = resolve(corner.position, chunk.positionBase, face.positions, positions.size());
+                    if(position < 0)
+                        return false;
+                    Vertex vertex;
+                    vertex.Position = positions[position];
+                    vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+                    vertex.Normal = glm::vec3(0.0f, 0.0f, 0.0f);
+                    vertex.Tangent = glm::vec3(0.0f, 0.0f, 0.0f);
+                    vertex.LightmapCoords = glm::vec2(0.0f, 0.0f);
+                    if(corner.texCoord != 0)
+                    {
+                        int texCoord = resolve(corner.texCoord, chunk.texCoordBase, face.texCoords, texCoords.size());
+                        if(texCoord < 0)
+                            return false;
+                        vertex.TexCoords = texCoords[texCoord];
+                        anyTexCoords = true;
+                    }
+                    if(corner.normal != 0)
+                    {
+                        int normal = resolve(corner.normal, chunk.normalBase, face.normals, normals.size());
+                        if(normal < 0)
+                            return false;
+                        vertex.Normal = normals[normal];
+                    }
+                    else
+                        missingNormal = true;
+                    mesh.vertices.push_back(vertex);
+                }
+                if(missingNormal)
+                    fillFaceNormal(mesh.vertices, first);
+                triangulate(mesh.vertices, first, face.cornerCount, mesh.indices);
+            }
+        }
+        // assimp leaves meshes without UVs without tangents too
+        if(anyTexCoords)
+            calculateTangents(mesh.vertices, mesh.indices);
+        return true;
+    }
+
+    static void fillFaceNormal(std::vector<Vertex>& vertices, unsigned int first)
+    {
+        glm::vec3 normal = glm::cross(vertices[first + 1].Position - vertices[first].Position,
+                                      vertices[first + 2].Position - vertices[first].Position);
+        float length = glm::length(normal);
+        if(length > 0.0f)
+            normal /= length;
+        for(unsigned int i = first; i < vertices.size(); i++)
+            if(vertices[i].Normal == glm::vec3(0.0f))
+                vertices[i].Normal = normal;
+    }
+
+    // assimp's Normalize, which divides by zero on zero vectors
+    static glm::vec3 unsafeNormalize(const glm::vec3& v)
+    {
+        return v / glm::length(v);
+    }
+
+    // assimp's NormalizeSafe
+    static glm::vec3 safeNormalize(const glm::vec3& v)
+    {
+        float length = glm::length(v);
+        return length > 0.0f ? v / length : v;
+    }
+
+    // aiProcess_Triangulate: a quad is fanned from its concave corner if it has one, otherwise from the first
+    static void triangulate(const std::vector<Vertex>& vertices, unsigned int first, unsigned int count,
+                            std::vector<unsigned int>& indices)
+    {
+        if(count == 4)
+        {
+            unsigned int start = 0;
+            for(unsigned int i = 0; i < 4; i++)
+            {
+                const glm::vec3& v = vertices[first + i].Position;
+                glm::vec3 left = unsafeNormalize(vertices[first + (i + 3) % 4].Position - v);
+                glm::vec3 diagonal = unsafeNormalize(vertices[first + (i + 2) % 4].Position - v);
+                glm::vec3 right = unsafeNormalize(vertices[first + (i + 1) % 4].Position - v);
+                float angle = std::acos(glm::dot(left, diagonal)) + std::acos(glm::dot(right, diagonal));
+                if(angle > 3.14159265358979f)
+                {
+                    start = i;
+                    break;
+                }
+            }
+            unsigned int order[6] = { start, start + 1, start + 2, start, start + 2, start + 3 };
+            for(unsigned int i = 0; i < 6; i++)
+                indices.push_back(first + order[i] % 4);
+            return;
+        }
+        for(unsigned int i = 1; i + 1 < count; i++)
+        {
+            indices.push_back(first);
+            indices.push_back(first + i);
+            indices.push_back(first + i + 1);
+        }
+    }
+
+    // aiProcess_CalcTangentSpace: per triangle tangents projected into each corner's normal plane,
+    // then averaged over corners that share a position, a normal and a tangent within 45 degrees
+    static void calculateTangents(std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+    {
+        std::vector<glm::vec3> bitangents(vertices.size(), glm::vec3(0.0f));
+        for(unsigned int t = 0; t + 2 < indices.size(); t += 3)
+        {
+            unsigned int p0 = indices[t], p1 = indices[t + 1], p2 = indices[t + 2];
+            glm::vec3 v = vertices[p1].Position - vertices[p0].Position;
+            glm::vec3 w = vertices[p2].Position - vertices[p0].Position;
+            float sx = vertices[p1].TexCoords.x - vertices[p0].TexCoords.x, sy = vertices[p1].TexCoords.y - vertices[p0].TexCoords.y;
+            float tx = vertices[p2].TexCoords.x - vertices[p0].TexCoords.x, ty = vertices[p2].TexCoords.y - vertices[p0].TexCoords.y;
+            float direction = (tx * sy - ty * sx) < 0.0f ? -1.0f : 1.0f;
+            // all three at one UV, use the default UV directions
+            if(sx * ty == sy * tx)
+            {
+                sx = 0.0f; sy = 1.0f;
+                tx = 1.0f; ty = 0.0f;
+            }
+            glm::vec3 tangent = (w * sy - v * ty) * direction;
+            glm::vec3 bitangent = (w * sx - v * tx) * direction;
+            for(unsigned int j = 0; j < 3; j++)
+            {
+                unsigned int p = indices[t + j];
+                const glm::vec3& normal = vertices[p].Normal;
+                glm::vec3 localTangent = tangent - normal * glm::dot(tangent, normal);
+                glm::vec3 localBitangent = bitangent - normal * glm::dot(bitangent, normal)
+                                           - localTangent * glm::dot(bitangent, localTangent);
+                localTangent = safeNormalize(localTangent);
+                localBitangent = safeNormalize(localBitangent);
+                bool invalidTangent = !std::isfinite(localTangent.x) || !std::isfinite(localTangent.y) || !std::isfinite(localTangent.z);
+                bool invalidBitangent = !std::isfinite(localBitangent.x) || !std::isfinite(localBitangent.y) || !std::isfinite(localBitangent.z);
+                if(invalidTangent != invalidBitangent)
+                {
+                    if(invalidTangent)
+                        localTangent = safeNormalize(glm::cross(normal, localBitangent));
+                    else
+                        localBitangent = safeNormalize(glm::cross(localTangent, normal));
+                }
+                vertices[p].Tangent = localTangent;
+                bitangents[p] = localBitangent;
+            }
+        }
+
+        // assimp's SpatialSort: positions ordered along one skewed axis, neighbours within epsilon
+        glm::vec3 boundsMin(1e10f), boundsMax(-1e10f);
+        for(unsigned int i = 0; i < vertices.size(); i++)
+        {
+            boundsMin = glm::min(boundsMin, vertices[i].Position);
+            boundsMax = glm::max(boundsMax, vertices[i].Position);
+        }
+        float epsilon = glm::length(boundsMax - boundsMin) * 1e-4f;
+        glm::vec3 axis = glm::normalize(glm::vec3(0.8523f, 0.34321f, 0.5736f));
+        std::vector<std::pair<float, unsigned int> > sorted(vertices.size());
+        for(unsigned int i = 0; i < vertices.size(); i++)
+            sorted[i] = std::make_pair(glm::dot(axis, vertices[i].Position), i);
+        std::sort(sorted.begin(), sorted.end());
+
+        const float angleLimit = std::cos(glm::radians(45.0f));
+        const float normalLimit = 0.9999f;
+        std::vector<bool> done(vertices.size(), false);
+        std::vector<unsigned int> close;
+        for(unsigned int a = 0; a < vertices.size(); a++)
+        {
+            if(done[a])
+                continue;
+            glm::vec3 position = vertices[a].Position;
+            glm::vec3 normal = vertices[a].Normal;
+            glm::vec3 tangent = vertices[a].Tangent;
+            glm::vec3 bitangent = bitangents[a];
+            float distance = glm::dot(axis, position);
+            close.clear();
+            // a goes in twice, once here and once as its own neighbour, as in assimp
+            close.push_back(a);
+            std::vector<std::pair<float, unsigned int> >::iterator it =
+                    std::lower_bound(sorted.begin(), sorted.end(), std::make_pair(distance - epsilon, 0u));
+            for(; it != sorted.end() && it->first <= distance + epsilon; ++it)
+            {
+                unsigned int b = it->second;
+                if(done[b] || glm::dot(vertices[b].Position - position, vertices[b].Position - position) >= epsilon * epsilon)
+                    continue;
+                if(glm::dot(vertices[b].Normal, normal) < normalLimit || glm::dot(vertices[b].Tangent, tangent) < angleLimit
+                   || glm::dot(bitangents[b], bitangent) < angleLimit)
+                    continue;
+                close.push_back(b);
+                done[b] = true;
+            }
+            glm::vec3 smoothTangent(0.0f), smoothBitangent(0.0f);
+            for(unsigned int i = 0; i < close.size(); i++)
+            {
+                smoothTangent += vertices[close[i]].Tangent;
+                smoothBitangent += bitangents[close[i]];
+            }
+            smoothTangent = unsafeNormalize(smoothTangent);
+            smoothBitangent = unsafeNormalize(smoothBitangent);
+            for(unsigned int i = 0; i < close.size(); i++)
+            {
+                vertices[close[i]].Tangent = smoothTangent;
+                bitangents[close[i]] = smoothBitangent;
+            }
+        }
+    }
+
+    // texture statements may carry options before the file name; -o, -s and -t take three values,
+    // -mm two, the rest one, unknown options none
+    static std::string textureName(const char* p, const char* end)
+    {
+        struct Option
+        {
+            const char* name;
+            unsigned int values;
+        };
+        static const Option options[] = {
+                { "-o", 3 }, { "-s", 3 }, { "-t", 3 }, { "-mm", 2 }, { "-bm", 1 }, { "-blendu", 1 }, { "-blendv", 1 },
+                { "-boost", 1 }, { "-cc", 1 }, { "-clamp", 1 }, { "-imfchan", 1 }, { "-texres", 1 }, { "-type", 1 }
+        };
+        for(;;)
+        {
+            p = skipSpaces(p, end);
+            if(p >= end || *p != '-')
+                return restOfLine(p, end);
+            const char* tokenEnd = p;
+            while(tokenEnd < end && !isSpace(*tokenEnd))
+                tokenEnd++;
+            std::string token(p, tokenEnd);
+            p = tokenEnd;
+            unsigned int values = 0;
+            for(unsigned int i = 0; i < sizeof(options) / sizeof(options[0]); i++)
+                if(token == options[i].name)
+                    values = options[i].values;
+            for(unsigned int v = 0; v < values; v++)
+            {
+                p = skipSpaces(p, end);
+                while(p < end && !isSpace(*p))
+                    p++;
+            }
+        }
+    }
+
+    static glm::vec3 parseColor(const char* p, const char* end)
+    {
+        glm::vec3 color;
+        color.x = parseFloat(p, end);
+        color.y = parseFloat(p, end);
+        color.z = parseFloat(p, end);
+        return color;
+    }
+
+    // new materials start from assimp's defaults: diffuse 0.6, no specular
+    void loadMaterials(const std::string& path)
+    {
+        FileData file = VirtualFileSystem::instance().read(path);
+        if(!file.isValid())
+            return;
+        const char* p = file.data();
+        const char* end = p + file.size();
+        ObjMaterial* material = nullptr;
+        while(p < end)
+        {
+            const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if(!lineEnd)
+                lineEnd = end;
+            const char* line = skipSpaces(p, lineEnd);
+            p = lineEnd + 1;
+
+            if(startsWith(line, lineEnd, "newmtl"))
+            {
+                std::string name = restOfLine(line + 6, lineEnd);
+                std::unordered_map<std::string, unsigned int>::iterator it = materialIndices.find(name);
+                if(it == materialIndices.end())
+                {
+                    ObjMaterial created;
+                    created.name = name;
+                    created.constants.diffuseColor = glm::vec3(0.6f);
+                    created.constants.specularColor = glm::vec3(0.0f);
+                    it = materialIndices.insert(std::make_pair(name, (unsigned int)materials.size())).first;
+                    materials.push_back(created);
+                }
+                material = &materials[it->second];
+                continue;
+            }
+            if(!material)
+                continue;
+            if(startsWith(line, lineEnd, "Kd"))
+                material->constants.diffuseColor = parseColor(line + 2, lineEnd);
+            else if(startsWith(line, lineEnd, "Ks"))
+                material->constants.specularColor = parseColor(line + 2, lineEnd);
+            else if(startsWith(line, lineEnd, "map_Kd"))
+                material->maps[OBJ_MAP_DIFFUSE] = textureName(line + 6, lineEnd);
+            else if(startsWith(line, lineEnd, "map_Ks"))
+                material->maps[OBJ_MAP_SPECULAR] = textureName(line + 6, lineEnd);
+            else if(startsWith(line, lineEnd, "map_Bump") || startsWith(line, lineEnd, "map_bump"))
+                material->maps[OBJ_MAP_BUMP] = textureName(line + 8, lineEnd);
+            else if(startsWith(line, lineEnd, "bump"))
+                material->maps[OBJ_MAP_BUMP] = textureName(line + 4, lineEnd);
+            else if(startsWith(line, lineEnd, "map_disp"))
+                material->maps[OBJ_MAP_DISPLACEMENT] = textureName(line + 8, lineEnd);
+            else if(startsWith(line, lineEnd, "disp"))
+                material->maps[OBJ_MAP_DISPLACEMENT] = textureName(line + 4, lineEnd);
+            else if(startsWith(line, lineEnd, "map_d"))
+                material->maps[OBJ_MAP_OPACITY] = textureName(line + 5, lineEnd);
+        }
+    }
+};
+
+#endif //PROJECT_BASE_OBJLOADER_H
@@ -0,0 +1,182 @@
+#ifndef PROJECT_BASE_PROGRAMCACHE_H
+#define PROJECT_BASE_PROGRAMCACHE_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <sys/stat.h>
+
+// ARB_get_program_binary is core only since 4.1, so the 3.3 glad loader does not provide it
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+
+// On-disk cache of linked program binaries, keyed on the final sources (defines included)
+// and the driver vendor/renderer/version. A binary the driver rejects is deleted and the
+// caller compiles from source as usual.
+class ProgramCache
+{
+public:
+    static ProgramCache& instance()
+    {
+        static ProgramCache cache;
+        return cache;
+    }
+
+    // needs a current context; leaves the cache disabled when the driver cannot return binaries
+    void initialize(const std::string& directory)
+    {
+        this->directory = directory;
+        enabled = false;
+        if(!glfwExtensionSupported("GL_ARB_get_program_binary"))
+        {
+            std::cout << "program binary cache disabled: GL_ARB_get_program_binary not supported" << std::endl;
+            return;
+        }
+        getProgramBinary = (PFNGLGETPROGRAMBINARYPROC)glfwGetProcAddress("glGetProgramBinary");
+        programBinary = (PFNGLPROGRAMBINARYPROC)glfwGetProcAddress("glProgramBinary");
+        programParameteri = (PFNGLPROGRAMPARAMETERIPROC)glfwGetProcAddress("glProgramParameteri");
+        int formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if(!getProgramBinary || !programBinary || !programParameteri || formats == 0)
+        {
+            std::cout << "program binary cache disabled: no binary formats" << std::endl;
+            return;
+        }
+
+        driver = std::string((const char*)glGetString(GL_VENDOR)) + "|" + (const char*)glGetString(GL_RENDERER)
+                 + "|" + (const char*)glGetString(GL_VERSION);
+        mkdir(directory.c_str(), 0755);
+        enabled = true;
+    }
+
+    bool isEnabled() const
+    {
+        return enabled;
+    }
+
+    std::string key(const std::string& vertexCode, const std::string& geometryCode, const std::string& fragmentCode) const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        hashString(hash, driver);
+        hashString(hash, vertexCode);
+        hashString(hash, geometryCode);
+        hashString(hash, fragmentCode);
+        char name[17];
+        std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+        return name;
+    }
+
+    // creates program from a cached binary; false when there is none or the driver rejects it
+    bool load(const std::string& key, int& program)
+    {
+        if(!enabled)
+            return false;
+        std::ifstream in(path(key), std::ios::binary);
+        if(!in)
+            return false;
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        std::string data = buffer.str();
+        if(data.size() <= sizeof(GLenum))
+            return false;
+
+        GLenum format = *(const GLenum*)data.data();
+        program = glCreateProgram();
+        programBinary(program, format, data.data() + sizeof(GLenum), data.size() - sizeof(GLenum));
+        int success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if(!success)
+        {
+            // driver update or corrupted file
+            glDeleteProgram(program);
+            std::remove(path(key).c_str());
+            std::cout << "program binary " << key << " rejected, compiling from source" << std::endl;
+            return false;
+        }
+        hits++;
+        return true;
+    }
+
+    // must be called before glLinkProgram so the driver keeps the binary around
+    void prepare(int program) const
+    {
+        if(enabled)
+            programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    void store(const std::string& key, int program)
+    {
+        if(!enabled)
+            return;
+        int length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        getProgramBinary(program, length, NULL, &format, &binary[0]);
+
+        std::ofstream out(path(key), std::ios::binary);
+        if(!out)
+        {
+            std::cout << "failed to write program binary " << path(key) << std::endl;
+            return;
+        }
+        out.write((const char*)&format, sizeof(format));
+        out.write(&binary[0], length);
+        misses++;
+    }
+
+    unsigned int getHits() const
+    {
+        return hits;
+    }
+
+    unsigned int getMisses() const
+    {
+        return misses;
+    }
+private:
+    bool enabled = false;
+    std::string directory;
+    std::string driver;
+    // shaders may be built on the ShaderCompiler thread
+    std::atomic<unsigned int> hits{0};
+    std::atomic<unsigned int> misses{0};
+    PFNGLGETPROGRAMBINARYPROC getProgramBinary = nullptr;
+    PFNGLPROGRAMBINARYPROC programBinary = nullptr;
+    PFNGLPROGRAMPARAMETERIPROC programParameteri = nullptr;
+
+    ProgramCache() {}
+
+    std::string path(const std::string& key) const
+    {
+        return directory + "/" + key + ".bin";
+    }
+
+    static void hashString(uint64_t& hash, const std::string& s)
+    {
+        for(size_t i = 0; i < s.size(); i++)
+        {
+            hash ^= (unsigned char)s[i];
+            hash *= 1099511628211ull;
+        }
+        // separator, so moving text between stages changes the key
+        hash ^= 0xff;
+        hash *= 1099511628211ull;
+    }
+};
+
+#endif //PROJECT_BASE_PROGRAMCACHE_H
@@ -0,0 +1,244 @@
+#ifndef PROJECT_BASE_RENDERQUEUE_H
+#define PROJECT_BASE_RENDERQUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <MojeKlase/Shader.h>
+#include <MojeKlase/Mesh.h>
+#include <MojeKlase/RenderState.h>
+#include <MojeKlase/Frustum.h>
+#include <MojeKlase/AllocationTracker.h>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+// passes in submission order, each one sets its own blend and depth state
+enum RenderPass
+{
+    PASS_OPAQUE = 0,
+    PASS_CUTOUT = 1,    // alpha tested, after the opaque pass so discard does not cost early depth rejection there
+    PASS_BLENDED = 2,   // weighted blended OIT, order does not matter
+    RENDER_PASS_COUNT = 3
+};
+
+// a level of detail is good enough while its error projects to less than this many pixels
+const float LOD_PIXEL_ERROR = 1.0f;
+
+struct DrawCommand
+{
+    uint64_t key;
+    Mesh* mesh;
+    Shader* shader;
+    unsigned int transform;
+    unsigned int lod;
+};
+
+// Collects the frame's mesh draws as 64 bit sort keys, radix sorts them and submits them in key order.
+// Draws are grouped by pass, program and material and go front to back inside a group.
+// Blended draws are order independent (WeightedOIT), so they are grouped the same way.
+//
+// key layout, high to low bits: pass 4 | program 10 | material 14 | depth 24 | unused 12
+class RenderQueue
+{
+public:
+    // depth is normalized against farPlane, anything beyond it sorts as if it were on it;
+    // lodScale is viewport height / (2 tan(fovy / 2)), pixels per world unit at distance 1, 0 always draws level 0
+    void begin(const glm::vec3& cameraPosition, float farPlane, float lodScale = 0.0f)
+    {
+        this->cameraPosition = cameraPosition;
+        this->farPlane = farPlane;
+        this->lodScale = lodScale;
+        culling = false;
+        triangles = 0;
+        commands.clear();
+        transforms.clear();
+        fades.clear();
+        for(unsigned int i = 0; i < RENDER_PASS_COUNT; i++)
+            passCounts[i] = 0;
+    }
+
+    // after begin(), meshes outside the view are then left out before they ask for texture detail
+    void setFrustum(const glm::mat4& viewProjection)
+    {
+        frustum = Frustum(viewProjection);
+        culling = true;
+    }
+
+    // object space mesh bounds under the transform of pushTransform(); true when there is no frustum
+    bool isVisible(const Mesh* mesh, unsigned int transform) const
+    {
+        return !culling || frustum.intersects(mesh->boundsMin, mesh->boundsMax, transforms[transform]);
+    }
+
+    // transforms are shared by all draws pushed with the returned index;
+    // fadeOut dithers the draws away while an impostor fades in over them
+    unsigned int pushTransform(const glm::mat4& model, float fadeOut = 0.0f)
+    {
+        transforms.push_back(model);
+        fades.push_back(fadeOut);
+        return transforms.size() - 1;
+    }
+
+    void push(RenderPass pass, Mesh* mesh, Shader* shader, unsigned int transform)
+    {
+        const glm::mat4& model = transforms[transform];
+        glm::vec3 center = glm::vec3(model * glm::vec4((mesh->boundsMin + mesh->boundsMax) * 0.5f, 1.0f));
+        float distance = glm::length(center - cameraPosition) / farPlane;
+        uint64_t depth = (uint64_t)(glm::clamp(distance, 0.0f, 1.0f) * DEPTH_MASK);
+        uint64_t program = programIndex(shader) & PROGRAM_MASK;
+        uint64_t material = mesh->materialKey & MATERIAL_MASK;
+
+        unsigned int lod = 0;
+        if(lodScale > 0.0f)
+        {
+            // largest axis scale turns object space sizes into world space, the nearest point of
+            // the bounding sphere is where a pixel covers the least of the mesh
+            float scale = std::max(glm::length(glm::vec3(model[0])),
+                                   std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+            float radius = glm::length(mesh->boundsMax - mesh->boundsMin) * 0.5f * scale;
+            float nearest = std::max(glm::length(center - cameraPosition) - radius, 0.0f);
+            float unitsPerPixel = nearest / (lodScale * scale);
+            lod = mesh->selectLod(LOD_PIXEL_ERROR * unitsPerPixel);
+            mesh->requestTextureDetail(unitsPerPixel);
+        }
+        triangles += mesh->getLods()[lod].indexCount / 3;
+
+        DrawCommand command;
+        command.key = ((uint64_t)pass << 60) | (program << 50) | (material << 36) | (depth << 12);
+        command.mesh = mesh;
+        command.shader = shader;
+        command.transform = transform;
+        command.lod = lod;
+        commands.push_back(command);
+        passCounts[pass]++;
+    }
+
+    // LSD radix sort on bytes, skipping the bytes every key has in common; once per frame before submitting
+    void sort()
+    {
+        if(commands.size() < 2)
+            return;
+        scratch.resize(commands.size());
+        uint64_t same = ~0ull;
+        for(unsigned int i = 1; i < commands.size(); i++)
+            same &= ~(commands[i].key ^ commands[0].key);
+
+        for(unsigned int shift = 0; shift < 64; shift += 8)
+        {
+            if(((same >> shift) & 0xff) == 0xff)
+                continue;
+            unsigned int count[256] = {0};
+            for(unsigned int i = 0; i < commands.size(); i++)
+                count[(commands[i].key >> shift) & 0xff]++;
+            unsigned int offset = 0;
+            for(unsigned int b = 0; b < 256; b++)
+            {
+                unsigned int c = count[b];
+                count[b] = offset;
+                offset += c;
+            }
+            for(unsigned int i = 0; i < commands.size(); i++)
+                scratch[count[(commands[i].key >> shift) & 0xff]++] = commands[i];
+            commands.swap(scratch);
+        }
+    }
+
+    // draws the sorted commands of one pass; uniforms other than the model matrix and fade must already be set
+    void submit(RenderPass pass)
+    {
+        unsigned int first = 0;
+        for(int p = 0; p < pass; p++)
+            first += passCounts[p];
+        if(passCounts[pass] == 0)
+            return;
+
+        RenderState& state = RenderState::instance();
+        applyPass(state, pass);
+        Shader* shader = nullptr;
+        unsigned int transform = 0xffffffffu;
+        for(unsigned int i = first; i < first + passCounts[pass]; i++)
+        {
+            const DrawCommand& command = commands[i];
+            if(command.shader != shader)
+            {
+                shader = command.shader;
+                shader->use();
+                transform = 0xffffffffu;
+            }
+            if(command.transform != transform)
+            {
+                transform = command.transform;
+                shader->setModel(transforms[transform]);
+                shader->setLodFadeOut(fades[transform]);
+            }
+            command.mesh->Draw(shader, command.lod);
+        }
+        // leave the default state for whatever draws after the queue
+        if(pass != PASS_OPAQUE)
+            applyPass(state, PASS_OPAQUE);
+    }
+
+    unsigned int size() const
+    {
+        return commands.size();
+    }
+
+    unsigned int count(RenderPass pass) const
+    {
+        return passCounts[pass];
+    }
+
+    // triangles of the selected levels of detail over all queued draws
+    unsigned int getTriangleCount() const
+    {
+        return triangles;
+    }
+private:
+    static const uint64_t DEPTH_MASK = (1ull << 24) - 1;
+    static const uint64_t PROGRAM_MASK = (1ull << 10) - 1;
+    static const uint64_t MATERIAL_MASK = (1ull << 14) - 1;
+
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    float farPlane = 100.0f;
+    float lodScale = 0.0f;
+    Frustum frustum;
+    bool culling = false;
+    unsigned int triangles = 0;
+    std::vector<DrawCommand> commands;
+    std::vector<DrawCommand> scratch;
+    std::vector<glm::mat4> transforms;
+    std::vector<float> fades;
+    unsigned int passCounts[RENDER_PASS_COUNT] = {0};
+    std::unordered_map<Shader*, unsigned int> programs;
+
+    // stable small ids so the program field groups draws; assigned on first sight
+    unsigned int programIndex(Shader* shader)
+    {
+        std::unordered_map<Shader*, unsigned int>::iterator it = programs.find(shader);
+        if(it != programs.end())
+            return it->second;
+        // a variant that has just compiled
+        AllocationScope streaming(SCOPE_STREAMING);
+        unsigned int index = programs.size();
+        programs[shader] = index;
+        return index;
+    }
+
+    static void applyPass(RenderState& state, int pass)
+    {
+        if(pass == PASS_BLENDED)
+        {
+            state.enable(GL_BLEND);
+            state.depthMask(GL_FALSE);
+        }
+        else
+        {
+            state.disable(GL_BLEND);
+            state.depthMask(GL_TRUE);
+        }
+    }
+};
+
+#endif //PROJECT_BASE_RENDERQUEUE_H
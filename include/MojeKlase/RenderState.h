@@ -0,0 +1,292 @@
+#ifndef PROJECT_BASE_RENDERSTATE_H
+#define PROJECT_BASE_RENDERSTATE_H
+
+#include <glad/glad.h>
+
+// Shadow copy of the GL state of the main context. Every bind and enable in the renderer goes through here
+// and is forwarded only when it changes something. Not for the ShaderCompiler context.
+class RenderState
+{
+public:
+    static const unsigned int MAX_TEXTURE_UNITS = 16;
+
+    struct Stats
+    {
+        unsigned int issued = 0;
+        unsigned int skipped = 0;
+    };
+
+    static RenderState& instance()
+    {
+        static RenderState state;
+        return state;
+    }
+
+    // forget everything, e.g. after code that talks to GL directly
+    void invalidate()
+    {
+        for(unsigned int i = 0; i < CAPABILITY_COUNT; i++)
+            capabilities[i] = UNKNOWN;
+        blendSrcRGB = blendDstRGB = blendSrcAlpha = blendDstAlpha = UNKNOWN;
+        blendEquationMode = UNKNOWN;
+        depthMaskValue = UNKNOWN;
+        depthFuncValue = UNKNOWN;
+        cullFaceMode = UNKNOWN;
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        arrayBuffer = UNKNOWN;
+        framebuffer = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for(unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++)
+            texture2D[i] = textureCube[i] = UNKNOWN;
+    }
+
+    void beginFrame()
+    {
+        lastFrame = current;
+        current = Stats();
+    }
+
+    const Stats& getLastFrameStats() const
+    {
+        return lastFrame;
+    }
+
+    void enable(GLenum capability)
+    {
+        setCapability(capability, true);
+    }
+
+    void disable(GLenum capability)
+    {
+        setCapability(capability, false);
+    }
+
+    bool isEnabled(GLenum capability)
+    {
+        unsigned int index = capabilityIndex(capability);
+        // untracked capabilities share one slot, which says nothing about any particular one of them
+        if(index == OTHER_CAPABILITY)
+            return glIsEnabled(capability) == GL_TRUE;
+        unsigned int& value = capabilities[index];
+        if(value == UNKNOWN)
+            value = glIsEnabled(capability) ? 1 : 0;
+        return value == 1;
+    }
+
+    void blendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+    {
+        if(srcRGB == blendSrcRGB && dstRGB == blendDstRGB && srcAlpha == blendSrcAlpha && dstAlpha == blendDstAlpha)
+            return skip();
+        blendSrcRGB = srcRGB;
+        blendDstRGB = dstRGB;
+        blendSrcAlpha = srcAlpha;
+        blendDstAlpha = dstAlpha;
+        issue();
+        glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
+    }
+
+    void blendFunc(GLenum src, GLenum dst)
+    {
+        blendFuncSeparate(src, dst, src, dst);
+    }
+
+    void blendEquation(GLenum mode)
+    {
+        if(change(blendEquationMode, mode))
+            glBlendEquation(mode);
+    }
+
+    void depthMask(GLboolean flag)
+    {
+        if(change(depthMaskValue, flag))
+            glDepthMask(flag);
+    }
+
+    void depthFunc(GLenum func)
+    {
+        if(change(depthFuncValue, func))
+            glDepthFunc(func);
+    }
+
+    void cullFace(GLenum mode)
+    {
+        if(change(cullFaceMode, mode))
+            glCullFace(mode);
+    }
+
+    void useProgram(unsigned int id)
+    {
+        if(change(program, id))
+            glUseProgram(id);
+    }
+
+    void bindVertexArray(unsigned int id)
+    {
+        if(change(vertexArray, id))
+            glBindVertexArray(id);
+    }
+
+    // element array bindings live in the VAO and are always forwarded
+    void bindBuffer(GLenum target, unsigned int id)
+    {
+        if(target == GL_ARRAY_BUFFER)
+        {
+            if(change(arrayBuffer, id))
+                glBindBuffer(target, id);
+            return;
+        }
+        issue();
+        glBindBuffer(target, id);
+    }
+
+    void bindFramebuffer(unsigned int id)
+    {
+        if(change(framebuffer, id))
+            glBindFramebuffer(GL_FRAMEBUFFER, id);
+    }
+
+    void activeTexture(unsigned int unit)
+    {
+        if(change(activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    // binds to a given unit, switching the active unit only when the binding actually changes
+    void bindTexture(unsigned int unit, GLenum target, unsigned int id)
+    {
+        unsigned int* slot = unit < MAX_TEXTURE_UNITS ? textureSlot(unit, target) : nullptr;
+        if(slot && *slot == id)
+            return skip();
+        activeTexture(unit);
+        if(slot)
+            *slot = id;
+        issue();
+        glBindTexture(target, id);
+    }
+
+    // binds to whatever unit is active, for uploads
+    void bindTexture(GLenum target, unsigned int id)
+    {
+        bindTexture(activeUnit == UNKNOWN ? 0 : activeUnit, target, id);
+    }
+
+    // deleted names may be handed out again by GL, so they must not stay cached as bound
+    void programDeleted(unsigned int id)
+    {
+        if(program == id)
+            program = UNKNOWN;
+    }
+
+    void vertexArrayDeleted(unsigned int id)
+    {
+        if(vertexArray == id)
+            vertexArray = UNKNOWN;
+    }
+
+    void bufferDeleted(unsigned int id)
+    {
+        if(arrayBuffer == id)
+            arrayBuffer = UNKNOWN;
+    }
+
+    void framebufferDeleted(unsigned int id)
+    {
+        if(framebuffer == id)
+            framebuffer = UNKNOWN;
+    }
+
+    void textureDeleted(unsigned int id)
+    {
+        for(unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++)
+        {
+            if(texture2D[i] == id)
+                texture2D[i] = UNKNOWN;
+            if(textureCube[i] == id)
+                textureCube[i] = UNKNOWN;
+        }
+    }
+private:
+    static const unsigned int UNKNOWN = 0xffffffffu;
+    enum { DEPTH_TEST, BLEND, CULL_FACE, OTHER_CAPABILITY, CAPABILITY_COUNT };
+
+    unsigned int capabilities[CAPABILITY_COUNT];
+    unsigned int blendSrcRGB, blendDstRGB, blendSrcAlpha, blendDstAlpha;
+    unsigned int blendEquationMode;
+    unsigned int depthMaskValue;
+    unsigned int depthFuncValue;
+    unsigned int cullFaceMode;
+    unsigned int program;
+    unsigned int vertexArray;
+    unsigned int arrayBuffer;
+    unsigned int framebuffer;
+    unsigned int activeUnit;
+    unsigned int texture2D[MAX_TEXTURE_UNITS];
+    unsigned int textureCube[MAX_TEXTURE_UNITS];
+    Stats current;
+    Stats lastFrame;
+
+    RenderState()
+    {
+        invalidate();
+    }
+
+    void issue()
+    {
+        current.issued++;
+    }
+
+    void skip()
+    {
+        current.skipped++;
+    }
+
+    bool change(unsigned int& cached, unsigned int value)
+    {
+        if(cached == value)
+        {
+            skip();
+            return false;
+        }
+        cached = value;
+        issue();
+        return true;
+    }
+
+    static unsigned int capabilityIndex(GLenum capability)
+    {
+        switch(capability)
+        {
+            case GL_DEPTH_TEST: return DEPTH_TEST;
+            case GL_BLEND: return BLEND;
+            case GL_CULL_FACE: return CULL_FACE;
+            default: return OTHER_CAPABILITY;
+        }
+    }
+
+    void setCapability(GLenum capability, bool enabled)
+    {
+        unsigned int index = capabilityIndex(capability);
+        // capabilities we do not track are always forwarded
+        if(index == OTHER_CAPABILITY)
+            capabilities[index] = UNKNOWN;
+        if(change(capabilities[index], enabled ? 1 : 0))
+        {
+            if(enabled)
+                glEnable(capability);
+            else
+                glDisable(capability);
+        }
+    }
+
+    unsigned int* textureSlot(unsigned int unit, GLenum target)
+    {
+        if(target == GL_TEXTURE_2D)
+            return &texture2D[unit];
+        if(target == GL_TEXTURE_CUBE_MAP)
+            return &textureCube[unit];
+        return nullptr;
+    }
+};
+
+#endif //PROJECT_BASE_RENDERSTATE_H
@@ -0,0 +1,174 @@
+#ifndef PROJECT_BASE_SCENEGRAPH_H
+#define PROJECT_BASE_SCENEGRAPH_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// Transform hierarchy with local and world matrices in separate arrays, kept in breadth first order
+// so a parent is always updated before its children in one linear pass. Only nodes whose local
+// transform changed, and everything below them, get their world matrix recomputed.
+// Nodes are addressed by handles that stay valid while the arrays are reordered.
+class SceneGraph
+{
+public:
+    static const unsigned int NO_PARENT = 0xffffffffu;
+
+    unsigned int addNode(const glm::mat4& local, unsigned int parent = NO_PARENT)
+    {
+        unsigned int handle = handleToIndex.size();
+        unsigned int index = parents.size();
+        handleToIndex.push_back(index);
+        handles.push_back(handle);
+        parents.push_back(parent == NO_PARENT ? NO_PARENT : handleToIndex[parent]);
+        depths.push_back(parent == NO_PARENT ? 0 : depths[handleToIndex[parent]] + 1);
+        locals.push_back(local);
+        worlds.push_back(local);
+        dirty.push_back(1);
+        changed.push_back(1);
+        // a child of a node added earlier always lands after it, but deeper levels can interleave
+        if(index > 0 && depths[index] < depths[index - 1])
+            orderDirty = true;
+        return handle;
+    }
+
+    void setLocal(unsigned int handle, const glm::mat4& local)
+    {
+        unsigned int index = handleToIndex[handle];
+        locals[index] = local;
+        dirty[index] = 1;
+    }
+
+    const glm::mat4& getLocal(unsigned int handle) const
+    {
+        return locals[handleToIndex[handle]];
+    }
+
+    // valid after update()
+    const glm::mat4& getWorld(unsigned int handle) const
+    {
+        return worlds[handleToIndex[handle]];
+    }
+
+    // whether the last update() changed this node's world matrix
+    bool worldChanged(unsigned int handle) const
+    {
+        return changed[handleToIndex[handle]] != 0;
+    }
+
+    // recomputes the dirty subtrees, returns how many world matrices were rebuilt
+    unsigned int update()
+    {
+        if(orderDirty)
+            sortBreadthFirst();
+        unsigned int updated = 0;
+        for(unsigned int i = 0; i < locals.size(); i++)
+        {
+            unsigned int parent = parents[i];
+            if(parent != NO_PARENT && changed[parent])
+                dirty[i] = 1;
+            changed[i] = dirty[i];
+            if(!dirty[i])
+                continue;
+            if(parent == NO_PARENT)
+                worlds[i] = locals[i];
+            else
+                multiply(worlds[parent], locals[i], worlds[i]);
+            dirty[i] = 0;
+            updated++;
+        }
+        lastUpdated = updated;
+        return updated;
+    }
+
+    unsigned int size() const
+    {
+        return locals.size();
+    }
+
+    unsigned int getLastUpdated() const
+    {
+        return lastUpdated;
+    }
+
+    // out = a * b, column major like glm
+    static void multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out)
+    {
+#ifdef __SSE__
+        __m128 a0 = _mm_loadu_ps(&a[0][0]);
+        __m128 a1 = _mm_loadu_ps(&a[1][0]);
+        __m128 a2 = _mm_loadu_ps(&a[2][0]);
+        __m128 a3 = _mm_loadu_ps(&a[3][0]);
+        for(int c = 0; c < 4; c++)
+        {
+            __m128 r = _mm_mul_ps(a0, _mm_set1_ps(b[c][0]));
+            r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[c][1])));
+            r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[c][2])));
+            r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[c][3])));
+            _mm_storeu_ps(&out[c][0], r);
+        }
+#else
+        out = a * b;
+#endif
+    }
+private:
+    // all indexed by position in breadth first order
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<unsigned int> parents;
+    std::vector<unsigned int> depths;
+    std::vector<unsigned int> handles;
+    std::vector<uint8_t> dirty;
+    std::vector<uint8_t> changed;
+    // indexed by handle
+    std::vector<unsigned int> handleToIndex;
+    bool orderDirty = false;
+    unsigned int lastUpdated = 0;
+
+    // stable counting sort by depth, then every array is permuted the same way
+    void sortBreadthFirst()
+    {
+        unsigned int n = locals.size();
+        unsigned int maxDepth = 0;
+        for(unsigned int i = 0; i < n; i++)
+            maxDepth = std::max(maxDepth, depths[i]);
+        std::vector<unsigned int> offsets(maxDepth + 2, 0);
+        for(unsigned int i = 0; i < n; i++)
+            offsets[depths[i] + 1]++;
+        for(unsigned int d = 1; d < offsets.size(); d++)
+            offsets[d] += offsets[d - 1];
+        std::vector<unsigned int> newIndex(n);
+        for(unsigned int i = 0; i < n; i++)
+            newIndex[i] = offsets[depths[i]]++;
+
+        permute(locals, newIndex);
+        permute(worlds, newIndex);
+        permute(depths, newIndex);
+        permute(handles, newIndex);
+        permute(dirty, newIndex);
+        permute(changed, newIndex);
+        for(unsigned int i = 0; i < n; i++)
+            if(parents[i] != NO_PARENT)
+                parents[i] = newIndex[parents[i]];
+        permute(parents, newIndex);
+        for(unsigned int i = 0; i < n; i++)
+            handleToIndex[handles[i]] = i;
+        orderDirty = false;
+    }
+
+    template <typename T>
+    static void permute(std::vector<T>& values, const std::vector<unsigned int>& newIndex)
+    {
+        std::vector<T> sorted(values.size());
+        for(unsigned int i = 0; i < values.size(); i++)
+            sorted[newIndex[i]] = values[i];
+        values.swap(sorted);
+    }
+};
+
+#endif //PROJECT_BASE_SCENEGRAPH_H
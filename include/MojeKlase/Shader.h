@@ -4,44 +4,93 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
+#include <MojeKlase/ProgramCache.h>
+#include <MojeKlase/RenderState.h>
+#include <MojeKlase/VirtualFileSystem.h>
 
 #include <string>
 #include <iostream>
-#include <sstream>
-#include <fstream>
+
+// texture unit of every material map, the same in all programs so a program's samplers are set only once
+enum MaterialSlot
+{
+    MATERIAL_SLOT_DIFFUSE = 0,
+    MATERIAL_SLOT_SPECULAR,
+    MATERIAL_SLOT_NORMAL,
+    MATERIAL_SLOT_HEIGHT,
+    MATERIAL_SLOT_OPACITY,
+    MATERIAL_SLOT_COUNT
+};
+
+static const char* const MATERIAL_SAMPLERS[MATERIAL_SLOT_COUNT] = {
+        "material.texture_diffuse1", "material.texture_specular1", "material.texture_normal1",
+        "material.texture_height1", "material.texture_opacity1"
+};
+
+// uniforms that change from one draw to the next, -1 where the program does not have them
+struct DrawUniforms
+{
+    int model = -1;
+    int lodFadeOut = -1;
+    int diffuseColor = -1;
+    int specularColor = -1;
+};
 
 class Shader {
 private:
     int shaderProgram;
+    DrawUniforms drawUniforms;
+    bool drawUniformsResolved = false;
+    unsigned int boundMaterial = 0;     // the Material whose colors the program holds, 0 for none
+
+    // on the first use(), on the render thread: the compiler thread has no say over which program is bound there
+    void resolveDrawUniforms()
+    {
+        drawUniforms.model = glGetUniformLocation(shaderProgram, "model");
+        drawUniforms.lodFadeOut = glGetUniformLocation(shaderProgram, "lodFadeOut");
+        drawUniforms.diffuseColor = glGetUniformLocation(shaderProgram, "material.diffuseColor");
+        drawUniforms.specularColor = glGetUniformLocation(shaderProgram, "material.specularColor");
+        for(unsigned int i = 0; i < MATERIAL_SLOT_COUNT; i++)
+            glUniform1i(glGetUniformLocation(shaderProgram, MATERIAL_SAMPLERS[i]), MATERIAL_SLOT_DIFFUSE + i);
+        drawUniformsResolved = true;
+    }
+
+    static std::string injectDefines(const std::string& code, const std::string& defines)
+    {
+        if(code.compare(0, 8, "#version") != 0)
+            return defines + code;
+        size_t lineEnd = code.find('\n');
+        if(lineEnd == std::string::npos)
+            return code + "\n" + defines;
+        return code.substr(0, lineEnd + 1) + defines + code.substr(lineEnd + 1);
+    }
 public:
-    Shader(const char* vertexPath, const char* fragmentPath)
-    {
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode   = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-        }
-        catch(std::ifstream::failure e)
-        {
+    // defines are inserted right after the #version line of every stage
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string& defines = "")
+    {
+        // straight out of the asset pack or a mapped file, one copy into the strings GL and the cache key need
+        VirtualFileSystem& vfs = VirtualFileSystem::instance();
+        FileData vShaderFile = vfs.read(vertexPath);
+        FileData fShaderFile = vfs.read(fragmentPath);
+        FileData gShaderFile;
+        if(geometryPath != nullptr)
+            gShaderFile = vfs.read(geometryPath);
+        if(!vShaderFile.isValid() || !fShaderFile.isValid() || (geometryPath != nullptr && !gShaderFile.isValid()))
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        std::string vertexCode = vShaderFile.toString();
+        std::string fragmentCode = fShaderFile.toString();
+        std::string geometryCode = gShaderFile.toString();
+        if(!defines.empty())
+        {
+            vertexCode = injectDefines(vertexCode, defines);
+            fragmentCode = injectDefines(fragmentCode, defines);
+            geometryCode = injectDefines(geometryCode, defines);
         }
+        ProgramCache& cache = ProgramCache::instance();
+        std::string cacheKey = cache.key(vertexCode, geometryCode, fragmentCode);
+        if(cache.load(cacheKey, shaderProgram))
+            return;
+
         const char* vertexShaderSource = vertexCode.c_str();
         const char* fragmentShaderSource = fragmentCode.c_str();
 
@@ -67,75 +116,119 @@ public:
             std::cout << "fragment shader compilation failed\n" << msg << std::endl;
         }
 
+        int geometryShader = 0;
+        if(geometryPath != nullptr)
+        {
+            const char* geometryShaderSource = geometryCode.c_str();
+            geometryShader = glCreateShader(GL_GEOMETRY_SHADER);
+            glShaderSource(geometryShader, 1, &geometryShaderSource, NULL);
+            glCompileShader(geometryShader);
+            glGetShaderiv(geometryShader, GL_COMPILE_STATUS, &success);
+            if(!success)
+            {
+                glGetShaderInfoLog(geometryShader, 512, NULL, msg);
+                std::cout << "geometry shader compilation failed\n" << msg << std::endl;
+            }
+        }
+
         shaderProgram = glCreateProgram();
         glAttachShader(shaderProgram, vertexShader);
         glAttachShader(shaderProgram, fragmentShader);
+        if(geometryPath != nullptr)
+            glAttachShader(shaderProgram, geometryShader);
+        cache.prepare(shaderProgram);
         glLinkProgram(shaderProgram);
-        glGetShaderiv(shaderProgram, GL_LINK_STATUS, &success);
+        glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
         if(!success)
         {
-            glGetShaderInfoLog(shaderProgram, 512, NULL, msg);
+            glGetProgramInfoLog(shaderProgram, 512, NULL, msg);
             std::cout << "shader program link failed\n" << msg << std::endl;
         }
+        else
+            cache.store(cacheKey, shaderProgram);
 
         glDeleteShader(vertexShader);
         glDeleteShader(fragmentShader);
+        if(geometryPath != nullptr)
+            glDeleteShader(geometryShader);
     }
     void deleteProgram()
     {
+        RenderState::instance().programDeleted(shaderProgram);
         glDeleteProgram(shaderProgram);
     }
     void use()
     {
-        glUseProgram(shaderProgram);
+        RenderState::instance().useProgram(shaderProgram);
+        if(!drawUniformsResolved)
+            resolveDrawUniforms();
+    }
+    // the per draw setters below need the shader in use, which is also what looks their locations up
+    void setModel(const glm::mat4& model) const
+    {
+        glUniformMatrix4fv(drawUniforms.model, 1, GL_FALSE, &model[0][0]);
+    }
+    void setLodFadeOut(float fade) const
+    {
+        glUniform1f(drawUniforms.lodFadeOut, fade);
+    }
+    // material is Material's id, colors already on the program are not sent again
+    void setMaterialColors(unsigned int material, const glm::vec3& diffuse, const glm::vec3& specular)
+    {
+        if(material == boundMaterial)
+            return;
+        boundMaterial = material;
+        glUniform3fv(drawUniforms.diffuseColor, 1, &diffuse[0]);
+        glUniform3fv(drawUniforms.specularColor, 1, &specular[0]);
     }
-    void setBool(const std::string &name, bool value) const
+    // names are C strings, a std::string built from a literal allocates once it is longer than its inline buffer
+    void setBool(const char* name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(shaderProgram, name.c_str()), (int)value);
+        glUniform1i(glGetUniformLocation(shaderProgram, name), (int)value);
     }
-    void setInt(const std::string &name, int value) const
+    void setInt(const char* name, int value) const
     {
-        glUniform1i(glGetUniformLocation(shaderProgram, name.c_str()), value);
+        glUniform1i(glGetUniformLocation(shaderProgram, name), value);
     }
-    void setFloat(const std::string &name, float value) const
+    void setFloat(const char* name, float value) const
     {
-        glUniform1f(glGetUniformLocation(shaderProgram, name.c_str()), value);
+        glUniform1f(glGetUniformLocation(shaderProgram, name), value);
     }
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(const char* name, const glm::vec2 &value) const
     {
-        glUniform2fv(glGetUniformLocation(shaderProgram, name.c_str()), 1, &value[0]);
+        glUniform2fv(glGetUniformLocation(shaderProgram, name), 1, &value[0]);
     }
-    void setVec2(const std::string &name, float x, float y) const
+    void setVec2(const char* name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(shaderProgram, name.c_str()), x, y);
+        glUniform2f(glGetUniformLocation(shaderProgram, name), x, y);
     }
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(const char* name, const glm::vec3 &value) const
     {
-        glUniform3fv(glGetUniformLocation(shaderProgram, name.c_str()), 1, &value[0]);
+        glUniform3fv(glGetUniformLocation(shaderProgram, name), 1, &value[0]);
     }
-    void setVec3(const std::string &name, float x, float y, float z) const
+    void setVec3(const char* name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(shaderProgram, name.c_str()), x, y, z);
+        glUniform3f(glGetUniformLocation(shaderProgram, name), x, y, z);
     }
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(const char* name, const glm::vec4 &value) const
     {
-        glUniform4fv(glGetUniformLocation(shaderProgram, name.c_str()), 1, &value[0]);
+        glUniform4fv(glGetUniformLocation(shaderProgram, name), 1, &value[0]);
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w)
+    void setVec4(const char* name, float x, float y, float z, float w)
     {
-        glUniform4f(glGetUniformLocation(shaderProgram, name.c_str()), x, y, z, w);
+        glUniform4f(glGetUniformLocation(shaderProgram, name), x, y, z, w);
     }
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat2(const char* name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(shaderProgram, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(glGetUniformLocation(shaderProgram, name), 1, GL_FALSE, &mat[0][0]);
     }
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat3(const char* name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(shaderProgram, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(glGetUniformLocation(shaderProgram, name), 1, GL_FALSE, &mat[0][0]);
     }
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    void setMat4(const char* name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, name), 1, GL_FALSE, &mat[0][0]);
     }
 };
 
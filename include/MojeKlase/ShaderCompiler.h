@@ -0,0 +1,130 @@
+#ifndef PROJECT_BASE_SHADERCOMPILER_H
+#define PROJECT_BASE_SHADERCOMPILER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <MojeKlase/Shader.h>
+
+#include <iostream>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+
+// Compiles and links programs on a worker thread that owns a hidden GL context shared with the main window,
+// so the render thread never waits on the driver. Without a shared context it compiles synchronously.
+class ShaderCompiler
+{
+public:
+    ShaderCompiler(GLFWwindow* mainWindow)
+    {
+        // windows can only be created on the main thread, the worker just makes the context current
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        sharedWindow = glfwCreateWindow(1, 1, "shader compiler", NULL, mainWindow);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if(sharedWindow == NULL)
+        {
+            std::cout << "failed to create a shared context, shaders will compile on the render thread" << std::endl;
+            return;
+        }
+        glfwMakeContextCurrent(mainWindow);
+        worker = std::thread(&ShaderCompiler::run, this);
+    }
+
+    ~ShaderCompiler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        if(worker.joinable())
+            worker.join();
+        // jobs never started resolve to nullptr, so whoever waits on them does not get a broken promise
+        for(unsigned int i = 0; i < jobs.size(); i++)
+            jobs[i].promise.set_value(nullptr);
+        jobs.clear();
+        if(sharedWindow)
+            glfwDestroyWindow(sharedWindow);
+    }
+
+    std::shared_future<Shader*> compile(const std::string& vertexPath, const std::string& fragmentPath,
+                                        const std::string& geometryPath = "", const std::string& defines = "")
+    {
+        Job job;
+        job.vertexPath = vertexPath;
+        job.fragmentPath = fragmentPath;
+        job.geometryPath = geometryPath;
+        job.defines = defines;
+        std::shared_future<Shader*> result = job.promise.get_future().share();
+
+        if(!sharedWindow)
+        {
+            job.promise.set_value(build(job));
+            return result;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+        return result;
+    }
+
+    // the compiled program if it is done, nullptr otherwise; never blocks
+    static Shader* ready(const std::shared_future<Shader*>& program)
+    {
+        if(!program.valid() || program.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return nullptr;
+        return program.get();
+    }
+private:
+    struct Job
+    {
+        std::string vertexPath;
+        std::string fragmentPath;
+        std::string geometryPath;
+        std::string defines;
+        std::promise<Shader*> promise;
+    };
+
+    GLFWwindow* sharedWindow = NULL;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    bool stopping = false;
+
+    static Shader* build(const Job& job)
+    {
+        return new Shader(job.vertexPath.c_str(), job.fragmentPath.c_str(),
+                          job.geometryPath.empty() ? nullptr : job.geometryPath.c_str(), job.defines);
+    }
+
+    void run()
+    {
+        glfwMakeContextCurrent(sharedWindow);
+        for(;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if(stopping)
+                    break;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            Shader* shader = build(job);
+            // the program must be complete before another context uses it
+            glFinish();
+            job.promise.set_value(shader);
+        }
+        glfwMakeContextCurrent(NULL);
+    }
+};
+
+#endif //PROJECT_BASE_SHADERCOMPILER_H
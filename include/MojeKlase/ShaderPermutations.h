@@ -0,0 +1,144 @@
+#ifndef PROJECT_BASE_SHADERPERMUTATIONS_H
+#define PROJECT_BASE_SHADERPERMUTATIONS_H
+
+#include <MojeKlase/Shader.h>
+#include <MojeKlase/Mesh.h>
+#include <MojeKlase/ShaderCompiler.h>
+#include <MojeKlase/AllocationTracker.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <future>
+
+// Compiles #define specialized variants of one vertex/fragment pair on first use and caches them by feature key.
+// With a ShaderCompiler the variants build in the background and get() hands out the featureless
+// fallback variant until the requested one is ready.
+class ShaderPermutations
+{
+public:
+    ShaderPermutations(const char* vertexPath, const char* fragmentPath, ShaderCompiler* compiler = nullptr)
+    {
+        this->vertexPath = vertexPath;
+        this->fragmentPath = fragmentPath;
+        this->compiler = compiler;
+        if(compiler)
+            fallback = add(0, new Shader(vertexPath, fragmentPath, nullptr, defines(0)));
+    }
+
+    ~ShaderPermutations()
+    {
+        // variants still compiling would leak their program; waits for the compiler to finish them,
+        // or gets nullptr for the ones a compiler that is already gone never started
+        for(std::unordered_map<unsigned int, std::shared_future<Shader*>>::iterator it = pending.begin(); it != pending.end(); ++it)
+        {
+            Shader* shader = it->second.valid() ? it->second.get() : nullptr;
+            if(shader)
+            {
+                shader->deleteProgram();
+                delete shader;
+            }
+        }
+        for(unsigned int i = 0; i < variants.size(); i++)
+        {
+            variants[i]->deleteProgram();
+            delete variants[i];
+        }
+    }
+
+    Shader* get(unsigned int features)
+    {
+        std::unordered_map<unsigned int, Shader*>::iterator it = cache.find(features);
+        if(it != cache.end())
+            return it->second;
+
+        AllocationScope streaming(SCOPE_STREAMING);
+        if(compiler)
+        {
+            if(pending.find(features) == pending.end())
+                pending[features] = compiler->compile(vertexPath, fragmentPath, "", defines(features));
+            return fallback;
+        }
+        std::cout << "compiling " << fragmentPath << " permutation " << features << std::endl;
+        return add(features, new Shader(vertexPath.c_str(), fragmentPath.c_str(), nullptr, defines(features)));
+    }
+
+    // true once the exact variant exists, get() may still be handing out the fallback
+    bool has(unsigned int features) const
+    {
+        return cache.find(features) != cache.end();
+    }
+
+    // picks up variants the compiler has finished; call once per frame before setting uniforms
+    void poll()
+    {
+        std::unordered_map<unsigned int, std::shared_future<Shader*>>::iterator it = pending.begin();
+        while(it != pending.end())
+        {
+            Shader* shader = ShaderCompiler::ready(it->second);
+            if(shader)
+            {
+                AllocationScope streaming(SCOPE_STREAMING);
+                add(it->first, shader);
+                it = pending.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+
+    // runs once for every variant, now and for each one compiled later (sampler units and other static uniforms)
+    void setInitializer(const std::function<void(Shader*)>& initializer)
+    {
+        this->initializer = initializer;
+        reinitialize();
+    }
+
+    void reinitialize()
+    {
+        if(!initializer)
+            return;
+        for(unsigned int i = 0; i < variants.size(); i++)
+            initializer(variants[i]);
+    }
+
+    const std::vector<Shader*>& getVariants() const
+    {
+        return variants;
+    }
+
+    static std::string defines(unsigned int features)
+    {
+        static const char* names[MATERIAL_FEATURE_COUNT] = {
+                "HAS_DIFFUSE_MAP", "HAS_SPECULAR_MAP", "HAS_NORMAL_MAP", "HAS_HEIGHT_MAP", "HAS_OPACITY_MAP",
+                "ALPHA_CUTOUT", "WEIGHTED_OIT", "INSTANCED"
+        };
+        std::string result;
+        for(unsigned int i = 0; i < MATERIAL_FEATURE_COUNT; i++)
+            if(features & (1u << i))
+                result += std::string("#define ") + names[i] + "\n";
+        return result;
+    }
+private:
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::unordered_map<unsigned int, Shader*> cache;
+    std::vector<Shader*> variants;
+    std::function<void(Shader*)> initializer;
+    ShaderCompiler* compiler;
+    Shader* fallback = nullptr;
+    std::unordered_map<unsigned int, std::shared_future<Shader*>> pending;
+
+    Shader* add(unsigned int features, Shader* shader)
+    {
+        cache[features] = shader;
+        variants.push_back(shader);
+        if(initializer)
+            initializer(shader);
+        return shader;
+    }
+};
+
+#endif //PROJECT_BASE_SHADERPERMUTATIONS_H
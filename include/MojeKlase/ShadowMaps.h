@@ -0,0 +1,365 @@
+#ifndef PROJECT_BASE_SHADOWMAPS_H
+#define PROJECT_BASE_SHADOWMAPS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <MojeKlase/Shader.h>
+#include <MojeKlase/Model.h>
+#include <MojeKlase/Lights.h>
+#include <MojeKlase/RenderState.h>
+#include <MojeKlase/GpuMemory.h>
+#include <MojeKlase/Arena.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cfloat>
+
+const unsigned int SHADOW_MAP_TEXTURE_UNIT = 8;
+const unsigned int POINT_SHADOW_TEXTURE_UNIT = 9;   // one unit per point light from here on
+const unsigned int MAX_POINT_SHADOWS = 2;           // matches pointShadowMaps[] in shader.fs
+
+// Directional and omnidirectional shadow maps that are only re-rendered when they are invalidated:
+// a light changes, or a shadow caster inside the light's range is added or moved.
+// A static scene renders every map exactly once.
+class ShadowMaps
+{
+public:
+    ShadowMaps(unsigned int dirResolution = 2048, unsigned int pointResolution = 512)
+    {
+        this->dirResolution = dirResolution;
+        this->pointResolution = pointResolution;
+        dirDepthShader = new Shader("resources/shaders/shadowDepth.vs", "resources/shaders/shadowDepth.fs");
+        pointDepthShader = new Shader("resources/shaders/pointShadowDepth.vs", "resources/shaders/pointShadowDepth.fs",
+                                      "resources/shaders/pointShadowDepth.gs");
+
+        glGenFramebuffers(1, &dirShadow.FBO);
+        glGenTextures(1, &dirShadow.depthMap);
+        RenderState::instance().bindTexture(GL_TEXTURE_2D, dirShadow.depthMap);
+        GpuMemory::instance().texImage2D(GL_TEXTURE_2D, dirShadow.depthMap, 0, GL_DEPTH_COMPONENT24, dirResolution, dirResolution,
+                                         GL_DEPTH_COMPONENT, GL_FLOAT, NULL, GPU_RENDER_TARGET);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        float border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+        attachDepth(dirShadow.FBO, dirShadow.depthMap);
+    }
+
+    ~ShadowMaps()
+    {
+        RenderState& state = RenderState::instance();
+        state.framebufferDeleted(dirShadow.FBO);
+        glDeleteFramebuffers(1, &dirShadow.FBO);
+        GpuMemory::instance().deleteTexture(dirShadow.depthMap);
+        for(unsigned int i = 0; i < pointShadows.size(); i++)
+        {
+            state.framebufferDeleted(pointShadows[i].FBO);
+            glDeleteFramebuffers(1, &pointShadows[i].FBO);
+            GpuMemory::instance().deleteTexture(pointShadows[i].depthMap);
+        }
+        dirDepthShader->deleteProgram();
+        pointDepthShader->deleteProgram();
+        delete dirDepthShader;
+        delete pointDepthShader;
+    }
+
+    unsigned int addCaster(Model* model, const glm::mat4& transform)
+    {
+        Caster caster;
+        caster.model = model;
+        caster.transform = transform;
+        worldBounds(model, transform, caster.boundsMin, caster.boundsMax);
+        casters.push_back(caster);
+        invalidateRegion(caster.boundsMin, caster.boundsMax);
+        return casters.size() - 1;
+    }
+
+    void setCasterTransform(unsigned int caster, const glm::mat4& transform)
+    {
+        Caster& c = casters[caster];
+        if(c.transform == transform)
+            return;
+        // both where it was and where it is now may have changed
+        invalidateRegion(c.boundsMin, c.boundsMax);
+        c.transform = transform;
+        worldBounds(c.model, transform, c.boundsMin, c.boundsMax);
+        invalidateRegion(c.boundsMin, c.boundsMax);
+    }
+
+    void setDirLight(const DirLightParams& light)
+    {
+        if(dirShadow.initialized && dirShadow.direction == light.direction)
+            return;
+        dirShadow.direction = light.direction;
+        dirShadow.initialized = true;
+        dirShadow.dirty = true;
+    }
+
+    void setPointLight(unsigned int index, const glm::vec3& position, const PointLightParams& light)
+    {
+        if(index >= MAX_POINT_SHADOWS)
+            return;
+        while(pointShadows.size() <= index)
+            pointShadows.push_back(createPointShadow());
+
+        float farPlane = lightRange(light);
+        PointShadow& shadow = pointShadows[index];
+        if(shadow.initialized && shadow.position == position && shadow.farPlane == farPlane)
+            return;
+        shadow.position = position;
+        shadow.farPlane = farPlane;
+        shadow.initialized = true;
+        shadow.dirty = true;
+    }
+
+    // re-renders only the invalidated maps; returns how many were rendered
+    unsigned int update()
+    {
+        unsigned int rendered = 0;
+        bool anyDirty = dirShadow.dirty;
+        for(unsigned int i = 0; i < pointShadows.size(); i++)
+            anyDirty = anyDirty || pointShadows[i].dirty;
+        if(!anyDirty)
+        {
+            lastRenderCount = 0;
+            return 0;
+        }
+
+        int viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        RenderState& state = RenderState::instance();
+        bool cullFace = state.isEnabled(GL_CULL_FACE);
+        state.disable(GL_CULL_FACE);
+
+        if(dirShadow.dirty && dirShadow.initialized)
+        {
+            renderDirShadow();
+            rendered++;
+        }
+        for(unsigned int i = 0; i < pointShadows.size(); i++)
+        {
+            if(pointShadows[i].dirty && pointShadows[i].initialized)
+            {
+                renderPointShadow(pointShadows[i]);
+                rendered++;
+            }
+        }
+
+        state.bindFramebuffer(0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        if(cullFace)
+            state.enable(GL_CULL_FACE);
+
+        lastRenderCount = rendered;
+        totalRenderCount += rendered;
+        return rendered;
+    }
+
+    // binds the maps to their fixed units
+    void bindTextures() const
+    {
+        RenderState& state = RenderState::instance();
+        state.bindTexture(SHADOW_MAP_TEXTURE_UNIT, GL_TEXTURE_2D, dirShadow.depthMap);
+        for(unsigned int i = 0; i < pointShadows.size(); i++)
+            state.bindTexture(POINT_SHADOW_TEXTURE_UNIT + i, GL_TEXTURE_CUBE_MAP, pointShadows[i].depthMap);
+    }
+
+    // sampling uniforms of the lit shader, which must be in use
+    void setUniforms(Shader* shader) const
+    {
+        shader->setMat4("lightSpaceMatrix", dirShadow.lightSpaceMatrix);
+        for(unsigned int i = 0; i < pointShadows.size(); i++)
+            shader->setFloat(FrameAllocator::instance().format("pointShadowFar[%u]", i), pointShadows[i].farPlane);
+    }
+
+    // sampler units never change, so they are set once after the lit shader is created
+    void setSamplerUnits(Shader* shader) const
+    {
+        shader->use();
+        shader->setInt("shadowMap", SHADOW_MAP_TEXTURE_UNIT);
+        for(unsigned int i = 0; i < MAX_POINT_SHADOWS; i++)
+            shader->setInt(FrameAllocator::instance().format("pointShadowMaps[%u]", i), POINT_SHADOW_TEXTURE_UNIT + i);
+        shader->setBool("useShadows", true);
+    }
+
+    unsigned int getLastRenderCount() const
+    {
+        return lastRenderCount;
+    }
+
+    unsigned int getTotalRenderCount() const
+    {
+        return totalRenderCount;
+    }
+private:
+    struct Caster
+    {
+        Model* model;
+        glm::mat4 transform;
+        glm::vec3 boundsMin, boundsMax;
+    };
+
+    struct DirShadow
+    {
+        unsigned int FBO = 0, depthMap = 0;
+        glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+        glm::mat4 lightSpaceMatrix = glm::mat4(1.0f);
+        bool initialized = false;
+        bool dirty = true;
+    };
+
+    struct PointShadow
+    {
+        unsigned int FBO = 0, depthMap = 0;
+        glm::vec3 position = glm::vec3(0.0f);
+        float farPlane = 1.0f;
+        bool initialized = false;
+        bool dirty = true;
+    };
+
+    unsigned int dirResolution, pointResolution;
+    Shader* dirDepthShader;
+    Shader* pointDepthShader;
+    DirShadow dirShadow;
+    std::vector<PointShadow> pointShadows;
+    std::vector<Caster> casters;
+    unsigned int lastRenderCount = 0;
+    unsigned int totalRenderCount = 0;
+
+    static void attachDepth(unsigned int FBO, unsigned int depthMap)
+    {
+        RenderState::instance().bindFramebuffer(FBO);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthMap, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "shadow map framebuffer is not complete" << std::endl;
+        RenderState::instance().bindFramebuffer(0);
+    }
+
+    PointShadow createPointShadow()
+    {
+        PointShadow shadow;
+        glGenFramebuffers(1, &shadow.FBO);
+        glGenTextures(1, &shadow.depthMap);
+        RenderState::instance().bindTexture(GL_TEXTURE_CUBE_MAP, shadow.depthMap);
+        for(unsigned int face = 0; face < 6; face++)
+            GpuMemory::instance().texImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, shadow.depthMap, 0, GL_DEPTH_COMPONENT24,
+                                             pointResolution, pointResolution, GL_DEPTH_COMPONENT, GL_FLOAT, NULL, GPU_RENDER_TARGET);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        attachDepth(shadow.FBO, shadow.depthMap);
+        return shadow;
+    }
+
+    // distance at which the light falls below 1/256 of its diffuse intensity
+    static float lightRange(const PointLightParams& light)
+    {
+        float brightest = std::max(light.diffuse.x, std::max(light.diffuse.y, light.diffuse.z));
+        float c = light.constant - 256.0f * brightest;
+        if(c >= 0.0f)
+            return 0.1f;
+        if(light.quadratic <= 0.0f)
+            return light.linear > 0.0f ? -c / light.linear : 100.0f;
+        return (-light.linear + std::sqrt(light.linear*light.linear - 4.0f*light.quadratic*c)) / (2.0f*light.quadratic);
+    }
+
+    static void worldBounds(Model* model, const glm::mat4& transform, glm::vec3& outMin, glm::vec3& outMax)
+    {
+        const glm::vec3& bmin = model->getBoundsMin();
+        const glm::vec3& bmax = model->getBoundsMax();
+        outMin = glm::vec3(FLT_MAX);
+        outMax = glm::vec3(-FLT_MAX);
+        for(int i = 0; i < 8; i++)
+        {
+            glm::vec3 corner(i & 1 ? bmax.x : bmin.x, i & 2 ? bmax.y : bmin.y, i & 4 ? bmax.z : bmin.z);
+            glm::vec3 p = glm::vec3(transform * glm::vec4(corner, 1.0f));
+            outMin = glm::min(outMin, p);
+            outMax = glm::max(outMax, p);
+        }
+    }
+
+    void invalidateRegion(const glm::vec3& bmin, const glm::vec3& bmax)
+    {
+        // the directional light reaches everything
+        dirShadow.dirty = true;
+        for(unsigned int i = 0; i < pointShadows.size(); i++)
+        {
+            PointShadow& shadow = pointShadows[i];
+            glm::vec3 closest = glm::clamp(shadow.position, bmin, bmax);
+            if(glm::length(closest - shadow.position) <= shadow.farPlane)
+                shadow.dirty = true;
+        }
+    }
+
+    void drawCasters(Shader* depthShader)
+    {
+        for(unsigned int i = 0; i < casters.size(); i++)
+        {
+            depthShader->setModel(casters[i].transform);
+            casters[i].model->Draw(depthShader);
+        }
+    }
+
+    void renderDirShadow()
+    {
+        // fit an orthographic frustum around every caster
+        glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+        for(unsigned int i = 0; i < casters.size(); i++)
+        {
+            bmin = glm::min(bmin, casters[i].boundsMin);
+            bmax = glm::max(bmax, casters[i].boundsMax);
+        }
+        if(casters.empty())
+            bmin = bmax = glm::vec3(0.0f);
+        glm::vec3 center = (bmin + bmax) * 0.5f;
+        float radius = std::max(glm::length(bmax - bmin) * 0.5f, 0.01f);
+        glm::vec3 direction = glm::normalize(dirShadow.direction);
+        glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 view = glm::lookAt(center - direction * radius * 2.0f, center, up);
+        glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, radius * 0.5f, radius * 3.5f);
+        dirShadow.lightSpaceMatrix = projection * view;
+
+        glViewport(0, 0, dirResolution, dirResolution);
+        RenderState::instance().bindFramebuffer(dirShadow.FBO);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        dirDepthShader->use();
+        dirDepthShader->setMat4("lightSpaceMatrix", dirShadow.lightSpaceMatrix);
+        drawCasters(dirDepthShader);
+        dirShadow.dirty = false;
+    }
+
+    void renderPointShadow(PointShadow& shadow)
+    {
+        const glm::vec3& p = shadow.position;
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, shadow.farPlane);
+        glm::mat4 faces[6] = {
+                projection * glm::lookAt(p, p + glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
+                projection * glm::lookAt(p, p + glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
+                projection * glm::lookAt(p, p + glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f)),
+                projection * glm::lookAt(p, p + glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f, -1.0f)),
+                projection * glm::lookAt(p, p + glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
+                projection * glm::lookAt(p, p + glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f))
+        };
+
+        glViewport(0, 0, pointResolution, pointResolution);
+        RenderState::instance().bindFramebuffer(shadow.FBO);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        pointDepthShader->use();
+        for(unsigned int i = 0; i < 6; i++)
+            pointDepthShader->setMat4(FrameAllocator::instance().format("shadowMatrices[%u]", i), faces[i]);
+        pointDepthShader->setVec3("lightPos", p);
+        pointDepthShader->setFloat("farPlane", shadow.farPlane);
+        drawCasters(pointDepthShader);
+        shadow.dirty = false;
+    }
+};
+
+#endif //PROJECT_BASE_SHADOWMAPS_H
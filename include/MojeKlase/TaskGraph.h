@@ -0,0 +1,208 @@
+#ifndef PROJECT_BASE_TASKGRAPH_H
+#define PROJECT_BASE_TASKGRAPH_H
+
+#include <MojeKlase/JobSystem.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+// Tasks with dependencies, run once. Tasks that need the GL context run on the thread that calls run(),
+// in the order they were added when several are ready; the rest are JobSystem jobs and overlap with them.
+// Every task is timed so printTimeline() can show what ran in parallel and which chain of tasks held up the end.
+class TaskGraph
+{
+public:
+    // returns the id to list in the dependencies of later tasks
+    unsigned int add(const std::string& name, std::function<void()> function,
+                     const std::vector<unsigned int>& dependencies = std::vector<unsigned int>(), bool onMainThread = false)
+    {
+        Task* task = new Task();
+        task->name = name;
+        task->function = std::move(function);
+        task->dependencies = dependencies;
+        task->onMainThread = onMainThread;
+        tasks.push_back(task);
+        return tasks.size() - 1;
+    }
+
+    unsigned int addMain(const std::string& name, std::function<void()> function,
+                         const std::vector<unsigned int>& dependencies = std::vector<unsigned int>())
+    {
+        return add(name, std::move(function), dependencies, true);
+    }
+
+    ~TaskGraph()
+    {
+        for(unsigned int i = 0; i < tasks.size(); i++)
+            delete tasks[i];
+    }
+
+    void run()
+    {
+        JobSystem& jobs = JobSystem::instance();
+        JobCounter counter;
+        start = std::chrono::steady_clock::now();
+        unsigned int finished = 0;
+        while(finished < tasks.size())
+        {
+            finished = 0;
+            Task* mainTask = nullptr;
+            bool running = false;
+            for(unsigned int i = 0; i < tasks.size(); i++)
+            {
+                Task* task = tasks[i];
+                if(task->done.load(std::memory_order_acquire))
+                {
+                    finished++;
+                    continue;
+                }
+                if(task->started)
+                {
+                    running = true;
+                    continue;
+                }
+                if(!ready(*task))
+                    continue;
+                if(task->onMainThread)
+                {
+                    if(!mainTask)
+                        mainTask = task;
+                    continue;
+                }
+                task->started = true;
+                running = true;
+                jobs.run([this, task]() { execute(*task); }, &counter);
+            }
+            if(mainTask)
+            {
+                mainTask->started = true;
+                execute(*mainTask);
+            }
+            else if(finished < tasks.size())
+            {
+                if(!running)
+                {
+                    std::cout << "task graph: dependency cycle or a missing task, " << tasks.size() - finished
+                              << " tasks cannot run" << std::endl;
+                    break;
+                }
+                // help with jobs instead of spinning until a task finishes
+                if(!jobs.runOne())
+                    std::this_thread::yield();
+            }
+        }
+        jobs.wait(counter);
+        end = std::chrono::steady_clock::now();
+    }
+
+    // one bar per task on a shared time axis, '#' on the main thread, '=' on jobs; '*' marks the critical path
+    void printTimeline() const
+    {
+        const unsigned int WIDTH = 60;
+        double total = milliseconds(end);
+        std::vector<bool> critical(tasks.size(), false);
+        markCriticalPath(critical);
+
+        std::vector<unsigned int> order(tasks.size());
+        for(unsigned int i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) {
+            return tasks[a]->begin < tasks[b]->begin;
+        });
+
+        double serial = 0.0;
+        std::cout << "startup timeline, " << std::fixed << std::setprecision(1) << total << " ms" << std::defaultfloat
+                  << " on " << JobSystem::instance().getWorkerCount() << " workers" << std::endl;
+        for(unsigned int o = 0; o < order.size(); o++)
+        {
+            const Task* task = tasks[order[o]];
+            double begin = milliseconds(task->begin), finish = milliseconds(task->end);
+            serial += finish - begin;
+            unsigned int first = total > 0.0 ? (unsigned int)(begin / total * WIDTH) : 0;
+            unsigned int last = total > 0.0 ? (unsigned int)(finish / total * WIDTH) : 0;
+            std::string bar(WIDTH + 1, ' ');
+            for(unsigned int c = first; c <= std::min(last, WIDTH); c++)
+                bar[c] = task->onMainThread ? '#' : '=';
+            std::cout << (critical[order[o]] ? "* " : "  ") << std::left << std::setw(24) << task->name << std::right
+                      << " |" << bar << "| " << std::fixed << std::setprecision(1) << std::setw(7) << begin
+                      << " +" << std::setw(7) << finish - begin << " ms" << std::defaultfloat << std::endl;
+        }
+        std::cout << "the tasks take " << std::fixed << std::setprecision(1) << serial << " ms one after another"
+                  << std::defaultfloat << std::endl;
+    }
+private:
+    struct Task
+    {
+        std::string name;
+        std::function<void()> function;
+        std::vector<unsigned int> dependencies;
+        bool onMainThread = false;
+        bool started = false;                   // only touched by the thread running the graph
+        std::atomic<bool> done;
+        std::chrono::steady_clock::time_point begin;
+        std::chrono::steady_clock::time_point end;
+
+        Task() : done(false) {}
+    };
+
+    std::vector<Task*> tasks;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+
+    bool ready(const Task& task) const
+    {
+        for(unsigned int d = 0; d < task.dependencies.size(); d++)
+            if(task.dependencies[d] >= tasks.size() || !tasks[task.dependencies[d]]->done.load(std::memory_order_acquire))
+                return false;
+        return true;
+    }
+
+    void execute(Task& task)
+    {
+        task.begin = std::chrono::steady_clock::now();
+        task.function();
+        task.end = std::chrono::steady_clock::now();
+        task.done.store(true, std::memory_order_release);
+    }
+
+    double milliseconds(std::chrono::steady_clock::time_point time) const
+    {
+        return std::chrono::duration<double, std::milli>(time - start).count();
+    }
+
+    // from the task that finished last back through the dependency each one waited for longest; main thread
+    // tasks also wait for the main thread task before them, which counts as a dependency here
+    void markCriticalPath(std::vector<bool>& critical) const
+    {
+        int current = -1;
+        for(unsigned int i = 0; i < tasks.size(); i++)
+            if(current < 0 || tasks[i]->end > tasks[current]->end)
+                current = i;
+        while(current >= 0)
+        {
+            critical[current] = true;
+            const Task* task = tasks[current];
+            int previous = -1;
+            std::vector<unsigned int> candidates = task->dependencies;
+            if(task->onMainThread)
+                for(unsigned int i = 0; i < tasks.size(); i++)
+                    if(tasks[i]->onMainThread && tasks[i]->end <= task->begin)
+                        candidates.push_back(i);
+            for(unsigned int c = 0; c < candidates.size(); c++)
+            {
+                unsigned int d = candidates[c];
+                if(d < tasks.size() && tasks[d]->end <= task->begin && (previous < 0 || tasks[d]->end > tasks[previous]->end))
+                    previous = d;
+            }
+            current = previous;
+        }
+    }
+};
+
+#endif //PROJECT_BASE_TASKGRAPH_H
@@ -0,0 +1,116 @@
+#ifndef PROJECT_BASE_TEXTUREALPHA_H
+#define PROJECT_BASE_TEXTUREALPHA_H
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// how a material's opacity map has to be rendered
+enum AlphaMode
+{
+    ALPHA_OPAQUE,   // every texel fully opaque, the map can be ignored
+    ALPHA_CUTOUT,   // only fully opaque and fully transparent texels, alpha test without blending
+    ALPHA_BLENDED   // real translucency, needs the blended pass
+};
+
+// Classifies an 8 bit opacity map the way shader.fs reads it: opacity is the mean of r, g and b
+// (missing channels read as 0), alpha is ignored. Large maps are split across threads.
+class TextureAlpha
+{
+public:
+    static AlphaMode classify(const unsigned char* data, int width, int height, int channels)
+    {
+        // a red or red/green map samples with b = 0 and never reaches full opacity
+        if(channels != 3 && channels != 4)
+            return ALPHA_BLENDED;
+        size_t pixels = (size_t)width * height;
+        unsigned int threads = 1;
+        if(pixels >= PIXELS_PER_THREAD * 2)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+            threads = (unsigned int)std::min<size_t>(threads, pixels / PIXELS_PER_THREAD);
+        }
+
+        std::vector<Flags> results(threads);
+        std::vector<std::thread> workers;
+        size_t chunk = (pixels + threads - 1) / threads;
+        for(unsigned int t = 1; t < threads; t++)
+        {
+            size_t begin = std::min(pixels, chunk * t);
+            size_t end = std::min(pixels, begin + chunk);
+            workers.push_back(std::thread([=, &results]() {
+                results[t] = scan(data + begin * channels, end - begin, channels);
+            }));
+        }
+        results[0] = scan(data, std::min(pixels, chunk), channels);
+        for(unsigned int t = 0; t < workers.size(); t++)
+            workers[t].join();
+
+        Flags flags;
+        for(unsigned int t = 0; t < threads; t++)
+        {
+            flags.notFull = flags.notFull || results[t].notFull;
+            flags.partial = flags.partial || results[t].partial;
+        }
+        if(!flags.notFull)
+            return ALPHA_OPAQUE;
+        return flags.partial ? ALPHA_BLENDED : ALPHA_CUTOUT;
+    }
+private:
+    static const size_t PIXELS_PER_THREAD = 1 << 18;
+
+    struct Flags
+    {
+        bool notFull = false;   // some texel is below full opacity
+        bool partial = false;   // some texel is neither fully opaque nor fully transparent
+    };
+
+    static Flags scan(const unsigned char* data, size_t pixels, int channels)
+    {
+        if(channels == 4)
+            return scanRGBA(data, pixels);
+        Flags flags;
+        for(size_t i = 0; i < pixels; i++)
+            classifyTexel(flags, data[i * 3], data[i * 3 + 1], data[i * 3 + 2]);
+        return flags;
+    }
+
+    static void classifyTexel(Flags& flags, unsigned char r, unsigned char g, unsigned char b)
+    {
+        bool full = r == 255 && g == 255 && b == 255;
+        bool empty = r == 0 && g == 0 && b == 0;
+        flags.notFull = flags.notFull || !full;
+        flags.partial = flags.partial || (!full && !empty);
+    }
+
+    // one 32 bit lane per texel with alpha masked off, so a lane compare checks r, g and b together
+    static Flags scanRGBA(const unsigned char* data, size_t pixels)
+    {
+        Flags flags;
+        size_t i = 0;
+#ifdef __SSE2__
+        __m128i rgb = _mm_set1_epi32(0x00ffffff);
+        __m128i zero = _mm_setzero_si128();
+        __m128i notFull = zero;
+        __m128i partial = zero;
+        for(; i + 4 <= pixels; i += 4)
+        {
+            __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)(data + i * 4)), rgb);
+            __m128i full = _mm_cmpeq_epi32(v, rgb);
+            __m128i empty = _mm_cmpeq_epi32(v, zero);
+            notFull = _mm_or_si128(notFull, _mm_andnot_si128(full, rgb));
+            partial = _mm_or_si128(partial, _mm_andnot_si128(_mm_or_si128(full, empty), rgb));
+        }
+        flags.notFull = _mm_movemask_epi8(notFull) != 0;
+        flags.partial = _mm_movemask_epi8(partial) != 0;
+#endif
+        for(; i < pixels; i++)
+            classifyTexel(flags, data[i * 4], data[i * 4 + 1], data[i * 4 + 2]);
+        return flags;
+    }
+};
+
+#endif //PROJECT_BASE_TEXTUREALPHA_H
@@ -0,0 +1,535 @@
+#ifndef PROJECT_BASE_TEXTURESTREAMING_H
+#define PROJECT_BASE_TEXTURESTREAMING_H
+
+#include <glad/glad.h>
+#include <MojeKlase/RenderState.h>
+#include <MojeKlase/GpuMemory.h>
+#include <MojeKlase/TextureAlpha.h>
+#include <MojeKlase/VirtualFileSystem.h>
+#include <MojeKlase/JobSystem.h>
+#include <MojeKlase/Arena.h>
+#include <MojeKlase/AllocationTracker.h>
+#include <stb_image.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+// levels this small or smaller are always resident, so every texture can be sampled from the first frame
+const int STREAM_TAIL_SIZE = 64;
+// upload cap per update(), keeps a burst of newly visible textures from stalling one frame
+const unsigned int STREAM_UPLOAD_BYTES_PER_FRAME = 4 * 1024 * 1024;
+
+// Mip residency for material textures. The whole mip chain stays in system memory, the GPU only holds
+// levels from the texture's GL_TEXTURE_BASE_LEVEL down. Draws report how many UV units one pixel covers
+// (RenderQueue, from the mesh's UV density and its distance), which gives the finest level worth having.
+// update() streams missing levels in and, above the memory budget, drops the finest levels of the
+// least recently used textures, surplus levels first.
+// Textures added with addLazy() are not even decoded until a draw first asks for them: a flat 1x1
+// placeholder is sampled meanwhile, a background job decodes the file and builds the mips, and the
+// next update() installs the result like add() would.
+class TextureStreamer
+{
+public:
+    struct Stats
+    {
+        unsigned int textures = 0;
+        size_t residentBytes = 0;
+        size_t budgetBytes = 0;
+        size_t uploadedBytes = 0;   // last update()
+        size_t evictedBytes = 0;    // last update()
+        unsigned int unloaded = 0;  // lazy ones no draw has asked for yet
+        unsigned int decoding = 0;
+    };
+
+    static TextureStreamer& instance()
+    {
+        static TextureStreamer streamer;
+        return streamer;
+    }
+
+    void setBudget(size_t bytes)
+    {
+        budget = bytes;
+    }
+
+    // takes over the texture: builds the mip chain on the CPU and uploads only the tail, bound to the active unit
+    void add(unsigned int id, const unsigned char* data, int width, int height, int channels, const std::string& name)
+    {
+        StreamedTexture texture;
+        texture.id = id;
+        texture.name = name;
+        texture.channels = channels;
+        texture.format = formatOf(channels);
+        buildMips(texture, data, width, height);
+        install(texture);
+
+        lookup[id] = textures.size();
+        textures.push_back(texture);
+    }
+
+    // takes over the texture without reading the file: placeholder, one RGBA texel, is all the GPU holds
+    // until a request() decodes path. Opacity maps are classified then, see getAlpha().
+    void addLazy(unsigned int id, const std::string& path, const unsigned char placeholder[4], bool opacity)
+    {
+        StreamedTexture texture;
+        texture.id = id;
+        texture.name = path;
+        texture.channels = 4;
+        texture.format = GL_RGBA;
+        texture.tail = 0;
+        texture.resident = 0;
+        texture.wanted = 0;
+        texture.requested = NOT_REQUESTED;
+        texture.state = TEXTURE_UNLOADED;
+        texture.opacity = opacity;
+
+        RenderState::instance().bindTexture(GL_TEXTURE_2D, id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        GpuMemory::instance().texImage2D(GL_TEXTURE_2D, id, 0, GL_RGBA, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, placeholder,
+                                         GPU_TEXTURE);
+
+        lookup[id] = textures.size();
+        textures.push_back(texture);
+    }
+
+    // starts decoding a lazy texture without asking for any detail beyond the tail
+    void load(unsigned int id)
+    {
+        std::unordered_map<unsigned int, unsigned int>::iterator it = lookup.find(id);
+        if(it != lookup.end() && textures[it->second].state == TEXTURE_UNLOADED)
+            queueDecode(textures[it->second]);
+    }
+
+    // true once a lazy texture is decoded or has failed, also for ones that were never lazy
+    bool isLoaded(unsigned int id) const
+    {
+        std::unordered_map<unsigned int, unsigned int>::const_iterator it = lookup.find(id);
+        return it == lookup.end() || (textures[it->second].state != TEXTURE_UNLOADED && textures[it->second].state != TEXTURE_DECODING);
+    }
+
+    // false until the texture is decoded, alpha is the opacity map classification after that
+    bool getAlpha(unsigned int id, AlphaMode& alpha) const
+    {
+        std::unordered_map<unsigned int, unsigned int>::const_iterator it = lookup.find(id);
+        if(it == lookup.end() || textures[it->second].state == TEXTURE_UNLOADED || textures[it->second].state == TEXTURE_DECODING)
+            return false;
+        alpha = textures[it->second].alpha;
+        return true;
+    }
+
+    // goes up by one every time a lazy texture finishes, materials compare it to know when to look again
+    unsigned int getLoadCount() const
+    {
+        return loadCount;
+    }
+
+    // forgets the texture, for when its owner deletes it
+    void remove(unsigned int id)
+    {
+        std::unordered_map<unsigned int, unsigned int>::iterator it = lookup.find(id);
+        if(it == lookup.end())
+            return;
+        unsigned int index = it->second;
+        StreamedTexture& texture = textures[index];
+        for(unsigned int level = texture.resident; level < texture.levels.size(); level++)
+            residentBytes -= levelBytes(texture, level);
+        lookup.erase(it);
+        if(index != textures.size() - 1)
+        {
+            textures[index] = textures.back();
+            lookup[textures[index].id] = index;
+        }
+        textures.pop_back();
+    }
+
+    // uvPerPixel: how much of the 0..1 UV range one screen pixel spans, 0 asks for full detail
+    void request(unsigned int id, float uvPerPixel)
+    {
+        std::unordered_map<unsigned int, unsigned int>::iterator it = lookup.find(id);
+        if(it == lookup.end())
+            return;
+        StreamedTexture& texture = textures[it->second];
+        texture.lastUsed = frame;
+        if(texture.state != TEXTURE_LOADED)
+        {
+            if(texture.state == TEXTURE_UNLOADED)
+                queueDecode(texture);
+            return;
+        }
+        float texels = uvPerPixel * std::max(texture.widths[0], texture.heights[0]);
+        unsigned int level = texels <= 1.0f ? 0 : (unsigned int)std::floor(std::log2(texels));
+        texture.requested = std::min(texture.requested, std::min(level, texture.tail));
+    }
+
+    // once per frame after the draws have made their requests
+    void update()
+    {
+        // installs, uploads and GpuMemory's records of them
+        AllocationScope streaming(SCOPE_STREAMING);
+        collectDecodes();
+        lastStats.uploadedBytes = 0;
+        lastStats.evictedBytes = 0;
+        ArenaVector<unsigned int> missing = FrameAllocator::instance().vector<unsigned int>();
+        missing.reserve(textures.size());
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            StreamedTexture& texture = textures[i];
+            if(texture.requested != NOT_REQUESTED)
+                texture.wanted = texture.requested;
+            texture.requested = NOT_REQUESTED;
+            if(texture.wanted < texture.resident)
+                missing.push_back(i);
+        }
+
+        // the ones that need the most detail first, coarse to fine within a texture
+        std::sort(missing.begin(), missing.end(), [this](unsigned int a, unsigned int b) {
+            return textures[a].resident - textures[a].wanted > textures[b].resident - textures[b].wanted;
+        });
+        for(unsigned int m = 0; m < missing.size(); m++)
+        {
+            StreamedTexture& texture = textures[missing[m]];
+            while(texture.wanted < texture.resident)
+            {
+                size_t bytes = levelBytes(texture, texture.resident - 1);
+                if(lastStats.uploadedBytes + bytes > STREAM_UPLOAD_BYTES_PER_FRAME && lastStats.uploadedBytes > 0)
+                    break;
+                if(residentBytes + bytes > budget && !evict(residentBytes + bytes - budget, missing[m]))
+                    break;
+                uploadLevel(texture);
+                lastStats.uploadedBytes += bytes;
+            }
+        }
+        if(residentBytes > budget)
+            evict(residentBytes - budget, NO_TEXTURE);
+        frame++;
+    }
+
+    const Stats& getStats()
+    {
+        lastStats.textures = textures.size();
+        lastStats.residentBytes = residentBytes;
+        lastStats.budgetBytes = budget;
+        lastStats.unloaded = 0;
+        lastStats.decoding = 0;
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            lastStats.unloaded += textures[i].state == TEXTURE_UNLOADED;
+            lastStats.decoding += textures[i].state == TEXTURE_DECODING;
+        }
+        return lastStats;
+    }
+
+    // one line per texture: full size, finest resident level, finest wanted level, bytes on the GPU
+    void printResidency() const
+    {
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            const StreamedTexture& texture = textures[i];
+            if(texture.state != TEXTURE_LOADED)
+            {
+                std::cout << texture.name << (texture.state == TEXTURE_UNLOADED ? " not loaded"
+                                              : texture.state == TEXTURE_DECODING ? " decoding" : " failed")
+                          << ", placeholder on the GPU" << std::endl;
+                continue;
+            }
+            size_t bytes = 0;
+            for(unsigned int level = texture.resident; level < texture.levels.size(); level++)
+                bytes += levelBytes(texture, level);
+            std::cout << texture.name << " " << texture.widths[0] << "x" << texture.heights[0]
+                      << " resident " << texture.resident << " (" << texture.widths[texture.resident] << "x"
+                      << texture.heights[texture.resident] << ") wanted " << texture.wanted
+                      << ", " << bytes / 1024 << " KB, last used " << frame - texture.lastUsed << " frames ago" << std::endl;
+        }
+    }
+private:
+    static const unsigned int NOT_REQUESTED = 0xffffffffu;
+    static const unsigned int NO_TEXTURE = 0xffffffffu;
+
+    enum TextureState
+    {
+        TEXTURE_UNLOADED,   // lazy, placeholder only
+        TEXTURE_DECODING,   // a background job is decoding it
+        TEXTURE_LOADED,
+        TEXTURE_FAILED      // lazy and the file did not decode, keeps the placeholder
+    };
+
+    struct StreamedTexture
+    {
+        unsigned int id;
+        std::string name;
+        GLenum format;
+        int channels;
+        std::vector<std::vector<unsigned char> > levels;
+        std::vector<int> widths;
+        std::vector<int> heights;
+        unsigned int tail;          // first level of the always resident tail
+        unsigned int resident;      // finest level on the GPU, the base level
+        unsigned int wanted;        // finest level the last frame that drew the texture asked for
+        unsigned int requested;     // finest level asked for so far this frame
+        unsigned long long lastUsed = 0;
+        TextureState state = TEXTURE_LOADED;
+        bool opacity = false;               // lazy opacity map, classified when decoded
+        AlphaMode alpha = ALPHA_OPAQUE;
+    };
+
+    std::vector<StreamedTexture> textures;
+    std::unordered_map<unsigned int, unsigned int> lookup;
+    size_t budget = 256 * 1024 * 1024;
+    size_t residentBytes = 0;
+    unsigned long long frame = 0;
+    Stats lastStats;
+    unsigned int loadCount = 0;
+
+    // decode jobs leave their results in decoded for update() to install
+    JobCounter decodes;
+    std::mutex mutex;
+    std::vector<StreamedTexture> decoded;
+
+    TextureStreamer() {}
+    ~TextureStreamer()
+    {
+        // the jobs write into this object
+        JobSystem::instance().wait(decodes);
+    }
+
+    static GLenum formatOf(int channels)
+    {
+        return channels == 1 ? GL_RED : channels == 2 ? GL_RG : channels == 3 ? GL_RGB : GL_RGBA;
+    }
+
+    // picks the tail of a freshly built mip chain and uploads it, the texture has to have no level resident yet
+    void install(StreamedTexture& texture)
+    {
+        texture.tail = 0;
+        while(texture.tail + 1 < texture.levels.size()
+              && std::max(texture.widths[texture.tail], texture.heights[texture.tail]) > STREAM_TAIL_SIZE)
+            texture.tail++;
+        texture.resident = texture.levels.size();
+        texture.wanted = texture.tail;
+        texture.requested = NOT_REQUESTED;
+
+        RenderState::instance().bindTexture(GL_TEXTURE_2D, texture.id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levels.size() - 1);
+        while(texture.resident > texture.tail)
+            uploadLevel(texture);
+    }
+
+    // what a decode job needs to know, without the texture's data
+    static StreamedTexture decodeJob(const StreamedTexture& texture)
+    {
+        StreamedTexture job;
+        job.id = texture.id;
+        job.name = texture.name;
+        job.opacity = texture.opacity;
+        return job;
+    }
+
+    void queueDecode(StreamedTexture& texture)
+    {
+        texture.state = TEXTURE_DECODING;
+        AllocationScope streaming(SCOPE_STREAMING);
+        StreamedTexture job = decodeJob(texture);
+        // background, a frame waiting on its culling jobs must not end up decoding a texture
+        JobSystem::instance().run([this, job]() {
+            StreamedTexture result = job;
+            decode(result);
+            std::lock_guard<std::mutex> lock(mutex);
+            decoded.push_back(std::move(result));
+        }, &decodes, true);
+    }
+
+    // any thread. stb's vertical flip is one process wide switch in this version, so it is left alone here
+    // (the loaders keep it off once they are done) and the rows are flipped by hand instead.
+    // No levels means the file did not decode.
+    static void decode(StreamedTexture& job)
+    {
+        FileData file = VirtualFileSystem::instance().read(job.name);
+        int width = 0, height = 0, channels = 0;
+        unsigned char* data = file.isValid() ? stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(file.data()),
+                                                                     (int)file.size(), &width, &height, &channels, 0)
+                                             : nullptr;
+        if(!data)
+        {
+            // the same as a map that is translucent everywhere
+            job.alpha = job.opacity ? ALPHA_BLENDED : ALPHA_OPAQUE;
+            return;
+        }
+        size_t row = (size_t)width * channels;
+        std::vector<unsigned char> swap(row);
+        for(int y = 0; y < height / 2; y++)
+        {
+            unsigned char* top = data + y * row;
+            unsigned char* bottom = data + (height - 1 - y) * row;
+            std::copy(top, top + row, swap.begin());
+            std::copy(bottom, bottom + row, top);
+            std::copy(swap.begin(), swap.end(), bottom);
+        }
+        job.channels = channels;
+        job.format = formatOf(channels);
+        if(job.opacity)
+            job.alpha = TextureAlpha::classify(data, width, height, channels);
+        buildMips(job, data, width, height);
+        stbi_image_free(data);
+    }
+
+    // main thread, installs what the decode jobs finished; results for removed textures are dropped
+    void collectDecodes()
+    {
+        std::vector<StreamedTexture> finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.swap(decoded);
+        }
+        for(unsigned int i = 0; i < finished.size(); i++)
+        {
+            std::unordered_map<unsigned int, unsigned int>::iterator it = lookup.find(finished[i].id);
+            // the id may have been deleted and handed out again in the meantime
+            if(it == lookup.end() || textures[it->second].state != TEXTURE_DECODING || textures[it->second].name != finished[i].name)
+                continue;
+            finish(textures[it->second], finished[i]);
+        }
+    }
+
+    void finish(StreamedTexture& texture, StreamedTexture& result)
+    {
+        texture.alpha = result.alpha;
+        loadCount++;
+        if(texture.opacity)
+            std::cout << "opacity map " << texture.name << ": "
+                      << (texture.alpha == ALPHA_OPAQUE ? "opaque" : texture.alpha == ALPHA_CUTOUT ? "cutout" : "blended") << std::endl;
+        if(result.levels.empty())
+        {
+            std::cout << "Texture failed to load at path: " << texture.name << std::endl;
+            texture.state = TEXTURE_FAILED;
+            return;
+        }
+        texture.channels = result.channels;
+        texture.format = result.format;
+        texture.levels.swap(result.levels);
+        texture.widths.swap(result.widths);
+        texture.heights.swap(result.heights);
+        texture.state = TEXTURE_LOADED;
+
+        RenderState::instance().bindTexture(GL_TEXTURE_2D, texture.id);
+        // the placeholder is replaced by the real level 0 only when that streams in, free it now
+        GpuMemory::instance().texImage2D(GL_TEXTURE_2D, texture.id, 0, GL_RGBA, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL,
+                                         GPU_TEXTURE);
+        // textures with an alpha channel clamp, their transparent borders must not wrap into the other side
+        GLint wrap = texture.format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+        install(texture);
+    }
+
+    // drivers pad three channel texels to four
+    static size_t levelBytes(const StreamedTexture& texture, unsigned int level)
+    {
+        return (size_t)texture.widths[level] * texture.heights[level] * (texture.channels == 3 ? 4 : texture.channels);
+    }
+
+    // 2x2 box filter, odd edges repeat their last row or column
+    static void buildMips(StreamedTexture& texture, const unsigned char* data, int width, int height)
+    {
+        int channels = texture.channels;
+        texture.levels.push_back(std::vector<unsigned char>(data, data + (size_t)width * height * channels));
+        texture.widths.push_back(width);
+        texture.heights.push_back(height);
+        while(width > 1 || height > 1)
+        {
+            const std::vector<unsigned char>& source = texture.levels.back();
+            int w = std::max(width / 2, 1);
+            int h = std::max(height / 2, 1);
+            std::vector<unsigned char> level((size_t)w * h * channels);
+            for(int y = 0; y < h; y++)
+            {
+                int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+                for(int x = 0; x < w; x++)
+                {
+                    int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+                    for(int c = 0; c < channels; c++)
+                    {
+                        unsigned int sum = source[((size_t)y0 * width + x0) * channels + c] + source[((size_t)y0 * width + x1) * channels + c]
+                                         + source[((size_t)y1 * width + x0) * channels + c] + source[((size_t)y1 * width + x1) * channels + c];
+                        level[((size_t)y * w + x) * channels + c] = (unsigned char)((sum + 2) / 4);
+                    }
+                }
+            }
+            texture.levels.push_back(level);
+            texture.widths.push_back(w);
+            texture.heights.push_back(h);
+            width = w;
+            height = h;
+        }
+    }
+
+    void uploadLevel(StreamedTexture& texture)
+    {
+        unsigned int level = texture.resident - 1;
+        RenderState::instance().bindTexture(GL_TEXTURE_2D, texture.id);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        GpuMemory::instance().texImage2D(GL_TEXTURE_2D, texture.id, level, texture.format, texture.widths[level],
+                                         texture.heights[level], texture.format, GL_UNSIGNED_BYTE, &texture.levels[level][0],
+                                         GPU_TEXTURE);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        texture.resident = level;
+        residentBytes += levelBytes(texture, level);
+    }
+
+    // raises the base level first so the texture stays complete, then redefines the level as empty to free it
+    void dropLevel(StreamedTexture& texture)
+    {
+        unsigned int level = texture.resident;
+        RenderState::instance().bindTexture(GL_TEXTURE_2D, texture.id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+        GpuMemory::instance().texImage2D(GL_TEXTURE_2D, texture.id, level, texture.format, 0, 0, texture.format,
+                                         GL_UNSIGNED_BYTE, NULL, GPU_TEXTURE);
+        texture.resident = level + 1;
+        residentBytes -= levelBytes(texture, level);
+        lastStats.evictedBytes += levelBytes(texture, level);
+    }
+
+    // frees at least bytes, never from protect, never the tail, never what this frame still uses;
+    // returns false if that is not possible
+    bool evict(size_t bytes, unsigned int protect)
+    {
+        size_t freed = 0;
+        while(freed < bytes)
+        {
+            // levels finer than wanted go before needed ones, older textures before newer ones
+            int victim = -1;
+            for(unsigned int i = 0; i < textures.size(); i++)
+            {
+                const StreamedTexture& texture = textures[i];
+                if(i == protect || texture.resident >= texture.tail)
+                    continue;
+                bool surplus = texture.resident < texture.wanted;
+                if(!surplus && texture.lastUsed >= frame)
+                    continue;
+                if(victim < 0)
+                {
+                    victim = i;
+                    continue;
+                }
+                const StreamedTexture& best = textures[victim];
+                bool bestSurplus = best.resident < best.wanted;
+                if(surplus != bestSurplus ? surplus : texture.lastUsed < best.lastUsed)
+                    victim = i;
+            }
+            if(victim < 0)
+                return false;
+            size_t before = residentBytes;
+            dropLevel(textures[victim]);
+            freed += before - residentBytes;
+        }
+        return true;
+    }
+};
+
+#endif //PROJECT_BASE_TEXTURESTREAMING_H
@@ -0,0 +1,243 @@
+#ifndef PROJECT_BASE_VIRTUALFILESYSTEM_H
+#define PROJECT_BASE_VIRTUALFILESYSTEM_H
+
+#include <MojeKlase/MappedFile.h>
+#include <MojeKlase/AssetPack.h>
+#include <MojeKlase/Lz4.h>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstring>
+
+// Bytes of one file. Points straight into the mounted pack for stored entries, otherwise owns them:
+// the expanded copy of a compressed entry, or a mapping of a loose file. Move only.
+class FileData
+{
+public:
+    FileData() {}
+    FileData(FileData&& other) = default;
+    FileData& operator=(FileData&& other) = default;
+
+    bool isValid() const
+    {
+        return bytes != nullptr;
+    }
+    const char* data() const
+    {
+        return bytes;
+    }
+    size_t size() const
+    {
+        return length;
+    }
+    std::string toString() const
+    {
+        return bytes ? std::string(bytes, length) : std::string();
+    }
+private:
+    friend class VirtualFileSystem;
+    const char* bytes = nullptr;
+    size_t length = 0;
+    std::vector<char> buffer;
+    std::unique_ptr<MappedFile> mapping;
+};
+
+// One read only namespace over an asset pack and the loose files next to the executable.
+// A mounted pack wins over the disk, anything it lacks is read from the disk, so a pack can be
+// dropped in or left out without touching the loaders. Built with LOOSE_FILE_OVERRIDES (a development
+// option, it stats every entry on mount), loose files edited after the pack was built win over their
+// packed copy until the pack is rebuilt. Mount before the first read; after that read() only looks at
+// immutable state and may be called from any thread.
+class VirtualFileSystem
+{
+public:
+    static VirtualFileSystem& instance()
+    {
+        static VirtualFileSystem vfs;
+        return vfs;
+    }
+
+    // returns false, and keeps serving loose files, if the pack is missing or not one of ours
+    bool mount(const std::string& path)
+    {
+        if(access(path.c_str(), R_OK) != 0)
+            return false;
+        MappedFile* file = new MappedFile(path);
+        const AssetPackHeader* header = reinterpret_cast<const AssetPackHeader*>(file->data());
+        if(!file->isOpen() || file->size() < sizeof(AssetPackHeader)
+           || std::memcmp(header->magic, ASSET_PACK_MAGIC, 4) != 0 || header->version != ASSET_PACK_VERSION
+           || file->size() < sizeof(AssetPackHeader) + (uint64_t)header->entryCount * sizeof(AssetPackEntry) + header->namesSize)
+        {
+            std::cout << "not an asset pack: " << path << std::endl;
+            delete file;
+            return false;
+        }
+        const AssetPackEntry* fileEntries = reinterpret_cast<const AssetPackEntry*>(file->data() + sizeof(AssetPackHeader));
+        if(!validEntries(fileEntries, header->entryCount, header->namesSize, file->size()))
+        {
+            std::cout << "corrupt or truncated asset pack: " << path << std::endl;
+            delete file;
+            return false;
+        }
+        delete pack;
+        pack = file;
+        stale.clear();
+        entries = fileEntries;
+        entryCount = header->entryCount;
+        names = reinterpret_cast<const char*>(entries + entryCount);
+#ifdef LOOSE_FILE_OVERRIDES
+        findStaleEntries(path);
+#endif
+        // startup reads most of it anyway, better as one sequential read than as scattered page faults
+        pack->prefetch();
+        std::cout << "mounted " << path << ": " << entryCount << " files, " << pack->size() / 1024 << " KB" << std::endl;
+        return true;
+    }
+
+    FileData read(const std::string& path) const
+    {
+        FileData file;
+        std::string name = normalize(path);
+        const AssetPackEntry* entry = find(name);
+        if(entry && !isStale(entry))
+        {
+            // mount() checked every entry's range
+            const char* stored = pack->data() + entry->offset;
+            if(!(entry->flags & ASSET_LZ4))
+            {
+                file.bytes = stored;
+                file.length = entry->size;
+                return file;
+            }
+            file.buffer.resize(entry->size);
+            if(!Lz4::decompress(stored, entry->storedSize, file.buffer.data(), entry->size))
+            {
+                std::cout << "corrupt asset pack entry: " << name << std::endl;
+                return file;
+            }
+            file.bytes = file.buffer.data();
+            file.length = entry->size;
+            return file;
+        }
+
+        file.mapping.reset(new MappedFile(name));
+        if(file.mapping->isOpen())
+        {
+            file.bytes = file.mapping->data();
+            file.length = file.mapping->size();
+        }
+        return file;
+    }
+
+    bool exists(const std::string& path) const
+    {
+        std::string name = normalize(path);
+        return find(name) != nullptr || access(name.c_str(), R_OK) == 0;
+    }
+
+    // pack paths are relative with forward slashes, no "." or ".." segments
+    static std::string normalize(const std::string& path)
+    {
+        std::vector<std::string> segments;
+        size_t start = 0;
+        while(start <= path.size())
+        {
+            size_t end = path.find_first_of("/\\", start);
+            if(end == std::string::npos)
+                end = path.size();
+            std::string segment = path.substr(start, end - start);
+            if(segment == ".." && !segments.empty() && segments.back() != "..")
+                segments.pop_back();
+            else if(!segment.empty() && segment != ".")
+                segments.push_back(segment);
+            start = end + 1;
+        }
+        std::string result = !path.empty() && path[0] == '/' ? "/" : "";
+        for(unsigned int i = 0; i < segments.size(); i++)
+            result += (i ? "/" : "") + segments[i];
+        return result;
+    }
+private:
+    MappedFile* pack = nullptr;
+    const AssetPackEntry* entries = nullptr;
+    const char* names = nullptr;
+    unsigned int entryCount = 0;
+    std::vector<bool> stale;        // per entry, the loose file is newer than the pack; empty without LOOSE_FILE_OVERRIDES
+
+    VirtualFileSystem() {}
+    ~VirtualFileSystem()
+    {
+        delete pack;
+    }
+
+    // names inside the names block and data inside the file, so nothing read later goes out of bounds
+    static bool validEntries(const AssetPackEntry* entries, unsigned int count, uint32_t namesSize, uint64_t fileSize)
+    {
+        for(unsigned int i = 0; i < count; i++)
+        {
+            const AssetPackEntry& entry = entries[i];
+            if((uint64_t)entry.nameOffset + entry.nameLength > namesSize)
+                return false;
+            if(entry.offset > fileSize || entry.storedSize > fileSize - entry.offset)
+                return false;
+            // stored entries are handed out as size bytes straight from the mapping
+            if(!(entry.flags & ASSET_LZ4) && entry.size > entry.storedSize)
+                return false;
+        }
+        return true;
+    }
+
+    bool isStale(const AssetPackEntry* entry) const
+    {
+        return !stale.empty() && stale[entry - entries];
+    }
+
+    // loose files edited since the pack was built are read from disk instead, with a reminder to rebuild it
+    void findStaleEntries(const std::string& packPath)
+    {
+        stale.assign(entryCount, false);
+        struct stat packInfo;
+        if(stat(packPath.c_str(), &packInfo) != 0)
+            return;
+        unsigned int count = 0;
+        for(unsigned int i = 0; i < entryCount; i++)
+        {
+            std::string name(names + entries[i].nameOffset, entries[i].nameLength);
+            struct stat info;
+            if(stat(name.c_str(), &info) == 0 && info.st_mtime > packInfo.st_mtime)
+            {
+                stale[i] = true;
+                if(count++ < 10)
+                    std::cout << "newer than the asset pack, read from disk: " << name << std::endl;
+            }
+        }
+        if(count > 0)
+            std::cout << count << " files in the asset pack are out of date, rerun make pack" << std::endl;
+    }
+
+    // entries are sorted by name
+    const AssetPackEntry* find(const std::string& name) const
+    {
+        unsigned int low = 0, high = entryCount;
+        while(low < high)
+        {
+            unsigned int middle = (low + high) / 2;
+            const AssetPackEntry& entry = entries[middle];
+            int order = name.compare(0, std::string::npos, names + entry.nameOffset, entry.nameLength);
+            if(order == 0)
+                return &entry;
+            if(order < 0)
+                high = middle;
+            else
+                low = middle + 1;
+        }
+        return nullptr;
+    }
+};
+
+#endif //PROJECT_BASE_VIRTUALFILESYSTEM_H
@@ -0,0 +1,135 @@
+#ifndef PROJECT_BASE_WEIGHTEDOIT_H
+#define PROJECT_BASE_WEIGHTEDOIT_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <MojeKlase/Shader.h>
+#include <MojeKlase/RenderState.h>
+#include <MojeKlase/GpuMemory.h>
+
+#include <iostream>
+
+const unsigned int OIT_ACCUM_TEXTURE_UNIT = 11;
+const unsigned int OIT_WEIGHT_TEXTURE_UNIT = 12;
+
+// Weighted blended order independent transparency. Translucent draws go unsorted into an accumulation
+// target (weighted premultiplied color, revealage in alpha) and a weight target, depth tested against
+// a copy of the opaque depth, and one full screen pass composites them over the frame.
+// GL 3.3 has no per target blend functions, so revealage rides in the accumulation alpha channel.
+class WeightedOIT
+{
+public:
+    WeightedOIT(GLFWwindow* window)
+    {
+        this->window = window;
+        compositeShader = new Shader("resources/shaders/oitComposite.vs", "resources/shaders/oitComposite.fs");
+        compositeShader->use();
+        compositeShader->setInt("accumulation", OIT_ACCUM_TEXTURE_UNIT);
+        compositeShader->setInt("weights", OIT_WEIGHT_TEXTURE_UNIT);
+        glGenVertexArrays(1, &emptyVAO);
+        glGenFramebuffers(1, &FBO);
+        glGenTextures(1, &accumTexture);
+        glGenTextures(1, &weightTexture);
+        glGenTextures(1, &depthTexture);
+    }
+
+    ~WeightedOIT()
+    {
+        RenderState& state = RenderState::instance();
+        state.framebufferDeleted(FBO);
+        state.vertexArrayDeleted(emptyVAO);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteVertexArrays(1, &emptyVAO);
+        GpuMemory& memory = GpuMemory::instance();
+        memory.deleteTexture(accumTexture);
+        memory.deleteTexture(weightTexture);
+        memory.deleteTexture(depthTexture);
+        compositeShader->deleteProgram();
+        delete compositeShader;
+    }
+
+    // call after all opaque geometry; translucent draws that follow land in the OIT targets
+    void begin()
+    {
+        RenderState& state = RenderState::instance();
+        int w, h;
+        glfwGetFramebufferSize(window, &w, &h);
+        if(w != width || h != height)
+            resize(w, h);
+
+        // the translucent pass is depth tested against the opaque scene without writing to it
+        state.bindFramebuffer(0);
+        state.bindTexture(OIT_ACCUM_TEXTURE_UNIT, GL_TEXTURE_2D, depthTexture);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+        state.bindFramebuffer(FBO);
+        static const float clearAccum[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        static const float clearWeight[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glClearBufferfv(GL_COLOR, 0, clearAccum);
+        glClearBufferfv(GL_COLOR, 1, clearWeight);
+
+        state.enable(GL_BLEND);
+        state.depthMask(GL_FALSE);
+        state.blendEquation(GL_FUNC_ADD);
+        state.blendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    // resolves the targets over the default framebuffer and restores the usual blend function
+    void composite()
+    {
+        RenderState& state = RenderState::instance();
+        state.bindFramebuffer(0);
+        state.enable(GL_BLEND);
+        state.blendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
+        state.disable(GL_DEPTH_TEST);
+        state.bindTexture(OIT_ACCUM_TEXTURE_UNIT, GL_TEXTURE_2D, accumTexture);
+        state.bindTexture(OIT_WEIGHT_TEXTURE_UNIT, GL_TEXTURE_2D, weightTexture);
+        compositeShader->use();
+        state.bindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        state.enable(GL_DEPTH_TEST);
+        state.disable(GL_BLEND);
+        state.depthMask(GL_TRUE);
+    }
+private:
+    GLFWwindow* window;
+    Shader* compositeShader;
+    unsigned int FBO;
+    unsigned int accumTexture, weightTexture, depthTexture;
+    unsigned int emptyVAO;
+    int width = 0;
+    int height = 0;
+
+    void resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        RenderState& state = RenderState::instance();
+        allocate(accumTexture, GL_RGBA16F, GL_RGBA, GL_FLOAT);
+        allocate(weightTexture, GL_R16F, GL_RED, GL_FLOAT);
+        allocate(depthTexture, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT);
+
+        state.bindFramebuffer(FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, weightTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, attachments);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "OIT framebuffer is not complete" << std::endl;
+        state.bindFramebuffer(0);
+    }
+
+    void allocate(unsigned int texture, GLint internalFormat, GLenum format, GLenum type)
+    {
+        RenderState::instance().bindTexture(OIT_ACCUM_TEXTURE_UNIT, GL_TEXTURE_2D, texture);
+        GpuMemory::instance().texImage2D(GL_TEXTURE_2D, texture, 0, internalFormat, width, height, format, type, NULL,
+                                         GPU_RENDER_TARGET);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+};
+
+#endif //PROJECT_BASE_WEIGHTEDOIT_H
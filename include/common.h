@@ -5,14 +5,10 @@
 #ifndef PROJECT_BASE_COMMON_H
 #define PROJECT_BASE_COMMON_H
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <MojeKlase/VirtualFileSystem.h>
 
 std::string readFileContents(std::string path) {
-    std::ifstream in(path);
-    std::stringstream buffer;
-    buffer << in.rdbuf();
-    return buffer.str();
+    return VirtualFileSystem::instance().read(path).toString();
 }
 
 
@@ -0,0 +1,70 @@
+#version 330 core
+out vec4 FragColor;
+
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 position;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+in vec2 AtlasCoords;
+in vec3 FragPos;
+in vec3 FrameOffset;
+in mat3 NormalMatrix;
+in float Fade;
+
+uniform sampler2D albedoAtlas;
+uniform sampler2D normalDepthAtlas;
+uniform DirLight dirLight;
+uniform PointLight pointLights[4];
+
+// 4x4 ordered dither, shader.fs discards the complement so geometry and impostor never overlap
+float ditherThreshold()
+{
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+                                      3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    int x = int(gl_FragCoord.x) & 3;
+    int y = int(gl_FragCoord.y) & 3;
+    return (bayer[y * 4 + x] + 0.5) / 16.0;
+}
+
+void main()
+{
+    if(ditherThreshold() >= Fade)
+        discard;
+    vec4 albedo = texture(albedoAtlas, AtlasCoords);
+    if(albedo.a < 0.5)
+        discard;
+    vec4 normalDepth = texture(normalDepthAtlas, AtlasCoords);
+    vec3 normal = normalize(NormalMatrix * (normalDepth.xyz * 2.0 - 1.0));
+    // the frame was rendered looking at the bounds center from one radius away, depth spans the diameter
+    vec3 surface = FragPos + FrameOffset * (1.0 - 2.0 * normalDepth.a);
+
+    // diffuse only, a distant impostor has no resolution for highlights or shadow detail
+    vec3 result = albedo.rgb * (dirLight.ambient + dirLight.diffuse * max(dot(normal, normalize(-dirLight.direction)), 0.0));
+    // ACTIVE_POINT_LIGHTS is defined by Impostor
+    for(int i = 0; i < ACTIVE_POINT_LIGHTS; i++)
+    {
+        vec3 toLight = pointLights[i].position - surface;
+        float distance = length(toLight);
+        float attenuation = 1.0 / (pointLights[i].constant + pointLights[i].linear * distance
+                                   + pointLights[i].quadratic * distance * distance);
+        float diff = max(dot(normal, toLight / distance), 0.0);
+        result += albedo.rgb * (pointLights[i].ambient + pointLights[i].diffuse * diff) * attenuation;
+    }
+    FragColor = vec4(result, 1.0);
+}
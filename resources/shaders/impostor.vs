@@ -0,0 +1,61 @@
+#version 330 core
+// corner of the unit quad, -1 to 1
+layout (location = 0) in vec2 aCorner;
+// per instance from InstanceBuffer, tint alpha is how far the instance has faded from geometry to impostor
+layout (location = 5) in mat4 aInstanceModel;
+layout (location = 9) in vec4 aInstanceTint;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 viewPos;
+uniform vec3 boundsCenter;
+uniform float boundsRadius;
+uniform float frames;
+
+out vec2 AtlasCoords;
+out vec3 FragPos;
+out vec3 FrameOffset;
+out mat3 NormalMatrix;
+out float Fade;
+
+// full sphere octahedral mapping, y up; Impostor.h bakes the frames with the same one
+vec2 octEncode(vec3 d)
+{
+    d /= abs(d.x) + abs(d.y) + abs(d.z);
+    vec2 p = d.xz;
+    if(d.y < 0.0)
+        p = (1.0 - abs(p.yx)) * vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+    return p * 0.5 + 0.5;
+}
+
+vec3 octDecode(vec2 uv)
+{
+    vec2 p = uv * 2.0 - 1.0;
+    vec3 d = vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y);
+    if(d.y < 0.0)
+        d.xz = (1.0 - abs(d.zx)) * vec2(d.x >= 0.0 ? 1.0 : -1.0, d.z >= 0.0 ? 1.0 : -1.0);
+    return normalize(d);
+}
+
+void main()
+{
+    mat3 rotation = mat3(aInstanceModel);
+    vec3 center = vec3(aInstanceModel * vec4(boundsCenter, 1.0));
+    // rotation and uniform scale only, so the transpose undoes the rotation
+    vec3 direction = normalize(transpose(rotation) * (viewPos - center));
+
+    // the baked frame nearest to the view direction, the quad faces exactly the way that frame was rendered
+    vec2 frame = clamp(floor(octEncode(direction) * frames), 0.0, frames - 1.0);
+    vec3 frameDirection = octDecode((frame + 0.5) / frames);
+    vec3 reference = abs(frameDirection.y) > 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+    vec3 right = normalize(cross(reference, frameDirection));
+    vec3 up = cross(frameDirection, right);
+
+    vec3 worldPos = center + rotation * (right * aCorner.x + up * aCorner.y) * boundsRadius;
+    AtlasCoords = (frame + aCorner * 0.5 + 0.5) / frames;
+    FragPos = worldPos;
+    FrameOffset = rotation * frameDirection * boundsRadius;
+    NormalMatrix = rotation;
+    Fade = aInstanceTint.a;
+    gl_Position = projection * view * vec4(worldPos, 1.0);
+}
@@ -0,0 +1,24 @@
+#version 330 core
+// albedo with coverage in alpha, and object space normal with linear depth in alpha
+layout(location = 0) out vec4 albedo;
+layout(location = 1) out vec4 normalDepth;
+
+struct Material {
+    sampler2D texture_diffuse1;
+    vec3 diffuseColor;
+};
+
+in vec3 Normal;
+in vec2 TexCoords;
+
+uniform Material material;
+uniform bool useDiffuseMap;
+
+void main()
+{
+    vec3 color = useDiffuseMap ? texture(material.texture_diffuse1, TexCoords).rgb : material.diffuseColor;
+    vec3 normal = normalize(gl_FrontFacing ? Normal : -Normal);
+    albedo = vec4(color, 1.0);
+    // orthographic projection, window depth is already linear
+    normalDepth = vec4(normal * 0.5 + 0.5, gl_FragCoord.z);
+}
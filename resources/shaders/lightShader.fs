@@ -1,7 +1,9 @@
 #version 330 core
 out vec4 FragColor;
 
+in vec4 Tint;
+
 void main()
 {
-    FragColor = vec4(1.0f, 0.6f, 0.0f, 1.0f);
+    FragColor = Tint;
 }
@@ -1,12 +1,17 @@
 #version 330 core
 
 layout (location = 0) in vec3 aPos;
+// one gizmo per instance, see InstanceBuffer
+layout (location = 5) in mat4 aInstanceModel;
+layout (location = 9) in vec4 aInstanceTint;
 
 uniform mat4 view;
-uniform mat4 model;
 uniform mat4 projection;
 
+out vec4 Tint;
+
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
-}
\ No newline at end of file
+    Tint = aInstanceTint;
+    gl_Position = projection * view * aInstanceModel * vec4(aPos, 1.0f);
+}
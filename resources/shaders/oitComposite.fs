@@ -0,0 +1,19 @@
+#version 330 core
+out vec4 FragColor;
+
+// rgb = sum of weighted premultiplied color, a = product of (1 - alpha)
+uniform sampler2D accumulation;
+// r = sum of weighted alpha
+uniform sampler2D weights;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 accum = texelFetch(accumulation, texel, 0);
+    float revealage = accum.a;
+    if(revealage >= 1.0)
+        discard;
+    float weightSum = texelFetch(weights, texel, 0).r;
+    vec3 average = accum.rgb / max(weightSum, 0.00001);
+    FragColor = vec4(average, 1.0 - revealage);
+}
@@ -0,0 +1,11 @@
+#version 330 core
+in vec4 FragPos;
+
+uniform vec3 lightPos;
+uniform float farPlane;
+
+void main()
+{
+    // linear distance to the light, so calcPointShadow can compare against it directly
+    gl_FragDepth = length(FragPos.xyz - lightPos) / farPlane;
+}
@@ -1,13 +1,34 @@
 #version 330 core
+#ifdef WEIGHTED_OIT
+// accumulation and weight targets of WeightedOIT, both additive except for revealage in accum.a
+layout(location = 0) out vec4 accum;
+layout(location = 1) out vec4 weight;
+#else
 out vec4 FragColor;
+#endif
 
+// HAS_*_MAP defines come from ShaderPermutations, one per map the material actually has
 struct Material {
     vec3 ambient;
+#ifdef HAS_DIFFUSE_MAP
     sampler2D texture_diffuse1;
+#else
+    vec3 diffuseColor;
+#endif
+#ifdef HAS_SPECULAR_MAP
     sampler2D texture_specular1;
+#else
+    vec3 specularColor;
+#endif
+#ifdef HAS_NORMAL_MAP
     sampler2D texture_normal1;
+#endif
+#ifdef HAS_HEIGHT_MAP
     sampler2D texture_height1;
+#endif
+#ifdef HAS_OPACITY_MAP
     sampler2D texture_opacity1;
+#endif
     float shininess;
 };
 
@@ -52,6 +73,11 @@ in vec3 Normal;
 in vec2 TexCoords;
 in vec3 FragPos;
 in mat3 tbnMatrix;
+in vec2 LightmapCoords;
+in vec4 FragPosLightSpace;
+#ifdef INSTANCED
+in vec4 InstanceTint;
+#endif
 
 uniform Material material;
 uniform DirLight dirLight;
@@ -61,6 +87,82 @@ uniform SpotLight spotLight;
 uniform vec3 viewPos;
 uniform vec3 cameraPos;
 
+// ambient + diffuse of dirLight and the point lights, baked by LightmapBaker
+uniform sampler2D lightmap;
+uniform bool useLightmap;
+
+// cached by ShadowMaps, only re-rendered when a light or a caster in its range changes
+uniform sampler2D shadowMap;
+uniform samplerCube pointShadowMaps[2];
+uniform float pointShadowFar[2];
+uniform bool useShadows;
+
+// set per draw by RenderQueue, 0 draws everything, 1 nothing; the rest is covered by the impostor
+uniform float lodFadeOut;
+
+// 4x4 ordered dither, impostor.fs keeps exactly the pixels discarded here
+float ditherThreshold()
+{
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+                                      3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    int x = int(gl_FragCoord.x) & 3;
+    int y = int(gl_FragCoord.y) & 3;
+    return (bayer[y * 4 + x] + 0.5) / 16.0;
+}
+
+vec3 materialDiffuse(vec2 textureCoords)
+{
+#ifdef HAS_DIFFUSE_MAP
+    return vec3(texture(material.texture_diffuse1, textureCoords));
+#else
+    return material.diffuseColor;
+#endif
+}
+
+vec3 materialSpecular(vec2 textureCoords)
+{
+#ifdef HAS_SPECULAR_MAP
+    return vec3(texture(material.texture_specular1, textureCoords));
+#else
+    return material.specularColor;
+#endif
+}
+
+float CalcDirShadow(vec3 normal, vec3 lightDir)
+{
+    vec3 projCoords = FragPosLightSpace.xyz / FragPosLightSpace.w * 0.5 + 0.5;
+    if(!useShadows || projCoords.z > 1.0)
+        return 0.0;
+    float bias = max(0.005 * (1.0 - dot(normal, lightDir)), 0.0005);
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0));
+    float shadow = 0.0;
+    for(int x = -1; x <= 1; x++)
+    {
+        for(int y = -1; y <= 1; y++)
+        {
+            float closest = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
+            shadow += projCoords.z - bias > closest ? 1.0 : 0.0;
+        }
+    }
+    return shadow / 9.0;
+}
+
+float calcPointShadow(int index, vec3 lightPos, vec3 fragPos)
+{
+    if(!useShadows)
+        return 0.0;
+    vec3 lightToFrag = fragPos - lightPos;
+    // sampler arrays may only be indexed with constant expressions in 330
+    float closest;
+    if(index == 0)
+        closest = texture(pointShadowMaps[0], lightToFrag).r;
+    else
+        closest = texture(pointShadowMaps[1], lightToFrag).r;
+    float farPlane = index == 0 ? pointShadowFar[0] : pointShadowFar[1];
+    float current = length(lightToFrag) / farPlane;
+    return current - 0.01 > closest && current < 1.0 ? 1.0 : 0.0;
+}
+
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec2 textureCoords)
 {
     vec3 lightDir = normalize(-light.direction);
@@ -69,13 +171,15 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec2 textureCoords)
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
 
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, textureCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, textureCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, textureCoords));
-    return (ambient + diffuse + specular);
+    float shadow = CalcDirShadow(normalize(Normal), lightDir);
+
+    vec3 ambient = light.ambient * materialDiffuse(textureCoords);
+    vec3 diffuse = light.diffuse * diff * materialDiffuse(textureCoords);
+    vec3 specular = light.specular * spec * materialSpecular(textureCoords);
+    return (ambient + (1.0 - shadow) * (diffuse + specular));
 }
 
-vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec2 textureCoords)
+vec3 calcPointLight(int index, PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec2 textureCoords)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     vec3 halfwayDir = normalize(lightDir + viewDir);
@@ -85,15 +189,36 @@ vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, v
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear*distance + light.quadratic*(distance*distance));
 
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, textureCoords));
-    vec3 diffuse = diff * light.diffuse * vec3(texture(material.texture_diffuse1, textureCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, textureCoords));
+    vec3 ambient = light.ambient * materialDiffuse(textureCoords);
+    vec3 diffuse = diff * light.diffuse * materialDiffuse(textureCoords);
+    vec3 specular = light.specular * spec * materialSpecular(textureCoords);
+    float shadow = calcPointShadow(index, light.position, fragPos);
     ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
+    diffuse *= attenuation * (1.0 - shadow);
+    specular *= attenuation * (1.0 - shadow);
     return (ambient + diffuse + specular);
 }
 
+vec3 CalcDirLightSpecular(DirLight light, vec3 normal, vec3 viewDir, vec2 textureCoords)
+{
+    vec3 lightDir = normalize(-light.direction);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+    float shadow = CalcDirShadow(normalize(Normal), lightDir);
+    return light.specular * spec * materialSpecular(textureCoords) * (1.0 - shadow);
+}
+
+vec3 calcPointLightSpecular(int index, PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec2 textureCoords)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear*distance + light.quadratic*(distance*distance));
+    float shadow = calcPointShadow(index, light.position, fragPos);
+    return light.specular * spec * materialSpecular(textureCoords) * attenuation * (1.0 - shadow);
+}
+
 vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec2 textureCoords)
 {
     vec3 lightDir = normalize(light.position - fragPos);
@@ -108,9 +233,9 @@ vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta-light.outerCutOff)/epsilon, 0.0f, 1.0f);
 
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, textureCoords));
-    vec3 diffuse = diff * light.diffuse * vec3(texture(material.texture_diffuse1, textureCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, textureCoords));
+    vec3 ambient = light.ambient * materialDiffuse(textureCoords);
+    vec3 diffuse = diff * light.diffuse * materialDiffuse(textureCoords);
+    vec3 specular = light.specular * spec * materialSpecular(textureCoords);
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
@@ -119,33 +244,76 @@ vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec
 
 vec2 ParallaxMapping(vec2 textureCoords, vec3 viewDirection)
 {
+#ifdef HAS_HEIGHT_MAP
     float height = texture(material.texture_height1, textureCoords).r;
     vec2 p = viewDirection.xy * (height*0.1);
     return textureCoords-p;
+#else
+    return textureCoords;
+#endif
 }
 
 void main()
 {
+    if(ditherThreshold() < lodFadeOut)
+        discard;
+    vec3 snapshotNormal = normalize(Normal);
+#ifdef HAS_NORMAL_MAP
     vec3 parallaxView = normalize(tbnMatrix*viewPos - tbnMatrix*FragPos);
     vec2 parallaxCoords = ParallaxMapping(TexCoords, parallaxView);
-    vec3 snapshotNormal = normalize(Normal);
     vec3 norm = texture(material.texture_normal1, parallaxCoords).rgb;
     norm = normalize(norm*2.0-1.0);
     norm = normalize(tbnMatrix*norm);
+#else
+    vec3 norm = snapshotNormal;
+#endif
 
     vec3 viewDir = normalize(viewPos - FragPos);
   	vec3 cameraDir = normalize(-cameraPos);
   	if(dot(snapshotNormal, cameraDir) < 0.0)
   	    discard;
 
-    vec3 result = CalcDirLight(dirLight, norm, viewDir, TexCoords);
-    for(int i = 0; i<2; i++)
+    vec3 result;
+    if(useLightmap)
+    {
+        result = texture(lightmap, LightmapCoords).rgb * materialDiffuse(TexCoords);
+        result += CalcDirLightSpecular(dirLight, norm, viewDir, TexCoords);
+        for(int i = 0; i<2; i++)
+        {
+            result += calcPointLightSpecular(i, pointLights[i], norm, FragPos, viewDir, TexCoords);
+        }
+    }
+    else
     {
-        result += calcPointLight(pointLights[i], norm, FragPos, viewDir, TexCoords);
+        result = CalcDirLight(dirLight, norm, viewDir, TexCoords);
+        for(int i = 0; i<2; i++)
+        {
+            result += calcPointLight(i, pointLights[i], norm, FragPos, viewDir, TexCoords);
+        }
     }
     result += calcSpotLight(spotLight, norm, FragPos, viewDir, TexCoords);
+#ifdef INSTANCED
+    result *= InstanceTint.rgb;
+#endif
 
+#ifdef HAS_OPACITY_MAP
     vec3 opacityTexture = vec3(texture(material.texture_opacity1, TexCoords));
     float opacityFactor = (opacityTexture.r + opacityTexture.g + opacityTexture.b)*0.3333;
+#ifdef ALPHA_CUTOUT
+    // binary map, filtering only blurs the edge
+    if(opacityFactor < 0.5)
+        discard;
+    opacityFactor = 1.0;
+#endif
+#else
+    float opacityFactor = 1.0;
+#endif
+#ifdef WEIGHTED_OIT
+    // depth weight from McGuire and Bavoil, keeps nearer surfaces dominant without sorting
+    float w = clamp(pow(min(1.0, opacityFactor * 10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - gl_FragCoord.z * 0.9, 3.0), 1e-2, 3e3);
+    accum = vec4(result * opacityFactor * w, opacityFactor);
+    weight = vec4(opacityFactor * w);
+#else
     FragColor = vec4(result, opacityFactor);
+#endif
 }
\ No newline at end of file
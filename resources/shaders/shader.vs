@@ -3,17 +3,32 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 layout (location = 3) in vec3 aTangent;
+layout (location = 4) in vec2 aLightmapCoords;
 
+#ifdef INSTANCED
+// per instance from InstanceBuffer, the transform spans locations 5 to 8
+layout (location = 5) in mat4 aInstanceModel;
+layout (location = 9) in vec4 aInstanceTint;
+out vec4 InstanceTint;
+#else
 uniform mat4 model;
+#endif
 uniform mat4 view;
 uniform mat4 projection;
+uniform mat4 lightSpaceMatrix;
 out vec3 Normal;
 out vec3 FragPos;
 out vec2 TexCoords;
 out mat3 tbnMatrix;
+out vec2 LightmapCoords;
+out vec4 FragPosLightSpace;
 
 void main()
 {
+#ifdef INSTANCED
+    mat4 model = aInstanceModel;
+    InstanceTint = aInstanceTint;
+#endif
     vec3 T = normalize(vec3(model*vec4(aTangent, 0.0)));
     vec3 N = normalize(vec3(model*vec4(aNormal, 0.0)));
     vec3 B = cross(N, T);
@@ -24,4 +39,6 @@ void main()
     Normal = mat3(transpose(inverse(model))) * aNormal;
     TexCoords = aTexCoords;
     tbnMatrix = TBN;
+    LightmapCoords = aLightmapCoords;
+    FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
 }
\ No newline at end of file
@@ -2,30 +2,100 @@
 #include <GLFW/glfw3.h>
 
 #include <MojeKlase/Game.h>
+#include <MojeKlase/AllocationTracker.h>
 
 #include <iostream>
+#include <string>
+#include <new>
+#include <cstdlib>
 
 const int windowWidth = 1980;
 const int windowHeight = 1485;
 
-int main()
+#ifdef TRACK_ALLOCATIONS
+// counting replacements of the global allocation functions, for AllocationTracker; only in this file
+void* operator new(size_t size)
 {
+    AllocationTracker::instance().record(size);
+    void* p = std::malloc(size ? size : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    AllocationTracker::instance().record(size);
+    return std::malloc(size ? size : 1);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    // checks the OBJ fast path against assimp, e.g. --compare-obj resources/objects/SobaProzor4/roomWindow.obj
+    if(argc == 3 && std::string(argv[1]) == "--compare-obj")
+        return Model::compareLoaders(argv[2]) ? 0 : 1;
+    // times building a model's meshes on 1 to N job system workers
+    if(argc == 3 && std::string(argv[1]) == "--job-scaling")
+    {
+        Model::measureJobScaling(argv[2]);
+        return 0;
+    }
+
+    // with TRACK_ALLOCATIONS, aborts on a frame loop allocation once the warm-up is over
+    bool strictAllocations = argc == 2 && std::string(argv[1]) == "--strict-allocations";
+
     Game game;
     GLFWwindow* window = game.Initialize(windowWidth, windowHeight, "projekat");
 
-    game.shaderInitialization();
-    game.arrayAndBufferInitialization();
-//    game.textureInitialization();
-    game.modelInitialization();
-    game.skyboxInitialization();
+    game.Startup();
 
+    AllocationTracker& allocations = AllocationTracker::instance();
+    allocations.start(strictAllocations);
     while(!glfwWindowShouldClose(window))
     {
         game.ScreenSettings();
-        game.Input(window);
-        game.DrawSkybox();
-        game.Update();
-        game.Draw(window);
+        {
+            AllocationScope scope(SCOPE_INPUT);
+            game.Input(window);
+        }
+        game.PollShaders();
+        {
+            AllocationScope scope(SCOPE_DRAW_SKYBOX);
+            game.DrawSkybox();
+        }
+        {
+            AllocationScope scope(SCOPE_UPDATE);
+            game.Update();
+        }
+        {
+            AllocationScope scope(SCOPE_DRAW);
+            game.Draw(window);
+        }
+        allocations.endFrame();
     }
 
     game.Deinitialize();
@@ -0,0 +1,177 @@
+// Bundles a directory tree into one asset pack for VirtualFileSystem.
+//   asset_packer [--store] <directory> <output>
+// Entry names are the paths as the game opens them, e.g. resources/shaders/shader.vs when run from the
+// project root with "resources". Every entry is LZ4 compressed unless that saves less than an eighth,
+// which leaves already compressed images stored as they are; --store turns compression off.
+// Caches the game writes at run time (program binaries, baked lightmaps) are machine specific and left out.
+#include <MojeKlase/AssetPack.h>
+#include <MojeKlase/Lz4.h>
+#include <MojeKlase/MappedFile.h>
+#include <MojeKlase/VirtualFileSystem.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+
+struct PackedFile
+{
+    std::string name;
+    std::vector<char> data;     // what goes into the pack, compressed or not
+    uint64_t size;
+    uint32_t flags;
+};
+
+// generated by the game and gitignored, rebuilt on the machine that runs it
+static const char* const EXCLUDED_DIRECTORIES[] = { "shader_cache" };
+static const char* const EXCLUDED_EXTENSIONS[] = { ".lightmap" };
+
+static bool excluded(const std::string& name, bool directory)
+{
+    if(directory)
+        return std::find(std::begin(EXCLUDED_DIRECTORIES), std::end(EXCLUDED_DIRECTORIES), name) != std::end(EXCLUDED_DIRECTORIES);
+    for(const char* extension : EXCLUDED_EXTENSIONS)
+    {
+        size_t length = std::strlen(extension);
+        if(name.size() >= length && name.compare(name.size() - length, length, extension) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void listFiles(const std::string& directory, std::vector<std::string>& files)
+{
+    DIR* dir = opendir(directory.c_str());
+    if(!dir)
+    {
+        std::cout << "could not open " << directory << std::endl;
+        return;
+    }
+    while(dirent* item = readdir(dir))
+    {
+        std::string name = item->d_name;
+        if(name == "." || name == "..")
+            continue;
+        std::string path = directory + "/" + name;
+        struct stat info;
+        if(stat(path.c_str(), &info) != 0 || excluded(name, S_ISDIR(info.st_mode)))
+            continue;
+        if(S_ISDIR(info.st_mode))
+            listFiles(path, files);
+        else if(S_ISREG(info.st_mode))
+            files.push_back(path);
+    }
+    closedir(dir);
+}
+
+static void pad(std::ofstream& out, uint64_t& position)
+{
+    static const char zeros[ASSET_PACK_ALIGNMENT] = {0};
+    uint64_t padding = (ASSET_PACK_ALIGNMENT - position % ASSET_PACK_ALIGNMENT) % ASSET_PACK_ALIGNMENT;
+    out.write(zeros, padding);
+    position += padding;
+}
+
+int main(int argc, char** argv)
+{
+    bool compress = true;
+    std::vector<std::string> arguments;
+    for(int i = 1; i < argc; i++)
+    {
+        if(std::string(argv[i]) == "--store")
+            compress = false;
+        else
+            arguments.push_back(argv[i]);
+    }
+    if(arguments.size() != 2)
+    {
+        std::cout << "usage: asset_packer [--store] <directory> <output>" << std::endl;
+        return 1;
+    }
+    std::vector<std::string> paths;
+    listFiles(VirtualFileSystem::normalize(arguments[0]), paths);
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<PackedFile> files;
+    uint64_t totalSize = 0, totalStored = 0;
+    for(unsigned int i = 0; i < paths.size(); i++)
+    {
+        MappedFile source(paths[i]);
+        PackedFile file;
+        file.name = paths[i];
+        file.size = source.size();
+        file.flags = 0;
+        if(source.isOpen() && compress)
+        {
+            file.data.resize(Lz4::compressBound(source.size()));
+            size_t stored = Lz4::compress(source.data(), source.size(), file.data.data(), file.data.size());
+            if(stored > 0 && stored < source.size() - source.size() / 8)
+            {
+                file.data.resize(stored);
+                file.flags = ASSET_LZ4;
+            }
+        }
+        if(!(file.flags & ASSET_LZ4))
+            file.data.assign(source.data(), source.data() + source.size());
+        totalSize += file.size;
+        totalStored += file.data.size();
+        files.push_back(file);
+    }
+
+    AssetPackHeader header;
+    std::memcpy(header.magic, ASSET_PACK_MAGIC, 4);
+    header.version = ASSET_PACK_VERSION;
+    header.entryCount = files.size();
+    std::string names;
+    std::vector<AssetPackEntry> entries(files.size());
+    for(unsigned int i = 0; i < files.size(); i++)
+    {
+        entries[i].nameOffset = names.size();
+        entries[i].nameLength = files[i].name.size();
+        names += files[i].name;
+    }
+    header.namesSize = names.size();
+
+    uint64_t position = sizeof(header) + entries.size() * sizeof(AssetPackEntry) + names.size();
+    for(unsigned int i = 0; i < files.size(); i++)
+    {
+        position += (ASSET_PACK_ALIGNMENT - position % ASSET_PACK_ALIGNMENT) % ASSET_PACK_ALIGNMENT;
+        entries[i].offset = position;
+        entries[i].storedSize = files[i].data.size();
+        entries[i].size = files[i].size;
+        entries[i].flags = files[i].flags;
+        entries[i].reserved = 0;
+        position += files[i].data.size();
+    }
+
+    std::ofstream out(arguments[1], std::ios::binary);
+    if(!out)
+    {
+        std::cout << "could not write " << arguments[1] << std::endl;
+        return 1;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(AssetPackEntry));
+    out.write(names.data(), names.size());
+    position = sizeof(header) + entries.size() * sizeof(AssetPackEntry) + names.size();
+    for(unsigned int i = 0; i < files.size(); i++)
+    {
+        pad(out, position);
+        out.write(files[i].data.data(), files[i].data.size());
+        position += files[i].data.size();
+    }
+    if(!out)
+    {
+        std::cout << "could not write " << arguments[1] << std::endl;
+        return 1;
+    }
+    std::cout << files.size() << " files, " << totalSize / 1024 << " KB packed into " << totalStored / 1024
+              << " KB" << std::endl;
+    return 0;
+}